@@ -0,0 +1,217 @@
+#include "config.h"
+#include "osmlr/output/geojson.hpp"
+#include "osmlr/output/path_plan.hpp"
+#include "osmlr/output/tiles.hpp"
+#include "osmlr/util/tile_writer.hpp"
+
+#include <valhalla/baldr/directededge.h>
+#include <valhalla/baldr/graphreader.h>
+#include <valhalla/midgard/logging.h>
+#include <valhalla/midgard/util.h>
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace vm = valhalla::midgard;
+namespace vb = valhalla::baldr;
+namespace bfs = boost::filesystem;
+
+/**
+ * Times the hot paths of generating OSMLR tiles on small, synthetic inputs,
+ * so that changes to them can be compared. Nothing here needs a Valhalla
+ * graph: edges and shapes are made up, and tiles are written to a temporary
+ * directory which is removed afterwards.
+ *
+ * Usage: osmlr_bench [scale], where scale multiplies the number of
+ * operations each benchmark does.
+ */
+
+namespace {
+
+// keeps results alive so that the work producing them isn't optimised away.
+volatile size_t g_sink = 0;
+
+// runs f(i) for i in [0, ops) and reports how long each call took.
+void run(const std::string &name, size_t ops, std::function<void(size_t)> f,
+         size_t bytes_per_op = 0) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < ops; ++i) {
+    f(i);
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  char line[256];
+  snprintf(line, sizeof(line), "%-48s %10zu ops %10.1f ns/op %12.0f ops/s",
+           name.c_str(), ops, seconds * 1.0e9 / ops, ops / seconds);
+  std::cout << line;
+  if (bytes_per_op > 0) {
+    snprintf(line, sizeof(line), " %8.1f MB/s", bytes_per_op * ops / seconds / 1.0e6);
+    std::cout << line;
+  }
+  std::cout << std::endl;
+}
+
+// a wiggly line of n points, about 10m apart.
+std::vector<vm::PointLL> make_shape(size_t n, float lng = -76.6f, float lat = 39.3f) {
+  std::vector<vm::PointLL> shape;
+  shape.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    shape.emplace_back(lng + i * 1.0e-4f, lat + (i % 2) * 5.0e-5f);
+  }
+  return shape;
+}
+
+vb::DirectedEdge make_edge(uint32_t length) {
+  vb::DirectedEdge e;
+  e.set_length(length);
+  e.set_classification(vb::RoadClass::kPrimary);
+  e.set_forwardaccess(vb::kAllAccess);
+  e.set_reverseaccess(vb::kAllAccess);
+  e.set_drive_on_right(true);
+  return e;
+}
+
+void bench_tile_writer(const bfs::path &dir, size_t scale) {
+  // many more tiles than file descriptors, visited in a random order, is
+  // the worst case for the LRU.
+  const size_t kTiles = 4096, kFds = 64;
+  const size_t ops = 200000 * scale;
+  const std::string data(200, 'x');
+
+  std::mt19937 rng(42);
+  std::vector<vb::GraphId> order(ops);
+  for (auto &id : order) {
+    id = vb::GraphId(rng() % kTiles, 2, 0);
+  }
+
+  for (size_t buffer : {size_t(0), size_t(16) << 20}) {
+    const bfs::path out = dir / ("writer-" + std::to_string(buffer));
+    osmlr::util::tile_writer writer(out.string(), "osmlr", kFds, buffer);
+    run("tile_writer::write_to " + std::string(buffer ? "16MB buffer" : "unbuffered") +
+        ", " + std::to_string(kFds) + " fds", ops,
+        [&](size_t i) { writer.write_to(order[i], data); }, data.size());
+    writer.close_all();
+    const auto &stats = writer.get_stats();
+    std::cout << "  opens = " << stats.opens << " evictions = " << stats.evictions
+              << " writes = " << stats.writes << std::endl;
+    bfs::remove_all(out);
+  }
+}
+
+void bench_tiles(vb::GraphReader &reader, const bfs::path &dir, size_t scale) {
+  osmlr::output::tiles out(reader, (dir / "tiles").string(), 64,
+                           std::make_shared<osmlr::util::buffer_budget>(size_t(16) << 20),
+                           1500000000, 12345);
+  const auto shape = make_shape(20);
+  std::vector<osmlr::output::lrp> lrps;
+  lrps.emplace_back(true, shape.front(), osmlr::output::bearing(shape),
+                    vb::RoadClass::kPrimary, osmlr::output::FormOfWay::kSingleCarriageway,
+                    vb::RoadClass::kPrimary, 150);
+  lrps.emplace_back(false, shape[10], 90, vb::RoadClass::kPrimary,
+                    osmlr::output::FormOfWay::kSingleCarriageway, vb::RoadClass::kPrimary, 100);
+  lrps.emplace_back(true, shape.back(), 0, vb::RoadClass::kPrimary,
+                    osmlr::output::FormOfWay::kSingleCarriageway, vb::RoadClass::kPrimary, 0);
+
+  run("tiles::output_segment, 3 LRPs", 100000 * scale, [&](size_t i) {
+    out.output_segment(lrps, vb::GraphId(i % 256, 2, 0));
+  });
+  out.finish();
+}
+
+void bench_geojson(vb::GraphReader &reader, const bfs::path &dir, size_t scale) {
+  osmlr::output::geojson out(reader, (dir / "geojson").string(), 64,
+                             std::make_shared<osmlr::util::buffer_budget>(size_t(16) << 20),
+                             1500000000, 12345,
+                             std::unordered_map<vb::GraphId, uint32_t>());
+
+  // a path of three whole edges, and a segment which is part of one edge
+  std::vector<vb::DirectedEdge> edges(3, make_edge(200));
+  osmlr::output::path_plan plan;
+  for (size_t i = 0; i < edges.size(); ++i) {
+    auto points = std::make_shared<const std::vector<vm::PointLL> >(
+      make_shape(10, -76.6f + i * 9.0e-4f));
+    plan.edges.push_back(osmlr::output::path_plan::edge{
+      vb::GraphId(i, 2, 0), nullptr, &edges[i], osmlr::util::shape_view(points, false)});
+  }
+  osmlr::output::path_plan::segment whole;
+  whole.begin = 0;
+  whole.end = edges.size();
+  whole.partial = false;
+  whole.start_at_node = whole.end_at_node = true;
+  whole.length = 600;
+  osmlr::output::path_plan::segment part = whole;
+  part.end = 1;
+  part.partial = true;
+  part.shape = make_shape(10);
+
+  run("geojson::output_segment, 3 edges of 10 points", 100000 * scale, [&](size_t i) {
+    whole.tile_id = vb::GraphId(i % 256, 2, 0);
+    out.output_segment(plan, whole);
+  });
+  run("geojson::output_segment, partial of 10 points", 100000 * scale, [&](size_t i) {
+    part.tile_id = vb::GraphId(i % 256, 2, 0);
+    out.output_segment(plan, part);
+  });
+  out.finish();
+}
+
+void bench_geometry(size_t scale) {
+  for (size_t n : {2, 16, 128}) {
+    const auto shape = make_shape(n);
+    const size_t ops = 2000000 * scale / n;
+    run("bearing, " + std::to_string(n) + " points", ops, [&](size_t) {
+      g_sink += osmlr::output::bearing(shape);
+    });
+    run("length, " + std::to_string(n) + " points", ops, [&](size_t) {
+      g_sink += size_t(vm::length(shape));
+    });
+  }
+}
+
+void bench_split(size_t scale) {
+  // an edge long enough to be cut into several segments
+  const auto shape = make_shape(400);
+  const uint32_t length = uint32_t(vm::length(shape));
+  run("split_shape, " + std::to_string(length) + "m edge of 400 points", 20000 * scale,
+      [&](size_t) {
+    g_sink += osmlr::output::split_shape(shape, length).size();
+  });
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+  size_t scale = argc > 1 ? std::max(1, atoi(argv[1])) : 1;
+  std::cout << "osmlr " VERSION " benchmarks, scale " << scale << std::endl;
+
+  const bfs::path dir = bfs::temp_directory_path() / bfs::unique_path("osmlr-bench-%%%%%%%%");
+  bfs::create_directories(dir);
+
+  // the outputs want a reader, but these benchmarks never read from it
+  boost::property_tree::ptree hierarchy_properties;
+  hierarchy_properties.put("tile_dir", (dir / "valhalla").string());
+  vb::GraphReader reader(hierarchy_properties);
+
+  try {
+    bench_tile_writer(dir, scale);
+    bench_tiles(reader, dir, scale);
+    bench_geojson(reader, dir, scale);
+    bench_geometry(scale);
+    bench_split(scale);
+  } catch (const std::exception &e) {
+    std::cerr << "Benchmark failed: " << e.what() << std::endl;
+    bfs::remove_all(dir);
+    return EXIT_FAILURE;
+  }
+
+  bfs::remove_all(dir);
+  return EXIT_SUCCESS;
+}
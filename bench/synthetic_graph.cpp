@@ -0,0 +1,487 @@
+#include "config.h"
+#include "osmlr/output/path_plan.hpp"
+#include "osmlr/output/tiles.hpp"
+#include "osmlr/util/compression.hpp"
+#include "osmlr/util/tile_writer.hpp"
+
+#include <valhalla/baldr/directededge.h>
+#include <valhalla/baldr/graphconstants.h>
+#include <valhalla/baldr/graphreader.h>
+#include <valhalla/baldr/nodeinfo.h>
+#include <valhalla/baldr/tilehierarchy.h>
+#include <valhalla/baldr/trafficassociation.h>
+#include <valhalla/midgard/logging.h>
+#include <valhalla/midgard/util.h>
+#include <valhalla/mjolnir/graphtilebuilder.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/program_options.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace vm = valhalla::midgard;
+namespace vb = valhalla::baldr;
+namespace vj = valhalla::mjolnir;
+namespace bpo = boost::program_options;
+namespace bpt = boost::property_tree;
+
+/**
+ * Writes a synthetic Valhalla graph, so that osmlr and geojson_osmlr can be
+ * run end to end at any scale without building a graph from OSM data.
+ *
+ * Each hierarchy level gets its own grid of two-way streets covering the
+ * tiles of that level which intersect the bounding box. The grid spacing of
+ * each level sets the density of the graph, and the nodes are moved about
+ * and the edges wiggled so that edge lengths and bearings vary. Every
+ * drivable edge is associated with OSMLR segments, one per piece of the edge
+ * as osmlr would split it, and the matching OSMLR tiles can be written too so
+ * that update mode has something to update.
+ *
+ * Everything is derived from the seed and the grid position, so the same
+ * options always give the same graph.
+ */
+
+namespace {
+
+// metres per degree of latitude.
+constexpr double kMetresPerDegree = 111319.5;
+
+// the most nodes along the side of a tile. 4 edges per node must fit in
+// the 21 bits of a GraphId's id.
+constexpr uint32_t kMaxNodesPerSide = 700;
+
+// directions out of a node, in the order its edges are stored. the opposite
+// of direction d is (d + 2) % 4.
+const int kDirRow[4] = {0, 1, 0, -1};
+const int kDirCol[4] = {1, 0, -1, 0};
+
+uint64_t mix(uint64_t x) {
+  // splitmix64 finaliser
+  x += 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+// a number in [0, 1) which depends only on its arguments.
+double unit(uint64_t seed, uint64_t a, uint64_t b = 0, uint64_t c = 0) {
+  return (mix(mix(mix(seed ^ a) ^ b) ^ c) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+struct settings {
+  uint64_t seed;
+  // node positions are moved up to this fraction of the grid cell, and edge
+  // shapes wiggle up to this fraction of it.
+  double jitter, wiggle;
+  uint32_t shape_points;
+  double oneway, associated;
+};
+
+// the grid of one hierarchy level. global rows and columns of nodes count
+// from the south west corner of the world, so a node's position doesn't
+// depend on which tiles are being generated.
+struct grid {
+  vb::TileLevel level;
+  uint32_t n;
+  int32_t min_row, max_row, min_col, max_col;
+  std::vector<vb::RoadClass> classes;
+  const settings *opts;
+
+  float cell() const { return level.tiles.TileSize() / n; }
+
+  bool exists(int64_t row, int64_t col) const {
+    return row >= int64_t(min_row) * n && row < int64_t(max_row + 1) * n &&
+           col >= int64_t(min_col) * n && col < int64_t(max_col + 1) * n;
+  }
+
+  uint32_t tile_of(int64_t row, int64_t col) const {
+    return uint32_t((row / n) * level.tiles.ncolumns() + col / n);
+  }
+
+  vb::GraphId node_id(int64_t row, int64_t col) const {
+    return vb::GraphId(tile_of(row, col), level.level, uint32_t((row % n) * n + col % n));
+  }
+
+  vm::PointLL node_ll(int64_t row, int64_t col) const {
+    const auto base = level.tiles.Base(tile_of(row, col));
+    const double dx = (unit(opts->seed, level.level, row, col) - 0.5) * opts->jitter;
+    const double dy = (unit(opts->seed, level.level, col, row) - 0.5) * opts->jitter;
+    return vm::PointLL(base.lng() + (col % n + 0.5 + dx) * cell(),
+                       base.lat() + (row % n + 0.5 + dy) * cell());
+  }
+
+  // the index of the edge going in direction d among the node's edges.
+  uint32_t local_index(int64_t row, int64_t col, int d) const {
+    uint32_t index = 0;
+    for (int i = 0; i < d; ++i) {
+      index += exists(row + kDirRow[i], col + kDirCol[i]);
+    }
+    return index;
+  }
+
+  // every 8th line of the grid is of the best class on the level, every
+  // other line of the next and the rest are of the worst.
+  vb::RoadClass line_class(int64_t line) const {
+    if (line % 8 == 0) return classes.front();
+    if (line % 2 == 0) return classes[std::min<size_t>(1, classes.size() - 1)];
+    return classes.back();
+  }
+
+  bool line_oneway(bool horizontal, int64_t line) const {
+    return unit(opts->seed, level.level, horizontal, line) < opts->oneway;
+  }
+
+  // the shape of the edge from the south or west node (row, col) to its
+  // neighbour to the east or north.
+  std::list<vm::PointLL> edge_shape(int64_t row, int64_t col, bool horizontal) const {
+    const auto a = node_ll(row, col);
+    const auto b = horizontal ? node_ll(row, col + 1) : node_ll(row + 1, col);
+    std::list<vm::PointLL> shape{a};
+    for (uint32_t i = 1; i <= opts->shape_points; ++i) {
+      const float t = float(i) / (opts->shape_points + 1);
+      const float off = (unit(opts->seed, level.level, row * 2 + horizontal, col * 64 + i) - 0.5) *
+        opts->wiggle * cell();
+      // move perpendicular to the edge
+      shape.emplace_back(a.lng() + (b.lng() - a.lng()) * t + (horizontal ? 0.0f : off),
+                         a.lat() + (b.lat() - a.lat()) * t + (horizontal ? off : 0.0f));
+    }
+    shape.push_back(b);
+    return shape;
+  }
+};
+
+struct counts {
+  std::atomic<uint64_t> nodes, edges, segments, associated;
+  counts() : nodes(0), edges(0), segments(0), associated(0) {}
+};
+
+// writes one Valhalla tile, associates its edges with OSMLR segments and,
+// if there's an output, writes the OSMLR tile for them.
+void build_tile(const grid &g, uint32_t tile_id, const std::string &tile_dir,
+                osmlr::output::tiles *out, counts &stats) {
+  const vb::GraphId base_id(tile_id, g.level.level, 0);
+  const int64_t row0 = int64_t(tile_id / g.level.tiles.ncolumns()) * g.n;
+  const int64_t col0 = int64_t(tile_id % g.level.tiles.ncolumns()) * g.n;
+
+  struct association {
+    uint32_t edge;
+    std::vector<vb::TrafficChunk> chunks;
+  };
+  std::vector<association> associations;
+  uint32_t segment_index = 0;
+
+  {
+    vj::GraphTileBuilder builder(tile_dir, base_id, false);
+    for (int64_t row = row0; row < row0 + g.n; ++row) {
+      for (int64_t col = col0; col < col0 + g.n; ++col) {
+        vb::NodeInfo node;
+        node.set_latlng(g.node_ll(row, col));
+        node.set_edge_index(builder.directededges().size());
+        node.set_access(vb::kAllAccess);
+        const auto node_id = g.node_id(row, col);
+
+        for (int d = 0; d < 4; ++d) {
+          const int64_t end_row = row + kDirRow[d], end_col = col + kDirCol[d];
+          if (!g.exists(end_row, end_col)) {
+            continue;
+          }
+          // the edge's shape and way run from its south or west node
+          const bool horizontal = (kDirRow[d] == 0);
+          const bool forward = (d < 2);
+          const int64_t a_row = std::min(row, end_row), a_col = std::min(col, end_col);
+          const int64_t line = horizontal ? a_row : a_col;
+          const auto lls = g.edge_shape(a_row, a_col, horizontal);
+          const auto end_id = g.node_id(end_row, end_col);
+
+          vb::DirectedEdge edge;
+          edge.set_endnode(end_id);
+          edge.set_length(std::max(1u, uint32_t(std::round(vm::length(
+            std::vector<vm::PointLL>(lls.begin(), lls.end()))))));
+          edge.set_use(vb::Use::kRoad);
+          edge.set_speed(line % 8 == 0 ? 80 : 40);
+          edge.set_classification(g.line_class(line));
+          edge.set_localedgeidx(g.local_index(row, col, d));
+          edge.set_opp_local_idx(g.local_index(end_row, end_col, (d + 2) % 4));
+          edge.set_forward(forward);
+          edge.set_drive_on_right(true);
+          uint32_t forward_access = vb::kAllAccess, reverse_access = vb::kAllAccess;
+          if (g.line_oneway(horizontal, line)) {
+            (forward ? reverse_access : forward_access) = 0;
+          }
+          edge.set_forwardaccess(forward_access);
+          edge.set_reverseaccess(reverse_access);
+
+          bool added = false;
+          const uint64_t way_id = (uint64_t(g.level.level) << 48) |
+            (uint64_t(horizontal) << 47) | uint64_t(line);
+          const uint32_t edge_key = uint32_t(mix((uint64_t(a_row) << 32) ^ uint64_t(a_col)) * 2 + horizontal);
+          const auto &a_id = forward ? node_id : end_id;
+          const auto &b_id = forward ? end_id : node_id;
+          edge.set_edgeinfo_offset(builder.AddEdgeInfo(edge_key, a_id, b_id, way_id, lls,
+                                                       std::vector<std::string>(), 0, added));
+
+          // one OSMLR segment for each piece of a drivable edge, as osmlr
+          // would split it
+          if (forward_access & vb::kVehicularAccess) {
+            std::vector<vm::PointLL> shape(lls.begin(), lls.end());
+            if (!forward) {
+              std::reverse(shape.begin(), shape.end());
+            }
+            auto pieces = osmlr::output::split_shape(std::move(shape), edge.length());
+            pieces.erase(std::remove_if(pieces.begin(), pieces.end(),
+                                        [](const std::vector<vm::PointLL> &p) { return p.size() < 2; }),
+                         pieces.end());
+
+            association assoc{uint32_t(builder.directededges().size()), {}};
+            for (size_t i = 0; i < pieces.size(); ++i) {
+              const vb::GraphId segment_id(tile_id, g.level.level, segment_index++);
+              if (unit(g.opts->seed, segment_id.value, 1) < g.opts->associated) {
+                assoc.chunks.emplace_back(segment_id, float(i) / pieces.size(),
+                                          float(i + 1) / pieces.size(), true, true);
+              }
+              if (out) {
+                const auto fow = osmlr::output::form_of_way(&edge);
+                const auto frc = edge.classification();
+                std::vector<osmlr::output::lrp> lrps;
+                lrps.emplace_back(i == 0, pieces[i].front(), osmlr::output::bearing(pieces[i]),
+                                  frc, fow, frc, uint32_t(vm::length(pieces[i])));
+                lrps.emplace_back(i + 1 == pieces.size(), pieces[i].back(), 0, frc, fow, frc, 0);
+                out->output_segment(lrps, base_id);
+              }
+            }
+            stats.segments += pieces.size();
+            stats.associated += assoc.chunks.size();
+            if (!assoc.chunks.empty()) {
+              associations.push_back(std::move(assoc));
+            }
+          }
+          builder.directededges().push_back(edge);
+        }
+
+        node.set_edge_count(builder.directededges().size() - node.edge_index());
+        builder.nodes().push_back(node);
+      }
+    }
+    stats.nodes += builder.nodes().size();
+    stats.edges += builder.directededges().size();
+    builder.StoreTileData();
+  }
+
+  // the associations are added to the stored tile, as valhalla does when
+  // associating real OSMLR segments.
+  if (!associations.empty()) {
+    vj::GraphTileBuilder builder(tile_dir, base_id, true);
+    for (const auto &assoc : associations) {
+      const vb::GraphId edge_id(tile_id, g.level.level, assoc.edge);
+      if (assoc.chunks.size() == 1) {
+        builder.AddTrafficSegment(edge_id, assoc.chunks.front());
+      } else {
+        builder.AddTrafficSegments(edge_id, assoc.chunks);
+      }
+    }
+    builder.UpdateTrafficSegments(true);
+  }
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+  bpo::options_description options("synthetic_graph " VERSION "\n"
+                                   "\n"
+                                   " Usage: synthetic_graph [options]\n"
+                                   "\n"
+                                   "synthetic_graph writes a synthetic Valhalla graph, with "
+                                   "OSMLR segments associated to its edges, for testing osmlr "
+                                   "and geojson_osmlr at scale. "
+                                   "\n"
+                                   "\n");
+
+  settings opts;
+  unsigned int concurrency, max_fds;
+  unsigned int default_concurrency = std::thread::hardware_concurrency();
+  std::string tile_dir, bbox, spacing, config_file, output_osmlr_dir, compression_name;
+  options.add_options()
+    ("help,h", "Print this help message.")
+    ("version,v", "Print the version of this software.")
+    ("tile-dir,d", bpo::value<std::string>(&tile_dir), "Required. The directory to write the Valhalla tiles to.")
+    ("bbox,b", bpo::value<std::string>(&bbox)->default_value("-77,38.5,-76,39.5"), "Comma separated min lng, min lat, max lng and max lat of the area to cover. Every tile of each level which intersects it is written.")
+    ("spacing,s", bpo::value<std::string>(&spacing)->default_value("8000,2000,250"), "Comma separated metres between intersections on levels 0, 1 and 2. Smaller makes a denser graph.")
+    ("shape-points", bpo::value<uint32_t>(&opts.shape_points)->default_value(4), "Number of shape points between the ends of each edge.")
+    ("jitter", bpo::value<double>(&opts.jitter)->default_value(0.3), "How far nodes are moved from the grid, as a fraction of the spacing, so that edge lengths vary.")
+    ("wiggle", bpo::value<double>(&opts.wiggle)->default_value(0.2), "How far edge shapes stray from a straight line, as a fraction of the spacing.")
+    ("oneway", bpo::value<double>(&opts.oneway)->default_value(0.1), "Fraction of streets which are one way.")
+    ("associated", bpo::value<double>(&opts.associated)->default_value(1.0), "Fraction of OSMLR segments which are associated with their edges. Segments which aren't will be deprecated by an update.")
+    ("seed", bpo::value<uint64_t>(&opts.seed)->default_value(1), "Seed for the positions and shapes.")
+    ("output-tiles,T", bpo::value<std::string>(&output_osmlr_dir), "Optional. The base path to write OSMLR tiles of the associated segments to, or a .pack archive, for use as the input of an update.")
+    ("compression", bpo::value<std::string>(&compression_name)->default_value("none"), "Compression of the output OSMLR tiles: none, gzip or zstd.")
+    ("max-fds,f", bpo::value<unsigned int>(&max_fds)->default_value(512), "Maximum number of files to have open in each output.")
+    ("config,c", bpo::value<std::string>(&config_file), "Optional. A file to write a Valhalla configuration for the graph to, to give to osmlr and geojson_osmlr.")
+    ("threads,t", bpo::value<unsigned int>(&concurrency)->default_value(default_concurrency), "Concurrency, number of threads. Each thread writes whole tiles.");
+
+  bpo::variables_map vm;
+  try {
+    bpo::store(bpo::command_line_parser(argc, argv).options(options).run(), vm);
+    bpo::notify(vm);
+  }
+  catch (std::exception &e) {
+    std::cerr << "Unable to parse command line options because: " << e.what()
+              << "\n" << "This is a bug, please report it at " PACKAGE_BUGREPORT
+              << "\n";
+    return EXIT_FAILURE;
+  }
+
+  if (vm.count("help") || !vm.count("tile-dir")) {
+    std::cout << options << "\n";
+    return EXIT_SUCCESS;
+  }
+
+  if (vm.count("version")) {
+    std::cout << "synthetic_graph " << VERSION << "\n";
+    return EXIT_SUCCESS;
+  }
+
+  valhalla::midgard::logging::Configure({{"type","std_err"},{"color","true"}});
+
+  std::vector<std::string> parts;
+  std::vector<float> box;
+  std::vector<float> spacings;
+  try {
+    boost::split(parts, bbox, boost::is_any_of(","));
+    for (const auto &p : parts) box.push_back(std::stof(p));
+    boost::split(parts, spacing, boost::is_any_of(","));
+    for (const auto &p : parts) spacings.push_back(std::stof(p));
+  } catch (const std::exception &) {
+    box.clear();
+  }
+  if (box.size() != 4 || box[0] >= box[2] || box[1] >= box[3]) {
+    LOG_ERROR("The bounding box must be min lng,min lat,max lng,max lat");
+    return EXIT_FAILURE;
+  }
+  if (spacings.empty() || *std::min_element(spacings.begin(), spacings.end()) <= 0.0f) {
+    LOG_ERROR("The spacing must be one or more positive distances in metres");
+    return EXIT_FAILURE;
+  }
+  osmlr::util::compression codec;
+  try {
+    codec = osmlr::util::parse_compression(compression_name);
+  } catch (const std::exception& e) {
+    LOG_ERROR(e.what());
+    return EXIT_FAILURE;
+  }
+  concurrency = std::max(static_cast<unsigned int>(1), concurrency);
+
+  // the classes of road on each level, best first
+  const std::vector<std::vector<vb::RoadClass> > level_classes = {
+    {vb::RoadClass::kMotorway, vb::RoadClass::kTrunk, vb::RoadClass::kPrimary},
+    {vb::RoadClass::kSecondary, vb::RoadClass::kTertiary},
+    {vb::RoadClass::kUnclassified, vb::RoadClass::kResidential, vb::RoadClass::kServiceOther}};
+
+  // a grid for each level that there's a spacing for, and the tiles to write
+  std::vector<grid> grids;
+  std::vector<std::pair<size_t, uint32_t> > work;
+  for (const auto &level : vb::TileHierarchy::levels()) {
+    const auto &l = level.second;
+    if (l.level >= spacings.size() || l.level >= level_classes.size()) {
+      continue;
+    }
+    grid g;
+    g.level = l;
+    g.classes = level_classes[l.level];
+    g.opts = &opts;
+    const double nodes = l.tiles.TileSize() * kMetresPerDegree / spacings[l.level];
+    g.n = uint32_t(std::max(1.0, std::round(nodes)));
+    if (g.n > kMaxNodesPerSide) {
+      LOG_WARN("Spacing for level " + std::to_string(l.level) + " is too small, using " +
+               std::to_string(l.tiles.TileSize() * kMetresPerDegree / kMaxNodesPerSide) + "m");
+      g.n = kMaxNodesPerSide;
+    }
+    const auto sw = l.tiles.TileId(box[1], box[0]);
+    const auto ne = l.tiles.TileId(box[3], box[2]);
+    g.min_row = sw / l.tiles.ncolumns();
+    g.min_col = sw % l.tiles.ncolumns();
+    g.max_row = ne / l.tiles.ncolumns();
+    g.max_col = ne % l.tiles.ncolumns();
+    for (int32_t row = g.min_row; row <= g.max_row; ++row) {
+      for (int32_t col = g.min_col; col <= g.max_col; ++col) {
+        work.emplace_back(grids.size(), uint32_t(row * l.tiles.ncolumns() + col));
+      }
+    }
+    LOG_INFO("Level " + std::to_string(l.level) + ": " +
+             std::to_string((g.max_row - g.min_row + 1) * (g.max_col - g.min_col + 1)) +
+             " tiles of " + std::to_string(g.n * g.n) + " nodes");
+    grids.push_back(g);
+  }
+
+  bpt::ptree config;
+  config.put("mjolnir.tile_dir", tile_dir);
+  config.put("mjolnir.logging.type", "std_err");
+  if (!config_file.empty()) {
+    bpt::write_json(config_file, config);
+  }
+
+  // each thread writes whole tiles, so that no tile is written by two of
+  // them, with its own output of OSMLR tiles.
+  counts stats;
+  std::atomic<size_t> next(0);
+  std::exception_ptr error;
+  std::mutex error_lock;
+  const time_t creation_date = time(nullptr);
+  auto worker = [&]() {
+    try {
+      vb::GraphReader reader(config.get_child("mjolnir"));
+      std::unique_ptr<osmlr::output::tiles> out;
+      if (!output_osmlr_dir.empty()) {
+        out.reset(new osmlr::output::tiles(reader, output_osmlr_dir, max_fds, nullptr,
+                                           creation_date, 0, codec));
+      }
+      for (size_t i = next++; i < work.size(); i = next++) {
+        build_tile(grids[work[i].first], work[i].second, tile_dir, out.get(), stats);
+      }
+      if (out) {
+        out->finish();
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> guard(error_lock);
+      if (!error) {
+        error = std::current_exception();
+      }
+      next = work.size();
+    }
+  };
+  std::vector<std::thread> threads;
+  for (unsigned int i = 0; i < concurrency; ++i) {
+    threads.emplace_back(worker);
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  if (error) {
+    try {
+      std::rethrow_exception(error);
+    } catch (const std::exception &e) {
+      LOG_ERROR(std::string("Unable to write the graph: ") + e.what());
+      return EXIT_FAILURE;
+    }
+  }
+  if (!output_osmlr_dir.empty()) {
+    osmlr::util::tile_writer::write_index(output_osmlr_dir);
+  }
+
+  LOG_INFO("Wrote " + std::to_string(work.size()) + " tiles with " +
+           std::to_string(stats.nodes) + " nodes, " + std::to_string(stats.edges) +
+           " directed edges and " + std::to_string(stats.segments) + " segments, " +
+           std::to_string(stats.associated) + " of them associated");
+  return EXIT_SUCCESS;
+}
@@ -3,8 +3,10 @@
 
 #include <osmlr/output/output.hpp>
 #include <osmlr/util/tile_writer.hpp>
+#include <osmlr/util/json_writer.hpp>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <ctime>
 
 namespace osmlr {
@@ -12,21 +14,29 @@ namespace output {
 
 struct geojson : public output {
   geojson(valhalla::baldr::GraphReader &reader, std::string base_dir, size_t max_fds,
-          time_t creation_date, const uint64_t osm_changeset_id,
-          const std::unordered_map<valhalla::baldr::GraphId, uint32_t> tile_index);
+          std::shared_ptr<util::buffer_budget> budget, time_t creation_date,
+          const uint64_t osm_changeset_id,
+          const std::unordered_map<valhalla::baldr::GraphId, uint32_t> tile_index,
+          unsigned int precision = 7,
+          util::compression codec = util::compression::kNone);
   virtual ~geojson();
 
-  void add_path(const valhalla::baldr::merge::path &);
-  void output_segment(const valhalla::baldr::merge::path &p);
-  void output_segment(const std::vector<valhalla::midgard::PointLL>& shape,
-                      const valhalla::baldr::DirectedEdge* edge,
-                      const valhalla::baldr::GraphId& edgeid);
-  void split_path(const valhalla::baldr::merge::path& p, const uint32_t total_length);
+  void add_path(const path_plan &plan);
+  void output_segment(const path_plan &plan, const path_plan::segment &seg);
   std::unordered_map<valhalla::baldr::GraphId, uint32_t> update_tiles(
-      const std::vector<std::string>& tiles);
+      const std::vector<std::string>& tiles,
+      const boost::property_tree::ptree &hierarchy_properties, size_t threads);
   void finish();
+  void checkpoint(std::ostream &out);
+  void resume(std::istream &in, uint8_t level);
 
 private:
+  std::unordered_map<valhalla::baldr::GraphId, uint32_t>::iterator
+  begin_feature(const valhalla::baldr::GraphId &tile_id);
+  void end_feature(const valhalla::baldr::GraphId &tile_id, uint32_t id,
+                   valhalla::baldr::RoadClass best_frc, bool oneway,
+                   bool drive_on_right);
+
   time_t m_creation_date;
   std::string m_date_str;
   std::unordered_map<valhalla::baldr::GraphId, uint32_t> m_tile_index;
@@ -34,6 +44,11 @@ private:
   valhalla::baldr::GraphReader &m_reader;
   util::tile_writer m_writer;
   std::unordered_map<valhalla::baldr::GraphId, uint32_t> m_tile_path_ids;
+  // where the existing tiles are read from when updating.
+  std::unordered_map<valhalla::baldr::GraphId, std::string> m_tile_paths;
+  // tiles whose feature collection is open, but has no features in it yet.
+  std::unordered_set<valhalla::baldr::GraphId> m_empty_collections;
+  util::json_writer m_json;
 };
 
 } // namespace output
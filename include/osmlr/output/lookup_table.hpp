@@ -0,0 +1,53 @@
+#ifndef OSMLR_OUTPUT_LOOKUP_TABLE_HPP
+#define OSMLR_OUTPUT_LOOKUP_TABLE_HPP
+
+#include <osmlr/output/output.hpp>
+#include <osmlr/util/segment_table.hpp>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace osmlr {
+namespace output {
+
+/**
+ * Writes a util::segment_table of every segment to a single file.
+ *
+ * Unlike the tile outputs, one of these is shared by all the levels being
+ * worked on, so add_path and update_tiles may be called from several threads
+ * at once. The records are kept in memory until finish() writes the table.
+ */
+struct lookup_table : public output {
+  lookup_table(valhalla::baldr::GraphReader &reader, std::string file_name,
+               time_t creation_date, const uint64_t osm_changeset_id);
+  virtual ~lookup_table();
+
+  void add_path(const path_plan &plan);
+  // reads the existing .osmlr tiles, which must be done before the tiles
+  // output updates them, so that the ids here carry on from theirs.
+  std::unordered_map<valhalla::baldr::GraphId, uint32_t> update_tiles(
+      const std::vector<std::string>& tiles,
+      const boost::property_tree::ptree &hierarchy_properties, size_t threads);
+  void finish();
+
+private:
+  typedef util::segment_table::record record;
+
+  record make_record(const path_plan &plan, const path_plan::segment &seg) const;
+
+  valhalla::baldr::GraphReader &m_reader;
+  std::string m_file_name;
+  time_t m_creation_date;
+  uint64_t m_osm_changeset_id;
+
+  std::mutex m_lock;
+  // the records for each tile, in id order.
+  std::unordered_map<valhalla::baldr::GraphId, std::vector<record> > m_records;
+};
+
+} // namespace output
+} // namespace osmlr
+
+#endif /* OSMLR_OUTPUT_LOOKUP_TABLE_HPP */
@@ -0,0 +1,66 @@
+#ifndef OSMLR_OUTPUT_MVT_HPP
+#define OSMLR_OUTPUT_MVT_HPP
+
+#include <osmlr/output/output.hpp>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace osmlr {
+namespace output {
+
+/**
+ * Writes the segments as Mapbox Vector Tiles, in a single "osmlr" layer at
+ * each of the given zoom levels, to base_dir/z/x/y.mvt.
+ *
+ * Each feature has the segment's geometry and the properties that the
+ * GeoJSON output writes. Geometries aren't clipped to the tile: a segment is
+ * put whole into every tile its box touches, as the spec allows coordinates
+ * outside the extent. Web mercator tiles don't line up with Valhalla's, so
+ * one of these is shared by all the levels being worked on, and the tiles
+ * are built in memory until finish() writes them.
+ */
+struct mvt : public output {
+  mvt(valhalla::baldr::GraphReader &reader, std::string base_dir,
+      std::vector<unsigned int> zooms, uint32_t extent = 4096);
+  virtual ~mvt();
+
+  void add_path(const path_plan &plan);
+  // reads the existing .osmlr tiles, which must be done before the tiles
+  // output updates them. their shapes aren't stored, so existing segments are
+  // drawn through their LRPs, and without the oneway and drive_on_right
+  // properties.
+  std::unordered_map<valhalla::baldr::GraphId, uint32_t> update_tiles(
+      const std::vector<std::string>& tiles,
+      const boost::property_tree::ptree &hierarchy_properties, size_t threads);
+  void finish();
+
+private:
+  // the features of a tile's layer, and the property values they use.
+  struct layer {
+    std::string features;
+    std::vector<std::string> values;
+    std::unordered_map<std::string, uint32_t> value_index;
+  };
+
+  struct feature;
+  void add_feature(const feature &f);
+  uint32_t add_value(layer &l, const std::string &value);
+
+  valhalla::baldr::GraphReader &m_reader;
+  std::string m_base_dir;
+  std::vector<unsigned int> m_zooms;
+  uint32_t m_extent;
+
+  std::mutex m_lock;
+  // keyed by zoom, x and y packed together.
+  std::unordered_map<uint64_t, layer> m_layers;
+  // the next id in each tile, to number new segments as the tiles output does.
+  std::unordered_map<valhalla::baldr::GraphId, uint32_t> m_counts;
+};
+
+} // namespace output
+} // namespace osmlr
+
+#endif /* OSMLR_OUTPUT_MVT_HPP */
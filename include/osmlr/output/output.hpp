@@ -2,6 +2,14 @@
 #define OSMLR_OUTPUT_OUTPUT_HPP
 
 #include <valhalla/baldr/merge.h>
+#include <valhalla/baldr/graphreader.h>
+#include <osmlr/output/path_plan.hpp>
+#include <osmlr/util/tile_writer.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <unordered_set>
 
 namespace osmlr {
 namespace output {
@@ -12,10 +20,56 @@ namespace output {
 struct output {
   virtual ~output();
 
-  virtual void add_path(const valhalla::baldr::merge::path &) = 0;
+  virtual void add_path(const path_plan &) = 0;
+  // brings the existing tiles up to date with the Valhalla tiles, using up to
+  // threads threads. each extra thread reads tiles with its own GraphReader,
+  // made from hierarchy_properties.
   virtual std::unordered_map<valhalla::baldr::GraphId, uint32_t> update_tiles(
-      const std::vector<std::string>& tiles) = 0;
+      const std::vector<std::string>& tiles,
+      const boost::property_tree::ptree &hierarchy_properties,
+      size_t threads) = 0;
   virtual void finish() = 0;
+
+  // writes what's needed to carry on from here after a restart, once
+  // everything output so far is on disk. resume() reads it back for a level,
+  // cutting that level's tiles back to what they were at the checkpoint. by
+  // default an output can't be checkpointed and both of these throw.
+  virtual void checkpoint(std::ostream &out);
+  virtual void resume(std::istream &in, uint8_t level);
+
+protected:
+  // the number of tiles at the start of the list which have a Valhalla tile.
+  // updating stops at the first one which doesn't.
+  static size_t count_existing(const std::vector<std::string> &tiles,
+                               valhalla::baldr::GraphReader &reader);
+
+  // the OSMLR segments which edges in the Valhalla tile are associated with.
+  static std::unordered_set<valhalla::baldr::GraphId> traffic_segments(
+      const valhalla::baldr::GraphTile *tile);
+
+  // calls work(reader, i) for each i in [0, count), spread over up to threads
+  // threads. with a single thread the work is done on this one with the given
+  // reader. the first exception thrown by the work is rethrown once all the
+  // threads have stopped.
+  static void parallel_for(
+      size_t count, valhalla::baldr::GraphReader &reader,
+      const boost::property_tree::ptree &hierarchy_properties, size_t threads,
+      const std::function<void(valhalla::baldr::GraphReader &, size_t)> &work);
+
+  // adds the counters of a tile writer to the metrics registry, as
+  // name.opens, name.bytes_written and so on.
+  static void record_writer_stats(const std::string &name,
+                                  const util::tile_writer::stats &stats);
+
+  // checkpoint and resume for outputs which number the segments in each tile
+  // they write. a line per tile, with the next number and the size of the
+  // tile's file, then an end marker.
+  static void checkpoint_tiles(
+      std::ostream &out,
+      const std::unordered_map<valhalla::baldr::GraphId, uint32_t> &counts,
+      util::tile_writer &writer);
+  static std::unordered_map<valhalla::baldr::GraphId, uint32_t> resume_tiles(
+      std::istream &in, uint8_t level, util::tile_writer &writer);
 };
 
 } // namespace output
@@ -0,0 +1,96 @@
+#ifndef OSMLR_OUTPUT_PATH_PLAN_HPP
+#define OSMLR_OUTPUT_PATH_PLAN_HPP
+
+#include <valhalla/baldr/graphreader.h>
+#include <valhalla/baldr/merge.h>
+#include <valhalla/midgard/pointll.h>
+#include <osmlr/util/shape_cache.hpp>
+#include <unordered_set>
+#include <vector>
+
+namespace osmlr {
+namespace output {
+
+// Minimum length for an OSMLR segment
+constexpr uint32_t kMinimumLength = 5;
+
+// Maximum length for an OSMLR segment
+constexpr uint32_t kMaximumLength = 1000;
+
+// Cuts the shape of an edge which is length metres long into pieces of
+// equal length, each shorter than kMaximumLength. Pieces may be empty if the
+// shape is shorter than the edge's length says.
+std::vector<std::vector<valhalla::midgard::PointLL> > split_shape(
+    std::vector<valhalla::midgard::PointLL> shape, uint32_t length);
+
+/**
+ * A merged path resolved against the graph and split into the OSMLR segments
+ * which will be written for it.
+ *
+ * All the graph lookups, shape decoding and split decisions for a path are
+ * made here, once, and every output consumes the result. This means that the
+ * outputs can't disagree about which segments there are, and so about their
+ * ids.
+ */
+struct path_plan {
+  struct edge {
+    valhalla::baldr::GraphId id;
+    const valhalla::baldr::GraphTile *tile;
+    const valhalla::baldr::DirectedEdge *directededge;
+    // shape in the direction of travel, filled in by split().
+    util::shape_view shape;
+  };
+
+  struct segment {
+    // the tile which the segment's id is allocated in.
+    valhalla::baldr::GraphId tile_id;
+    // the edges the segment runs along, as the range [begin, end) of edges.
+    size_t begin, end;
+    // true if the segment is only part of a single long edge, in which case
+    // shape is the part of the edge's shape it covers.
+    bool partial;
+    bool start_at_node, end_at_node;
+    std::vector<valhalla::midgard::PointLL> shape;
+    // for segments made of whole edges, the total length of the edges and the
+    // location of the node at the end of the last one.
+    uint32_t length;
+    valhalla::midgard::PointLL end_ll;
+  };
+
+  valhalla::baldr::GraphId start;
+  std::vector<edge> edges;
+  std::vector<segment> segments;
+
+  // looks up the edges of a merged path, which is enough to decide whether
+  // the path is wanted before doing the rest of the work in split().
+  void resolve(valhalla::baldr::GraphReader &reader,
+               const valhalla::baldr::merge::path &p);
+
+  // gets the edge shapes and splits the path into segments no longer than
+  // kMaximumLength. a path made of a single very short edge gets no segments.
+  void split(valhalla::baldr::GraphReader &reader, util::shape_cache &shapes);
+
+  // forgets which tiles the reader has loaded, for when its cache is
+  // cleared. the edges of the current path are no longer valid after that.
+  void clear_tiles();
+
+private:
+  // gets a tile from the reader, counting in the metrics whether the reader
+  // had to load it. a tile is taken to be loaded the first time this plan
+  // asks for it since the reader's cache was last cleared.
+  const valhalla::baldr::GraphTile *get_tile(valhalla::baldr::GraphReader &reader,
+                                             valhalla::baldr::GraphId id);
+  std::unordered_set<uint64_t> m_loaded_tiles;
+  // consecutive edges are usually in the same tile.
+  uint64_t m_last_tile = ~uint64_t(0);
+
+  void add_edges(valhalla::baldr::GraphReader &reader,
+                 valhalla::baldr::GraphId start_node, size_t begin, size_t end);
+  void add_partial(size_t index, std::vector<valhalla::midgard::PointLL> &&shape,
+                   bool start_at_node, bool end_at_node);
+};
+
+} // namespace output
+} // namespace osmlr
+
+#endif /* OSMLR_OUTPUT_PATH_PLAN_HPP */
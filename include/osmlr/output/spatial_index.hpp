@@ -0,0 +1,47 @@
+#ifndef OSMLR_OUTPUT_SPATIAL_INDEX_HPP
+#define OSMLR_OUTPUT_SPATIAL_INDEX_HPP
+
+#include <osmlr/output/output.hpp>
+#include <osmlr/util/segment_index.hpp>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace osmlr {
+namespace output {
+
+/**
+ * Writes a util::segment_index over the bounding boxes of all the segments
+ * to a single file.
+ *
+ * Like lookup_table, one of these is shared by all the levels being worked
+ * on, and the boxes are kept in memory until finish() builds the index.
+ */
+struct spatial_index : public output {
+  spatial_index(valhalla::baldr::GraphReader &reader, std::string file_name);
+  virtual ~spatial_index();
+
+  void add_path(const path_plan &plan);
+  // reads the existing .osmlr tiles, which must be done before the tiles
+  // output updates them. their shapes aren't stored, so existing segments are
+  // indexed by the box around their LRPs.
+  std::unordered_map<valhalla::baldr::GraphId, uint32_t> update_tiles(
+      const std::vector<std::string>& tiles,
+      const boost::property_tree::ptree &hierarchy_properties, size_t threads);
+  void finish();
+
+private:
+  valhalla::baldr::GraphReader &m_reader;
+  std::string m_file_name;
+
+  std::mutex m_lock;
+  std::vector<util::segment_index::item> m_items;
+  // the next id in each tile, to number new segments as the tiles output does.
+  std::unordered_map<valhalla::baldr::GraphId, uint32_t> m_counts;
+};
+
+} // namespace output
+} // namespace osmlr
+
+#endif /* OSMLR_OUTPUT_SPATIAL_INDEX_HPP */
@@ -4,6 +4,7 @@
 #include <unordered_map>
 #include <ctime>
 #include <osmlr/output/output.hpp>
+#include <osmlr/util/metrics.hpp>
 #include <osmlr/util/tile_writer.hpp>
 
 namespace osmlr {
@@ -46,23 +47,29 @@ struct lrp {
     {}
 };
 
+// the OpenLR form of way for an edge.
+FormOfWay form_of_way(const valhalla::baldr::DirectedEdge *e);
+
+// the bearing, in whole degrees, 20m along the start of the shape.
+uint16_t bearing(const std::vector<valhalla::midgard::PointLL> &shape);
+uint16_t bearing(const util::shape_view &shape);
+
 struct tiles : public output {
   tiles(valhalla::baldr::GraphReader &reader, std::string base_dir, size_t max_fds,
-        time_t creation_date, const uint64_t osm_changeset_id,
+        std::shared_ptr<util::buffer_budget> budget, time_t creation_date,
+        const uint64_t osm_changeset_id,
+        util::compression codec = util::compression::kNone,
         uint32_t max_length = 15000);
   virtual ~tiles();
 
-  void add_path(const valhalla::baldr::merge::path &p);
-  void split_path(const valhalla::baldr::merge::path &p, const uint32_t total_length);
-  void output_segment(const valhalla::baldr::merge::path &p);
-  void output_segment(const std::vector<valhalla::midgard::PointLL>& shape,
-                      const valhalla::baldr::DirectedEdge* edge,
-                      const valhalla::baldr::GraphId& edgeid,
-                      const bool start_at_node, const bool end_at_node);
+  void add_path(const path_plan &plan);
   void output_segment(std::vector<lrp>& lrps, const valhalla::baldr::GraphId& tile_id);
   std::unordered_map<valhalla::baldr::GraphId, uint32_t> update_tiles(
-      const std::vector<std::string>& tiles);
+      const std::vector<std::string>& tiles,
+      const boost::property_tree::ptree &hierarchy_properties, size_t threads);
   void finish();
+  void checkpoint(std::ostream &out);
+  void resume(std::istream &in, uint8_t level);
 
 private:
   time_t m_creation_date;
@@ -73,7 +80,17 @@ private:
 
   std::unordered_map<valhalla::baldr::GraphId, uint32_t> m_counts;
 
-  std::vector<lrp> build_segment_descriptor(const valhalla::baldr::merge::path &p,const uint32_t level);
+  // statistics for each level, which are recorded in the metrics registry and
+  // logged by finish().
+  struct level_metrics {
+    explicit level_metrics(uint32_t level);
+    util::metrics::histogram length, segments_per_tile;
+    util::metrics::counter still_valid, deprecated, short_segments, long_segments, chunks;
+  };
+  std::unordered_map<uint32_t, level_metrics> m_levels;
+  level_metrics &metrics_for(uint32_t level);
+
+  std::vector<lrp> build_segment_descriptor(const path_plan &plan, const path_plan::segment &s);
   std::vector<lrp> build_segment_descriptor(const std::vector<valhalla::midgard::PointLL>& shape,
                                             const valhalla::baldr::DirectedEdge* edge,
                                             const bool start_at_node,
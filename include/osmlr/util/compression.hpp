@@ -0,0 +1,43 @@
+#ifndef OSMLR_UTIL_COMPRESSION_HPP
+#define OSMLR_UTIL_COMPRESSION_HPP
+
+#include <string>
+#include <sys/uio.h>
+
+namespace osmlr {
+namespace util {
+
+/**
+ * Compression of tile files.
+ *
+ * Each write to a compressed tile is a complete gzip member or zstd frame,
+ * and both formats allow members or frames to be concatenated. So tiles can
+ * still be added to by appending, and reading a tile gives everything that
+ * was written to it, in order.
+ */
+enum class compression { kNone, kGzip, kZstd };
+
+// parses "none", "gzip" or "zstd".
+compression parse_compression(const std::string &name);
+
+// the suffix added to the names of files with the compression, e.g: ".gz".
+std::string compression_suffix(compression codec);
+
+// the compression of a file, going by its name.
+compression compression_of(const std::string &file_name);
+
+// the file name without any compression suffix.
+std::string uncompressed_name(const std::string &file_name);
+
+// appends the pieces of data to out as a single gzip member or zstd frame.
+void compress(compression codec, const iovec *iov, size_t iovcnt, std::string &out);
+
+// if the data is compressed, which is told from its first bytes rather than
+// a file name, appends all of it to out uncompressed and returns true.
+// returns false if the data isn't compressed.
+bool decompress(const char *data, size_t size, std::string &out);
+
+} // namespace util
+} // namespace osmlr
+
+#endif /* OSMLR_UTIL_COMPRESSION_HPP */
@@ -0,0 +1,41 @@
+#ifndef OSMLR_UTIL_FEATURE_COLLECTION_HPP
+#define OSMLR_UTIL_FEATURE_COLLECTION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace osmlr {
+namespace util {
+
+// The byte range of a feature within a GeoJSON FeatureCollection, and the
+// OSMLR id in its properties.
+struct feature_range {
+  size_t begin, end;
+  uint64_t osmlr_id;
+};
+
+// Where the features are within a GeoJSON FeatureCollection.
+struct collection_layout {
+  // offset just after the '[' opening the features array, and of the ']'
+  // closing it.
+  size_t features_begin, features_end;
+  std::vector<feature_range> features;
+};
+
+// Finds the features in a FeatureCollection, and their OSMLR ids, in a single
+// pass and without building a document tree. Only the nesting of objects,
+// arrays and strings is followed, this isn't a validating parser. Returns
+// false if there's no features array or a feature has no osmlr_id.
+bool scan_collection(const std::string &json, collection_layout &layout);
+
+// Finds the ']' closing the features array of a complete FeatureCollection,
+// given the end of it in buf. Sets cut to the offset of the ']' within buf,
+// and empty if the array has no features in it.
+bool find_collection_end(const std::string &buf, size_t &cut, bool &empty);
+
+} // namespace util
+} // namespace osmlr
+
+#endif /* OSMLR_UTIL_FEATURE_COLLECTION_HPP */
@@ -0,0 +1,77 @@
+#ifndef OSMLR_UTIL_JSON_WRITER_HPP
+#define OSMLR_UTIL_JSON_WRITER_HPP
+
+#include <valhalla/midgard/pointll.h>
+#include <string>
+#include <cstdint>
+#include <type_traits>
+
+namespace osmlr {
+namespace util {
+
+/**
+ * Appends JSON text to a buffer which can be reused between documents.
+ *
+ * This avoids the locale handling and allocations of std::ostringstream.
+ * Coordinates are written with a fixed number of decimal places, dropping
+ * any trailing zeros, so the caller can trade precision for output size.
+ * Structure is up to the caller, which writes punctuation with raw().
+ */
+struct json_writer {
+  explicit json_writer(unsigned int precision = 7);
+
+  json_writer &raw(char c) { m_buf.push_back(c); return *this; }
+  json_writer &raw(const char *s) { m_buf.append(s); return *this; }
+  json_writer &raw(const std::string &s) { m_buf.append(s); return *this; }
+
+  // a string value, in quotes and escaped as needed.
+  json_writer &quoted(const std::string &s);
+
+  // an integer (or bool, as 0 or 1) value.
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value, json_writer &>::type
+  number(T value) {
+    if (is_negative(value, std::is_signed<T>())) {
+      m_buf.push_back('-');
+      // negate in unsigned arithmetic, so the minimum value doesn't overflow.
+      append_unsigned(uint64_t(0) - uint64_t(int64_t(value)));
+    } else {
+      append_unsigned(uint64_t(value));
+    }
+    return *this;
+  }
+
+  // a floating point value with the configured number of decimal places.
+  json_writer &coordinate(double value);
+
+  // a GeoJSON position, [lng,lat].
+  json_writer &point(const valhalla::midgard::PointLL &pt) {
+    raw('[').coordinate(pt.lng()).raw(',').coordinate(pt.lat()).raw(']');
+    return *this;
+  }
+
+  const std::string &str() const { return m_buf; }
+  size_t size() const { return m_buf.size(); }
+  // empties the buffer, keeping the memory for the next document.
+  void clear() { m_buf.clear(); }
+
+  // the largest supported number of decimal places.
+  static constexpr unsigned int kMaxPrecision = 9;
+
+private:
+  template <typename T>
+  static bool is_negative(T value, std::true_type) { return value < 0; }
+  template <typename T>
+  static bool is_negative(T, std::false_type) { return false; }
+
+  void append_unsigned(uint64_t value);
+
+  std::string m_buf;
+  unsigned int m_precision;
+  uint64_t m_scale;
+};
+
+} // namespace util
+} // namespace osmlr
+
+#endif /* OSMLR_UTIL_JSON_WRITER_HPP */
@@ -0,0 +1,52 @@
+#ifndef OSMLR_UTIL_MANIFEST_HPP
+#define OSMLR_UTIL_MANIFEST_HPP
+
+#include <osmlr/util/shard.hpp>
+#include <osmlr/util/tile_scan.hpp>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace osmlr {
+namespace util {
+
+/**
+ * A summary of the tiles a shard of a build wrote, which osmlr_merge checks
+ * against the tiles on disk and uses to stitch the shards back together.
+ *
+ * It's written as a small JSON object naming the tool, its version and the
+ * shard, with each output's base path and the id and size of each of its
+ * tiles.
+ */
+struct manifest {
+  struct output {
+    std::string base;
+    std::vector<tile_file> tiles;
+  };
+
+  manifest() : changeset_id(0) {}
+  manifest(std::string tool, std::string version, const shard &part,
+           uint64_t changeset_id);
+
+  // lists the tiles with the extension (e.g: ".osmlr") under base which the
+  // shard owns. tiles it doesn't own, such as those carried over by an
+  // update, are left out.
+  void add_output(const std::string &extension, const std::string &base,
+                  size_t threads = 1);
+
+  // throws if the file can't be written or read.
+  void write(const std::string &file_name) const;
+  static manifest read(const std::string &file_name);
+
+  std::string tool, version;
+  shard part;
+  uint64_t changeset_id;
+  // keyed by extension.
+  std::map<std::string, output> outputs;
+};
+
+} // namespace util
+} // namespace osmlr
+
+#endif /* OSMLR_UTIL_MANIFEST_HPP */
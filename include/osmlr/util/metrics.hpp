@@ -0,0 +1,67 @@
+#ifndef OSMLR_UTIL_METRICS_HPP
+#define OSMLR_UTIL_METRICS_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace osmlr {
+namespace util {
+
+/**
+ * Counters and histograms for a whole run, which can be written out as a
+ * JSON report to track throughput between releases.
+ *
+ * Metrics are registered by name, which takes a lock, so callers should keep
+ * the handles rather than look them up each time. Recording is lock free:
+ * each thread adds to its own shard of every metric, and the shards are only
+ * summed when the totals are asked for. The shard of a thread which exits is
+ * handed on to the next new thread, so totals include the work of threads
+ * which have finished and short lived threads don't use more memory.
+ */
+struct metrics {
+  // the most metrics of each kind which can be registered.
+  static constexpr size_t kMaxCounters = 256;
+  static constexpr size_t kMaxHistograms = 64;
+  // histograms count values in power of two buckets: bucket 0 holds zeros and
+  // bucket i holds values in [2^(i-1), 2^i).
+  static constexpr size_t kBuckets = 65;
+
+  struct counter {
+    void add(uint64_t n = 1) const;
+    size_t index;
+  };
+
+  struct histogram {
+    void observe(uint64_t value) const;
+    size_t index;
+  };
+
+  // the metric with the name, registered on first use.
+  static counter get_counter(const std::string &name);
+  static histogram get_histogram(const std::string &name);
+
+  struct summary {
+    uint64_t count, sum, min, max;
+    std::array<uint64_t, kBuckets> buckets;
+
+    double mean() const { return count > 0 ? double(sum) / count : 0.0; }
+    // the upper bound of the bucket holding the p'th fraction of values.
+    uint64_t percentile(double p) const;
+  };
+
+  // totals over every thread.
+  static uint64_t total(counter c);
+  static summary total(histogram h);
+
+  // all the metrics registered, as a JSON object of counters and
+  // histograms. throws if the file can't be written.
+  static std::string to_json();
+  static void write_json(const std::string &file_name);
+};
+
+} // namespace util
+} // namespace osmlr
+
+#endif /* OSMLR_UTIL_METRICS_HPP */
@@ -0,0 +1,88 @@
+#ifndef OSMLR_UTIL_SEGMENT_INDEX_HPP
+#define OSMLR_UTIL_SEGMENT_INDEX_HPP
+
+#include <valhalla/baldr/graphid.h>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace osmlr {
+namespace util {
+
+/**
+ * A packed R-tree over the bounding boxes of OSMLR segments, stored in a
+ * single file which is memory mapped to query it.
+ *
+ * The tree is bulk loaded: segments are sorted along a Hilbert curve through
+ * the centres of their boxes and packed node_size to a node, then the nodes
+ * are packed the same way up to a single root. Nodes are stored level by
+ * level from the leaves up, as arrays of boxes and of indices. For a leaf the
+ * index is the segment id and otherwise it's the position of the node's first
+ * child. Integers are in host byte order.
+ */
+struct segment_index {
+  static constexpr char kMagic[8] = {'O', 'S', 'M', 'L', 'R', 'I', 'D', 'X'};
+  static constexpr uint32_t kVersion = 1;
+  static constexpr uint32_t kNodeSize = 16;
+
+  // coordinates in 1e-7 degrees, as in the LRPs of the .osmlr tiles.
+  struct box {
+    int32_t min_lng, min_lat, max_lng, max_lat;
+
+    bool intersects(const box &o) const {
+      return min_lng <= o.max_lng && o.min_lng <= max_lng &&
+             min_lat <= o.max_lat && o.min_lat <= max_lat;
+    }
+  };
+
+  struct item {
+    box bbox;
+    valhalla::baldr::GraphId id;
+  };
+
+  struct header {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size;
+    uint64_t item_count;
+    uint64_t node_count;
+    uint32_t level_count;
+    uint32_t reserved;
+    // followed by level_count uint64_t level ends, node_count boxes and then
+    // node_count uint64_t indices.
+  };
+
+  // builds the index over the items, which are reordered, and writes it to
+  // file_name.
+  static void write(const std::string &file_name, std::vector<item> &items);
+
+  explicit segment_index(const std::string &file_name);
+  ~segment_index();
+
+  segment_index(const segment_index &) = delete;
+  segment_index &operator=(const segment_index &) = delete;
+
+  // calls found with the id of every segment whose bounding box intersects
+  // the one given, in degrees.
+  void query(double min_lng, double min_lat, double max_lng, double max_lat,
+             const std::function<void(valhalla::baldr::GraphId)> &found) const;
+  std::vector<valhalla::baldr::GraphId> query(double min_lng, double min_lat,
+                                              double max_lng, double max_lat) const;
+
+  size_t size() const { return m_header->item_count; }
+
+private:
+  const char *m_data;
+  size_t m_size;
+  const header *m_header;
+  const uint64_t *m_level_ends;
+  const box *m_boxes;
+  const uint64_t *m_indices;
+};
+
+} // namespace util
+} // namespace osmlr
+
+#endif /* OSMLR_UTIL_SEGMENT_INDEX_HPP */
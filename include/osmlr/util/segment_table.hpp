@@ -0,0 +1,97 @@
+#ifndef OSMLR_UTIL_SEGMENT_TABLE_HPP
+#define OSMLR_UTIL_SEGMENT_TABLE_HPP
+
+#include <valhalla/baldr/graphid.h>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace osmlr {
+namespace util {
+
+/**
+ * A flat table of every OSMLR segment in a release, which can be memory
+ * mapped and looked up by id without parsing anything.
+ *
+ * The file starts with a header, followed by an entry for each hierarchy
+ * level. Each level has an array of tile_count + 1 record indices, so that
+ * the records for tile t are [offsets[t], offsets[t+1]) and the record for a
+ * segment is at offsets[tileid] + id. The records themselves are fixed size
+ * and come last. Integers are in host byte order, so tables aren't portable
+ * between machines of different endianness.
+ */
+struct segment_table {
+  static constexpr char kMagic[8] = {'O', 'S', 'M', 'L', 'R', 'T', 'B', 'L'};
+  static constexpr uint32_t kVersion = 1;
+
+  struct header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t creation_date;
+    uint64_t changeset_id;
+    uint32_t level_count;
+    uint32_t reserved;
+    uint64_t record_count;
+    // file offset of the first record.
+    uint64_t records;
+  };
+
+  struct level {
+    uint32_t level;
+    uint32_t tile_count;
+    // file offset of the tile_count + 1 uint64_t record indices.
+    uint64_t offsets;
+  };
+
+  enum flags : uint8_t {
+    // the id belongs to a segment.
+    kSegment = 1,
+    // the id belonged to a segment which has since been deleted.
+    kDeleted = 2
+  };
+
+  struct record {
+    // coordinates in 1e-7 degrees, as in the LRPs of the .osmlr tiles.
+    int32_t start_lat, start_lng;
+    int32_t end_lat, end_lng;
+    // metres.
+    uint32_t length;
+    // degrees from north at the start of the segment.
+    uint16_t bearing;
+    // valhalla::baldr::RoadClass of the start, and the most important one
+    // along the segment.
+    uint8_t frc, least_frc;
+    // osmlr::output::FormOfWay at the start.
+    uint8_t fow;
+    uint8_t flags;
+    uint16_t reserved;
+  };
+
+  explicit segment_table(const std::string &file_name);
+  ~segment_table();
+
+  segment_table(const segment_table &) = delete;
+  segment_table &operator=(const segment_table &) = delete;
+
+  // the record for the segment id, or nullptr if there isn't one. a record
+  // may still be for a deleted segment, see flags.
+  const record *find(valhalla::baldr::GraphId id) const;
+
+  const header &get_header() const { return *m_header; }
+
+private:
+  const char *m_data;
+  size_t m_size;
+  const header *m_header;
+  const record *m_records;
+  // the offsets for each level, indexed by level. nullptr if the level isn't
+  // in the table.
+  static constexpr size_t kMaxLevels = 8;
+  const level *m_levels[kMaxLevels];
+};
+
+} // namespace util
+} // namespace osmlr
+
+#endif /* OSMLR_UTIL_SEGMENT_TABLE_HPP */
@@ -0,0 +1,130 @@
+#ifndef OSMLR_UTIL_SHAPE_CACHE_HPP
+#define OSMLR_UTIL_SHAPE_CACHE_HPP
+
+#include <valhalla/baldr/graphtile.h>
+#include <valhalla/baldr/directededge.h>
+#include <valhalla/midgard/pointll.h>
+#include <cstddef>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace osmlr {
+namespace util {
+
+/**
+ * A decoded edge shape, seen in the direction of travel along a directed
+ * edge. The two directions of an edge share the same decoded points, so a
+ * reversed view doesn't need a reversed copy.
+ */
+struct shape_view {
+  typedef std::vector<valhalla::midgard::PointLL> points_t;
+
+  struct const_iterator {
+    typedef std::random_access_iterator_tag iterator_category;
+    typedef valhalla::midgard::PointLL value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const value_type *pointer;
+    typedef const value_type &reference;
+
+    const shape_view *m_view;
+    difference_type m_idx;
+
+    reference operator*() const { return (*m_view)[m_idx]; }
+    pointer operator->() const { return &(*m_view)[m_idx]; }
+    reference operator[](difference_type n) const { return (*m_view)[m_idx + n]; }
+    const_iterator &operator++() { ++m_idx; return *this; }
+    const_iterator operator++(int) { const_iterator r = *this; ++m_idx; return r; }
+    const_iterator &operator--() { --m_idx; return *this; }
+    const_iterator operator--(int) { const_iterator r = *this; --m_idx; return r; }
+    const_iterator &operator+=(difference_type n) { m_idx += n; return *this; }
+    const_iterator &operator-=(difference_type n) { m_idx -= n; return *this; }
+    const_iterator operator+(difference_type n) const { return const_iterator{m_view, m_idx + n}; }
+    const_iterator operator-(difference_type n) const { return const_iterator{m_view, m_idx - n}; }
+    difference_type operator-(const const_iterator &o) const { return m_idx - o.m_idx; }
+    bool operator==(const const_iterator &o) const { return m_idx == o.m_idx; }
+    bool operator!=(const const_iterator &o) const { return m_idx != o.m_idx; }
+    bool operator<(const const_iterator &o) const { return m_idx < o.m_idx; }
+    bool operator>(const const_iterator &o) const { return m_idx > o.m_idx; }
+    bool operator<=(const const_iterator &o) const { return m_idx <= o.m_idx; }
+    bool operator>=(const const_iterator &o) const { return m_idx >= o.m_idx; }
+  };
+
+  shape_view() : m_reversed(false) {}
+  shape_view(std::shared_ptr<const points_t> points, bool reversed)
+    : m_points(std::move(points)), m_reversed(reversed) {}
+
+  size_t size() const { return m_points ? m_points->size() : 0; }
+  bool empty() const { return size() == 0; }
+
+  const valhalla::midgard::PointLL &operator[](size_t i) const {
+    return m_reversed ? (*m_points)[m_points->size() - 1 - i] : (*m_points)[i];
+  }
+  const valhalla::midgard::PointLL &front() const { return (*this)[0]; }
+  const valhalla::midgard::PointLL &back() const { return (*this)[size() - 1]; }
+
+  const_iterator begin() const { return const_iterator{this, 0}; }
+  const_iterator end() const { return const_iterator{this, std::ptrdiff_t(size())}; }
+
+private:
+  // shared with the cache, so the view stays valid if the cache evicts it.
+  std::shared_ptr<const points_t> m_points;
+  bool m_reversed;
+};
+
+/**
+ * A bounded, least-recently-used cache of decoded edge shapes, keyed by the
+ * tile and edgeinfo offset of the edge.
+ *
+ * Decoding the polyline of an edge is one of the more expensive lookups, and
+ * the same shape is often wanted several times: for both directions of an
+ * edge, and by each of the outputs.
+ */
+struct shape_cache {
+  explicit shape_cache(size_t max_shapes);
+
+  // returns the shape of the directed edge, in its direction of travel.
+  shape_view get(const valhalla::baldr::GraphTile *tile,
+                 const valhalla::baldr::DirectedEdge *edge);
+  void clear();
+
+  // counters for the lifetime of the cache.
+  struct stats {
+    size_t hits, misses, evictions;
+  };
+  const stats &get_stats() const { return m_stats; }
+
+private:
+  struct key {
+    uint64_t tile_id;
+    uint32_t edgeinfo_offset;
+    bool operator==(const key &other) const {
+      return tile_id == other.tile_id && edgeinfo_offset == other.edgeinfo_offset;
+    }
+  };
+  struct key_hash {
+    size_t operator()(const key &k) const {
+      return std::hash<uint64_t>()(k.tile_id * 0x9e3779b97f4a7c15ULL ^ k.edgeinfo_offset);
+    }
+  };
+
+  struct entry {
+    std::shared_ptr<const shape_view::points_t> points;
+    // position in the LRU list, so it can be moved to the front in constant
+    // time.
+    std::list<key>::iterator lru;
+  };
+
+  const size_t m_max_shapes;
+  // keys, most recently used first.
+  std::list<key> m_lru;
+  std::unordered_map<key, entry, key_hash> m_shapes;
+  stats m_stats;
+};
+
+} // namespace util
+} // namespace osmlr
+
+#endif /* OSMLR_UTIL_SHAPE_CACHE_HPP */
@@ -0,0 +1,44 @@
+#ifndef OSMLR_UTIL_SHARD_HPP
+#define OSMLR_UTIL_SHARD_HPP
+
+#include <valhalla/baldr/graphid.h>
+#include <cstdint>
+#include <string>
+
+namespace osmlr {
+namespace util {
+
+/**
+ * One of several parts of a build, so that it can be spread over machines.
+ *
+ * Tiles belong to shards in blocks of kBlockDegrees square, and the blocks
+ * are dealt out to the shards in turn so that dense regions are shared
+ * between them. Which shard owns a tile depends only on where the tile is,
+ * not on which tiles there are, so every tool and every level agrees on it.
+ * A shard makes all the segments in the tiles it owns and none in any
+ * other, and as segment ids are indices within a tile, the outputs of
+ * different shards never collide.
+ */
+struct shard {
+  static constexpr double kBlockDegrees = 8.0;
+
+  // the whole build, in one part.
+  shard() : index(0), count(1) {}
+  // throws unless index < count.
+  shard(uint32_t index, uint32_t count);
+
+  // parses "i/N", the i'th of N shards counting from zero.
+  static shard parse(const std::string &spec);
+
+  bool owns(valhalla::baldr::GraphId tile_id) const;
+  bool whole() const { return count == 1; }
+  // as parse() takes it.
+  std::string name() const;
+
+  uint32_t index, count;
+};
+
+} // namespace util
+} // namespace osmlr
+
+#endif /* OSMLR_UTIL_SHARD_HPP */
@@ -0,0 +1,129 @@
+#ifndef OSMLR_UTIL_TILE_ARCHIVE_HPP
+#define OSMLR_UTIL_TILE_ARCHIVE_HPP
+
+#include <valhalla/baldr/graphid.h>
+#include <osmlr/util/compression.hpp>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/uio.h>
+
+namespace osmlr {
+namespace util {
+
+/**
+ * A single file holding many tiles, for use instead of a directory tree of
+ * them. Archives are told apart from directories by their .pack extension.
+ *
+ * The file is a sequence of records, each for one tile. Data records are
+ * appended to their tile in order, and a removal record drops everything
+ * written to the tile before it. Each record is written under a lock, so
+ * several writers can append to the same archive. Once they are all done an
+ * index of where the data of every tile is is appended, which ends with a
+ * footer so that readers can find it from the end of the file. If the file
+ * doesn't end with an index, e.g: after a crash, readers walk the records
+ * instead.
+ *
+ * Tiles in an archive are named as if the archive were a directory, e.g:
+ * planet.pack/2/000/756/425.osmlr, so that their tile ids can be found from
+ * their names as for any other tile. Integers are in host byte order.
+ */
+struct tile_archive {
+  static constexpr char kMagic[8] = {'O', 'S', 'M', 'L', 'R', 'P', 'A', 'K'};
+
+  enum record_type : uint32_t {
+    kData = 1,
+    kRemove = 2,
+    kIndex = 3
+  };
+
+  struct record_header {
+    uint32_t type;
+    // the util::compression of the data, for data records.
+    uint32_t codec;
+    uint64_t tile_id;
+    // bytes following the header.
+    uint64_t length;
+  };
+
+  // the end of an index record, and so of the file.
+  struct footer {
+    // file offset of the index record's header.
+    uint64_t index;
+    // bit set of the compressions used by the data records.
+    uint32_t codecs;
+    uint32_t reserved;
+    char magic[8];
+  };
+
+  // whether the path names an archive rather than a directory.
+  static bool is_archive(const std::string &path);
+
+  // finds the archive that a tile name is within. returns false if the name
+  // isn't within an archive.
+  static bool archive_of(const std::string &name, std::string &archive);
+
+  // the archive, opened and indexed once for the life of the process. only
+  // for archives which are no longer being written to, such as inputs.
+  static std::shared_ptr<const tile_archive> open(const std::string &file_name);
+
+  // reads a whole tile, which may be a file or within an archive, and
+  // decompresses it.
+  static std::string read_tile(const std::string &name);
+
+  // appends a record to the archive open for reading and appending as fd,
+  // under the archive's lock.
+  static void append(int fd, record_type type, compression codec,
+                     valhalla::baldr::GraphId tile_id, const iovec *iov,
+                     size_t iovcnt);
+
+  // appends an index of everything in the archive open as fd, from every
+  // writer and not just this one, unless the archive already ends with one.
+  // this walks the whole archive, so is meant to be done once all the
+  // writers are done.
+  static void append_index(int fd);
+
+  explicit tile_archive(const std::string &file_name);
+  ~tile_archive();
+
+  tile_archive(const tile_archive &) = delete;
+  tile_archive &operator=(const tile_archive &) = delete;
+
+  // the tiles with data in the archive, in id order.
+  std::vector<valhalla::baldr::GraphId> tiles() const;
+
+  // the name of a tile within the archive, with the given extension.
+  std::string name_of(valhalla::baldr::GraphId tile_id,
+                      const std::string &extension) const;
+
+  // the data of a tile as it was written, which may be compressed. empty if
+  // the tile isn't in the archive.
+  std::string read(valhalla::baldr::GraphId tile_id) const;
+  size_t size_of(valhalla::baldr::GraphId tile_id) const;
+
+  // whether all the data in the archive is compressed with codec.
+  bool only(compression codec) const {
+    return (m_codecs & ~(1u << uint32_t(codec))) == 0;
+  }
+
+  // where a piece of a tile's data is in the file.
+  struct extent {
+    uint64_t offset, length;
+  };
+  typedef std::unordered_map<uint64_t, std::vector<extent> > index;
+
+private:
+  std::string m_file_name;
+  const char *m_data;
+  size_t m_size;
+  index m_index;
+  uint32_t m_codecs;
+};
+
+} // namespace util
+} // namespace osmlr
+
+#endif /* OSMLR_UTIL_TILE_ARCHIVE_HPP */
@@ -0,0 +1,96 @@
+#ifndef OSMLR_UTIL_TILE_READER_HPP
+#define OSMLR_UTIL_TILE_READER_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <iterator>
+#include <string>
+
+namespace osmlr {
+namespace util {
+
+/**
+ * Reads an OSMLR tile directly from a memory mapping of its file.
+ *
+ * Rather than parsing the whole Tile message, the wire format is walked as
+ * needed: the header fields are found when the tile is opened, and entries
+ * are decoded one at a time while iterating. The LRPs of segments are never
+ * decoded. Because tiles may be made of several concatenated Tile messages,
+ * the header fields follow the protocol buffers rule that the last value
+ * seen wins.
+ *
+ * Compressed tiles, and tiles within an archive, are read into memory when
+ * opened instead.
+ */
+struct tile_reader {
+  explicit tile_reader(const std::string &file_name);
+  ~tile_reader();
+
+  tile_reader(const tile_reader &) = delete;
+  tile_reader &operator=(const tile_reader &) = delete;
+
+  struct entry {
+    // the whole entries field within the tile, tag included, so that it can
+    // be copied verbatim.
+    const char *record_begin, *record_end;
+    // the encoded Entry message within that field.
+    const char *message_begin, *message_end;
+    bool has_segment, has_marker;
+    uint64_t segment_creation_date, segment_deleted_date;
+  };
+
+  struct const_iterator {
+    typedef std::forward_iterator_tag iterator_category;
+    typedef entry value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const entry *pointer;
+    typedef const entry &reference;
+
+    const_iterator(const char *pos, const char *end);
+
+    reference operator*() const { return m_entry; }
+    pointer operator->() const { return &m_entry; }
+    const_iterator &operator++();
+    const_iterator operator++(int) { const_iterator r = *this; ++(*this); return r; }
+    bool operator==(const const_iterator &o) const { return m_entry.record_begin == o.m_entry.record_begin; }
+    bool operator!=(const const_iterator &o) const { return !operator==(o); }
+
+  private:
+    // moves to the next entries field at or after m_pos, or the end.
+    void advance();
+
+    const char *m_pos, *m_end;
+    entry m_entry;
+  };
+
+  const_iterator begin() const { return const_iterator(m_data, m_data + m_size); }
+  const_iterator end() const { return const_iterator(m_data + m_size, m_data + m_size); }
+
+  size_t entry_count() const { return m_entry_count; }
+  uint64_t creation_date() const { return m_creation_date; }
+  uint64_t changeset_id() const { return m_changeset_id; }
+  const std::string &description() const { return m_description; }
+
+  // the raw bytes of the tile.
+  const char *data() const { return m_data; }
+  size_t size() const { return m_size; }
+
+private:
+  // maps the file, decompressing it into m_plain if it's compressed.
+  void map(const std::string &file_name);
+
+  std::string m_file_name;
+  const char *m_data;
+  size_t m_size;
+  // the tile, if it was read into memory, otherwise m_data is mapped.
+  std::string m_plain;
+
+  size_t m_entry_count;
+  uint64_t m_creation_date, m_changeset_id;
+  std::string m_description;
+};
+
+} // namespace util
+} // namespace osmlr
+
+#endif /* OSMLR_UTIL_TILE_READER_HPP */
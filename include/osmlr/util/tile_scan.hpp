@@ -0,0 +1,38 @@
+#ifndef OSMLR_UTIL_TILE_SCAN_HPP
+#define OSMLR_UTIL_TILE_SCAN_HPP
+
+#include <valhalla/baldr/graphid.h>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+namespace osmlr {
+namespace util {
+
+// A tile found on disk.
+struct tile_file {
+  valhalla::baldr::GraphId tile_id;
+  std::string path;
+  off_t size;
+};
+
+/**
+ * Lists the tiles under base_dir which have the given extension (e.g:
+ * ".osmlr"), with the tile ids parsed from their paths.
+ *
+ * Only the directories which exist are read, rather than testing for every
+ * tile id the hierarchy could have, so this is quick for an extract. The
+ * directories one level below each level directory are walked on up to
+ * threads threads. The result is sorted by tile id.
+ *
+ * If base_dir is an archive, its tiles are listed from its index instead,
+ * named as if the archive were a directory.
+ */
+std::vector<tile_file> scan_tiles(const std::string &base_dir,
+                                  const std::string &extension,
+                                  size_t threads = 1);
+
+} // namespace util
+} // namespace osmlr
+
+#endif /* OSMLR_UTIL_TILE_SCAN_HPP */
@@ -3,41 +3,191 @@
 
 #include <valhalla/baldr/graphid.h>
 #include <valhalla/baldr/tilehierarchy.h>
+#include <osmlr/util/compression.hpp>
+#include <atomic>
+#include <memory>
 #include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 namespace osmlr {
 namespace util {
 
+/**
+ * A limit on the tile data buffered in memory by any number of tile_writers,
+ * e.g: all the outputs of a run, which may be in different threads. Each
+ * writer counts what it buffers against the budget, and writes its own
+ * buffers out when the total goes over.
+ */
+struct buffer_budget {
+  explicit buffer_budget(size_t limit) : m_limit(limit), m_used(0) {}
+
+  buffer_budget(const buffer_budget &) = delete;
+  buffer_budget &operator=(const buffer_budget &) = delete;
+
+  size_t limit() const { return m_limit; }
+  size_t used() const { return m_used.load(std::memory_order_relaxed); }
+
+  // counts more bytes as buffered, and returns whether that goes over the
+  // limit.
+  bool add(size_t bytes) {
+    return m_used.fetch_add(bytes, std::memory_order_relaxed) + bytes > m_limit;
+  }
+  // counts bytes as no longer buffered, once they are written or dropped.
+  void release(size_t bytes) {
+    m_used.fetch_sub(bytes, std::memory_order_relaxed);
+  }
+
+private:
+  const size_t m_limit;
+  std::atomic<size_t> m_used;
+};
+
 /**
  * Writes data into tile files.
  *
  * In order to write data into many tiles in an unordered fashion, this class
  * will manage a set of open files in order to not run out of file descriptors.
+ *
+ * Optionally, data can be buffered in memory per tile, up to a total of
+ * max_buffer bytes across all tiles, or within a budget shared with other
+ * writers. When that is exceeded, the writer's tiles with the largest buffers
+ * are written out first, which turns many small writes into a few large ones
+ * and means fewer files have to be opened and closed. A max_buffer of zero,
+ * or no budget, writes everything through immediately.
+ *
+ * Tiles can also be compressed, which adds the codec's suffix to their names.
+ * Each write, or each buffer written out, becomes a gzip member or zstd
+ * frame of its own, so buffering gets much better compression than writing
+ * straight through.
+ *
+ * If base_dir names an archive (see tile_archive) the tiles are appended to
+ * it instead of to files of their own, and its index is written by
+ * write_index once all the writers to it are closed.
  */
 struct tile_writer {
-  tile_writer(std::string base_dir, std::string suffix, size_t max_fds);
+  tile_writer(std::string base_dir, std::string suffix, size_t max_fds,
+              size_t max_buffer = 0, compression codec = compression::kNone);
+  tile_writer(std::string base_dir, std::string suffix, size_t max_fds,
+              std::shared_ptr<buffer_budget> budget,
+              compression codec = compression::kNone);
+  ~tile_writer();
+
+  // removes any existing data under base_dir, or the archive it names. this
+  // is done once, up front, rather than in the constructor so that several
+  // writers (e.g: one per thread) can share the same output directory.
+  static void purge(const std::string &base_dir);
+
+  // writes the index of the archive that base_dir names, once every writer
+  // to it has been closed. does nothing for a directory.
+  static void write_index(const std::string &base_dir);
+
+  // tries to raise the soft limit on open files to at least num_fds, up to
+  // the hard limit. returns the resulting soft limit.
+  static size_t raise_fd_limit(size_t num_fds);
+
+  // puts the files with the given extension under src_dir into the same
+  // place under dst_dir and returns their new names. each file is hardlinked
+  // if possible, otherwise cloned (reflinked) or copied in the kernel, so
+  // that carrying over a previous release costs little I/O. a hardlinked
+  // file is shared with src_dir, so writers must unshare() it before changing
+  // it in place. files may be compressed in any way, and those which aren't
+  // compressed with codec are converted.
+  //
+  // if either side is an archive, the tiles are copied into dst_dir, or the
+  // whole archive cloned, and the names returned are those in src_dir, which
+  // are never changed, to read the tiles from.
+  static std::vector<std::string> carry_over(const std::string &src_dir,
+                                             const std::string &dst_dir,
+                                             const std::string &extension,
+                                             compression codec = compression::kNone);
+
+  // if the file has other hardlinks, replaces it with a copy of its own so
+  // that it can be changed without changing them.
+  static void unshare(const std::string &file_name);
+
   void write_to(valhalla::baldr::GraphId tile_id, const std::string &data);
+  // puts a whole existing tile, which may be a file or within an archive,
+  // into the output. nothing should have been written to the tile yet. a
+  // file already compressed with codec is hardlinked or cloned where it can
+  // be, so like carry_over it may be shared with where it came from.
+  void write_tile(valhalla::baldr::GraphId tile_id, const std::string &name);
+  // drops everything written to the tile, including any existing file.
+  void remove(valhalla::baldr::GraphId tile_id);
   std::string get_name_for_tile(valhalla::baldr::GraphId tile_id);
   void close_all();
 
+  // the size of the tile's file once anything buffered for it is written,
+  // for a checkpoint. zero if nothing has been written to the tile.
+  off_t flushed_size(valhalla::baldr::GraphId tile_id);
+  // cuts the files of the tiles on the level back to the sizes they had at a
+  // checkpoint, and removes those of any other tiles on the level. throws if
+  // a file is shorter than it was, as the checkpoint can't be trusted then.
+  // neither of these work with an archive.
+  void restore(uint8_t level,
+               const std::unordered_map<valhalla::baldr::GraphId, off_t> &sizes);
+  compression codec() const { return m_codec; }
+  // whether tiles are uncompressed files of their own, which can be changed
+  // in place.
+  bool in_place() const { return !m_archive && m_codec == compression::kNone; }
+
+  // counters for the lifetime of the writer, useful for sizing max_fds.
+  struct stats {
+    // files opened, and files closed to make room for another.
+    size_t opens, evictions;
+    // writes to a file which was already open.
+    size_t hits;
+    // calls to writev and the total bytes they wrote.
+    size_t writes, bytes_written;
+  };
+  const stats &get_stats() const { return m_stats; }
+
 private:
   int get_fd_for(valhalla::baldr::GraphId tile_id);
   int make_fd_for(valhalla::baldr::GraphId tile_id);
   void evict_last_fd();
+  void close_fd(int fd);
+  void write_fully(valhalla::baldr::GraphId tile_id, iovec *iov, size_t iovcnt);
+  void flush(valhalla::baldr::GraphId tile_id);
+  void spill();
+  int archive_fd();
 
   const std::string m_base_dir, m_suffix;
   const size_t m_max_fds;
+  const compression m_codec;
+  const bool m_archive;
+  // the archive, when writing to one, opened on first use.
+  int m_archive_fd;
 
   struct lru_fd {
     // the file descriptor itself
     int fd;
-    // the least-recently-used index. this is set to the max on use, and
-    // reduced by the minimum when the minimum is evicted.
-    size_t lru;
+    // position of the tile in the LRU list, so that it can be moved to the
+    // front in constant time.
+    std::list<valhalla::baldr::GraphId>::iterator lru;
   };
 
-  size_t m_max_lru;
+  // tiles with open files, most recently used first.
+  std::list<valhalla::baldr::GraphId> m_lru;
   std::unordered_map<valhalla::baldr::GraphId, lru_fd> m_fds;
+  stats m_stats;
+
+  struct tile_buffer {
+    // data waiting to be written, in blocks which are written out together
+    // with a single writev.
+    std::vector<std::string> blocks;
+    // total number of bytes in all the blocks.
+    size_t size;
+  };
+
+  // shared with other writers, or null to write through.
+  const std::shared_ptr<buffer_budget> m_budget;
+  // this writer's part of what's counted against the budget.
+  size_t m_buffered;
+  std::unordered_map<valhalla::baldr::GraphId, tile_buffer> m_buffers;
 };
 
 } // namespace util
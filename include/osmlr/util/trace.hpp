@@ -0,0 +1,85 @@
+#ifndef OSMLR_UTIL_TRACE_HPP
+#define OSMLR_UTIL_TRACE_HPP
+
+#include <valhalla/baldr/graphid.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace osmlr {
+namespace util {
+
+/**
+ * Spans of time spent in each stage of the work, written out in the Chrome
+ * trace-event format so they can be opened in a trace viewer such as
+ * chrome://tracing or Perfetto.
+ *
+ * Tracing is off unless start() is called, and until then a span costs the
+ * check of a flag. Once started, each thread records its spans into a ring
+ * buffer of its own without taking any locks, keeping only the most recent
+ * events_per_thread of them. Span names and categories are not copied, so
+ * they must be string literals.
+ */
+struct trace {
+  static constexpr size_t kDefaultEventsPerThread = 1 << 16;
+
+  // starts recording spans. should be called before the threads to be traced
+  // are started.
+  static void start(size_t events_per_thread = kDefaultEventsPerThread);
+  static bool enabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+  // names the calling thread in the trace.
+  static void name_thread(const std::string &name);
+
+  // writes all the spans recorded so far. the threads which recorded them
+  // should have finished, or at least stopped recording.
+  static void write_json(const std::string &file_name);
+
+  // records the time from its construction to its destruction, optionally
+  // for a particular tile.
+  struct span {
+    explicit span(const char *name, const char *category = "osmlr")
+      : span(name, kNoTile, category) {}
+    span(const char *name, valhalla::baldr::GraphId tile_id,
+         const char *category = "osmlr")
+      : span(name, tile_id.value, category) {}
+    ~span() { end(); }
+
+    // ends the span before it goes out of scope.
+    void end() {
+      if (m_name != nullptr) {
+        record(m_name, m_category, m_tile, m_start);
+        m_name = nullptr;
+      }
+    }
+
+    span(const span &) = delete;
+    span &operator=(const span &) = delete;
+
+  private:
+    span(const char *name, uint64_t tile, const char *category)
+      : m_name(enabled() ? name : nullptr)
+      , m_category(category)
+      , m_tile(tile)
+      , m_start(m_name != nullptr ? now() : 0) {}
+
+    const char *m_name, *m_category;
+    uint64_t m_tile, m_start;
+  };
+
+private:
+  static constexpr uint64_t kNoTile = ~uint64_t(0);
+
+  // nanoseconds since tracing started.
+  static uint64_t now();
+  static void record(const char *name, const char *category, uint64_t tile,
+                     uint64_t start);
+
+  static std::atomic<bool> s_enabled;
+};
+
+} // namespace util
+} // namespace osmlr
+
+#endif /* OSMLR_UTIL_TRACE_HPP */
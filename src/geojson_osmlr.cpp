@@ -2,7 +2,10 @@
 #include <thread>
 #include <mutex>
 #include <vector>
-#include <queue>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
 #include <sys/stat.h>
 #include <fstream>
 #include <unistd.h>
@@ -11,7 +14,16 @@
 #include <valhalla/midgard/util.h>
 #include <valhalla/baldr/graphreader.h>
 #include <valhalla/baldr/tilehierarchy.h>
+#include <osmlr/util/compression.hpp>
 #include <osmlr/util/tile_writer.hpp>
+#include <osmlr/util/json_writer.hpp>
+#include <osmlr/util/metrics.hpp>
+#include <osmlr/util/trace.hpp>
+#include <osmlr/util/shape_cache.hpp>
+#include <osmlr/util/tile_reader.hpp>
+#include <osmlr/util/tile_scan.hpp>
+#include <osmlr/util/shard.hpp>
+#include <osmlr/util/manifest.hpp>
 
 #include <boost/program_options.hpp>
 #include <boost/property_tree/ptree.hpp>
@@ -29,45 +41,41 @@ namespace pbf  = opentraffic::osmlr;
 namespace bpo = boost::program_options;
 namespace bpt = boost::property_tree;
 
-inline bool exists(const std::string& name) {
-  struct stat buffer;
-  return (stat(name.c_str(), &buffer) == 0);
-}
-
-std::string get_osmlr_tilename(const std::string& osmlr_dir,
-                               const vb::GraphId& tile_id) {
-  std::string osmlr_file = osmlr_dir + "/" + vb::GraphTile::FileSuffix(tile_id);
-  osmlr_file.erase(osmlr_file.length()-3);
-  osmlr_file += "osmlr";
-  return osmlr_file;
-}
+// How much of the run a worker thread spent working, reported at the end to
+// show how evenly the tiles were spread.
+struct worker_stats {
+  size_t tiles;
+  // seconds from the start of the run until the thread ran out of tiles.
+  double busy;
+};
 
 // Output a segment that is part of an edge.
-void output_segment(std::ostringstream& out,
+template <typename shape_t>
+void output_segment(util::json_writer& out,
                     bool& first,
                     const vb::GraphId& osmlr_id,
                     const vb::DirectedEdge* edge,
-                    const std::vector<vm::PointLL>& shape) {
+                    const shape_t& shape) {
   if (!first) {
-    out << ",";
+    out.raw(',');
   }
   first = false;
-  out << "{\"type\":\"Feature\",\"geometry\":";
-  out << "{\"type\":\"LineString\",\"coordinates\":[";
+  out.raw("{\"type\":\"Feature\",\"geometry\":");
+  out.raw("{\"type\":\"LineString\",\"coordinates\":[");
   bool first_pt = true;
-  for (const auto pt : shape) {
-    if (first_pt) { first_pt = false; } else { out << ","; }
-    out << "[" << pt.lng() << "," << pt.lat() << "]";
+  for (const auto& pt : shape) {
+    if (first_pt) { first_pt = false; } else { out.raw(','); }
+    out.point(pt);
   }
 
   bool oneway = (edge->reverseaccess() & vb::kVehicularAccess) == 0;
-  out << "]},\"properties\":{"
-      << "\"id\":" << osmlr_id.id() << ","
-      << "\"osmlr_id\":" << osmlr_id.value << ","
-      << "\"best_frc\":\"" << vb::to_string(edge->classification()) << "\","
-      << "\"oneway\":" << oneway << ","
-      << "\"drive_on_right\":" << edge->drive_on_right();
-  out << "}}";
+  out.raw("]},\"properties\":{")
+     .raw("\"id\":").number(osmlr_id.id()).raw(',')
+     .raw("\"osmlr_id\":").number(osmlr_id.value).raw(',')
+     .raw("\"best_frc\":").quoted(vb::to_string(edge->classification())).raw(',')
+     .raw("\"oneway\":").number(oneway).raw(',')
+     .raw("\"drive_on_right\":").number(edge->drive_on_right());
+  out.raw("}}");
 }
 
 // Follow a segment at the end node of the directed edge.
@@ -75,12 +83,14 @@ const vb::DirectedEdge* follow_segment(const vb::TrafficSegment& seg,
                                        std::vector<vm::PointLL>& shape,
                                        const vb::DirectedEdge* edge,
                                        const vb::GraphTile* tile,
-                                       vb::GraphReader& reader) {
+                                       vb::GraphReader& reader,
+                                       util::shape_cache& shapes) {
   // Get the end node of the directed edge
   const vb::GraphTile* node_tile;
   if (edge->endnode().tileid() == tile->header()->graphid().tileid()) {
     node_tile = tile;
   } else {
+    util::trace::span span("get tile", edge->endnode().Tile_Base(), "graph");
     node_tile = reader.GetGraphTile(edge->endnode().Tile_Base());
   }
   const vb::NodeInfo* node = node_tile->node(edge->endnode());
@@ -109,11 +119,7 @@ const vb::DirectedEdge* follow_segment(const vb::TrafficSegment& seg,
         }
 
         // Get the edge shape
-        auto edgeinfo_offset = next_edge->edgeinfo_offset();
-        std::vector<vm::PointLL> next_shape = node_tile->edgeinfo(edgeinfo_offset).shape();
-        if (!next_edge->forward()) {
-          std::reverse(next_shape.begin(), next_shape.end());
-        }
+        util::shape_view next_shape = shapes.get(node_tile, next_edge);
 
         // Append shape, trim if needed
         if (next_seg.begin_percent_ > 0.0f || next_seg.end_percent_ < 1.0f) {
@@ -145,44 +151,54 @@ const vb::DirectedEdge* follow_segment(const vb::TrafficSegment& seg,
 /**
  * Create GeoJSON for an OSMLR tile.
  */
-void create_geojson(std::queue<vb::GraphId>& tilequeue,
+void create_geojson(const std::vector<util::tile_file>& jobs,
+                    std::atomic<size_t>& next_job,
+                    worker_stats& stats,
+                    const std::chrono::steady_clock::time_point start,
                     const std::string& output_dir,
                     const boost::property_tree::ptree& hierarchy_properties,
-                    const std::string& osmlr_dir, std::mutex& lock) {
+                    const unsigned int precision,
+                    const size_t shape_cache_size,
+                    const util::compression codec) {
   // Local Graphreader
   vb::GraphReader reader(hierarchy_properties);
 
+  // Decoded edge shapes, shared by both directions of an edge and by
+  // segments which are followed into neighbouring edges
+  util::shape_cache shapes(shape_cache_size);
+
+  // GeoJSON output buffer, reused for each tile
+  util::json_writer out(precision);
+
+  util::trace::name_thread("worker");
+
   // Create a tile writer
-  lock.lock();
-  util::tile_writer writer(output_dir, "json", 1);
-  lock.unlock();
+  util::tile_writer writer(output_dir, "json", 1, 0, codec);
 
-  // Iterate through the tiles in the queue and perform enhancements
+  // Take tiles from the list, largest first, until there are none left
   while (true) {
-    // Get the next tile Id from the queue and get writeable and readable
-    // tile. Lock while we access the tile queue and get the tile.
-    lock.lock();
-    if (tilequeue.empty()) {
-      lock.unlock();
+    size_t job = next_job.fetch_add(1);
+    if (job >= jobs.size()) {
       break;
     }
-    vb::GraphId tile_id = tilequeue.front();
-    tilequeue.pop();
-    lock.unlock();
+    vb::GraphId tile_id = jobs[job].tile_id;
+    const std::string& file_name = jobs[job].path;
+    stats.tiles++;
+    util::trace::span tile_span("tile", tile_id);
 
     // Get a Valhalla tile. If the tile is empty, skip it.
-    const vb::GraphTile* tile = reader.GetGraphTile(tile_id);
+    const vb::GraphTile* tile;
+    {
+      util::trace::span span("get tile", tile_id, "graph");
+      tile = reader.GetGraphTile(tile_id);
+    }
     if (!tile || tile->header()->directededgecount() == 0) {
       continue;
     }
 
     // Read the OSMLR pbf tile
-    pbf::Tile pbf_tile;
-    std::string file_name = get_osmlr_tilename(osmlr_dir, tile_id);
-    std::ifstream in(file_name);
-    if (!pbf_tile.ParseFromIstream(&in)) {
-      throw std::runtime_error("Unable to parse traffic segment file.");
-    }
+    util::trace::span read_span("read", tile_id, "io");
+    util::tile_reader pbf_tile(file_name);
     uint32_t creation_date = pbf_tile.creation_date();
     const time_t t(creation_date);
     std::tm tm = *std::gmtime(&t);
@@ -196,22 +212,26 @@ void create_geojson(std::queue<vb::GraphId>& tilequeue,
     // we find in the traffic-enabled Valhalla tile
     uint32_t id = 0;
     std::unordered_map<uint32_t, bool> segment_map;
-    for (const auto& entry : pbf_tile.entries()) {
-      if (entry.has_segment()) {
+    for (const auto& entry : pbf_tile) {
+      if (entry.has_segment) {
         segment_map[id] = false;
       }
       id++;
     }
 
-    // Create the GeoJSON output stream
-    std::ostringstream out;
-    out.precision(9);
-    out << "{\"type\":\"FeatureCollection\",\"properties\":{"
-        << "\"creation_time\":" << creation_date << ","
-        << "\"creation_date\":\"" << date_str << "\","
-        << "\"description\":\"" << tile_id << "\","
-        << "\"changeset_id\":" << osm_changeset_id << "},";
-    out << "\"features\":[";
+    read_span.end();
+
+    // Start the GeoJSON output
+    util::trace::span format_span("format", tile_id, "output");
+    std::ostringstream description;
+    description << tile_id;
+    out.clear();
+    out.raw("{\"type\":\"FeatureCollection\",\"properties\":{")
+       .raw("\"creation_time\":").number(creation_date).raw(',')
+       .raw("\"creation_date\":").quoted(date_str).raw(',')
+       .raw("\"description\":").quoted(description.str()).raw(',')
+       .raw("\"changeset_id\":").number(osm_changeset_id).raw("},");
+    out.raw("\"features\":[");
 
     // Iterate through the Valhalla directed edges. Find edges that start an
     // OSMLR segment or that include "chunks".
@@ -224,11 +244,7 @@ void create_geojson(std::queue<vb::GraphId>& tilequeue,
 
       // Get the directed edge and the shape
       const vb::DirectedEdge* edge = tile->directededge(n);
-      auto edgeinfo_offset = edge->edgeinfo_offset();
-      std::vector<vm::PointLL> shape = tile->edgeinfo(edgeinfo_offset).shape();
-      if (!edge->forward()) {
-        std::reverse(shape.begin(), shape.end());
-      }
+      util::shape_view shape = shapes.get(tile, edge);
       if (segments.size() == 1) {
         const auto& seg = segments.front();
         if (seg.starts_segment_ && seg.begin_percent_ == 0.0f &&
@@ -242,13 +258,14 @@ void create_geojson(std::queue<vb::GraphId>& tilequeue,
               // Segment starts on this edge and uses the entire edge.
               int n = 0;
               const vb::DirectedEdge* first_edge = edge;
-              while ((edge = follow_segment(seg, shape, edge, tile, reader)) != nullptr && n++ < 100) {
+              std::vector<vm::PointLL> full_shape(shape.begin(), shape.end());
+              while ((edge = follow_segment(seg, full_shape, edge, tile, reader, shapes)) != nullptr && n++ < 100) {
                 ;
               }
               if (n >= 100) {
                 printf("Follow XXX iterations?\n");
               } else {
-                output_segment(out, first, seg.segment_id_, first_edge, shape);
+                output_segment(out, first, seg.segment_id_, first_edge, full_shape);
                 segment_map[seg.segment_id_.id()] = true;
               }
             } else {
@@ -277,9 +294,9 @@ void create_geojson(std::queue<vb::GraphId>& tilequeue,
     }
 
     // Output to file
-    out << "]}";
+    out.raw("]}");
+    format_span.end();
     writer.write_to(tile_id, out.str());
-    writer.close_all();
 
     // Log statistics for this tile
     uint32_t found = 0;
@@ -299,6 +316,20 @@ void create_geojson(std::queue<vb::GraphId>& tilequeue,
       reader.Clear();
     }
   }
+
+  writer.close_all();
+  util::metrics::get_counter("geojson.writes").add(writer.get_stats().writes);
+  util::metrics::get_counter("geojson.bytes_written").add(writer.get_stats().bytes_written);
+
+  stats.busy = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  const auto &cache_stats = shapes.get_stats();
+  util::metrics::get_counter("shape_cache.hits").add(cache_stats.hits);
+  util::metrics::get_counter("shape_cache.misses").add(cache_stats.misses);
+  util::metrics::get_counter("shape_cache.evictions").add(cache_stats.evictions);
+  LOG_INFO("Shape cache hits = " + std::to_string(cache_stats.hits) +
+           " misses = " + std::to_string(cache_stats.misses) +
+           " evictions = " + std::to_string(cache_stats.evictions));
 }
 
 int main(int argc, char** argv) {
@@ -309,16 +340,24 @@ int main(int argc, char** argv) {
                                    "geojson_osmlr generates GeoJSON representations of OSMLR traffic segmentst."
                                    "\n"
                                    "\n");
-  uint32_t concurrency;
+  uint32_t concurrency, precision, shape_cache_size;
   uint32_t default_concurrency = std::thread::hardware_concurrency();
   std::string config;
-  std::string input_dir, output_dir;
+  std::string input_dir, output_dir, compression_name, metrics_file, trace_file;
+  std::string shard_spec, manifest_file;
   options.add_options()
     ("help,h", "Print this help message.")
     ("version,v", "Print the version of this software.")
     ("threads,t", bpo::value<unsigned int>(&concurrency)->default_value(default_concurrency), "Concurrency, number of threads.")
-    ("input_dir,i", bpo::value<std::string>(&input_dir), "Base path of OSMLR pbf tiles [required]")
-    ("output_dir,o", bpo::value<std::string>(&output_dir), "Base path to use when outputting GeoJSON tiles [required]")
+    ("input_dir,i", bpo::value<std::string>(&input_dir), "Base path of OSMLR pbf tiles, or a .pack archive of them [required]")
+    ("output_dir,o", bpo::value<std::string>(&output_dir), "Base path to use when outputting GeoJSON tiles, or a .pack archive to write them to [required]")
+    ("compression", bpo::value<std::string>(&compression_name)->default_value("none"), "Compression of the output GeoJSON tiles: none, gzip or zstd. Compressed input tiles are read whatever this is.")
+    ("shape-cache", bpo::value<unsigned int>(&shape_cache_size)->default_value(65536), "Number of decoded edge shapes to cache on each thread.")
+    ("precision,p", bpo::value<unsigned int>(&precision)->default_value(7), "Number of decimal places in GeoJSON coordinates.")
+    ("metrics", bpo::value<std::string>(&metrics_file), "Optional. A file to write a JSON report of the run's counters and histograms to.")
+    ("trace", bpo::value<std::string>(&trace_file), "Optional. A file to write a trace of the time spent on each tile to, in Chrome trace-event format.")
+    ("shard", bpo::value<std::string>(&shard_spec), "Optional. Convert only part i/N of the tiles (counting from 0), to spread the work over N machines. osmlr_merge puts the parts back together.")
+    ("manifest", bpo::value<std::string>(&manifest_file), "Optional. A file to write a list of the output tiles to, which osmlr_merge uses to check and stitch together shards.")
     // positional arguments
     ("config,c", bpo::value<std::string>(&config), "Valhalla configuration file [required]");
 
@@ -355,6 +394,26 @@ int main(int argc, char** argv) {
     LOG_ERROR("Must specify an output directory (use -o)");
     return EXIT_FAILURE;
   }
+  if (precision > util::json_writer::kMaxPrecision) {
+    LOG_ERROR("Precision must be at most " + std::to_string(util::json_writer::kMaxPrecision));
+    return EXIT_FAILURE;
+  }
+  util::compression codec;
+  try {
+    codec = util::parse_compression(compression_name);
+  } catch (const std::exception& e) {
+    LOG_ERROR(e.what());
+    return EXIT_FAILURE;
+  }
+  util::shard shard;
+  try {
+    if (!shard_spec.empty()) {
+      shard = util::shard::parse(shard_spec);
+    }
+  } catch (const std::exception& e) {
+    LOG_ERROR(e.what());
+    return EXIT_FAILURE;
+  }
   LOG_INFO("Input OSMLR directory: " + input_dir);
   LOG_INFO("Output OSMLR GeoJSON directory: " + output_dir);
 
@@ -365,51 +424,67 @@ int main(int argc, char** argv) {
   // Configure logging
   vm::logging::Configure({{"type","std_err"},{"color","true"}});
 
-  // A place to hold worker threads and their results, exceptions or otherwise
-  uint32_t nthreads = std::max(static_cast<unsigned int>(1), concurrency);
-  std::vector<std::shared_ptr<std::thread> > threads(nthreads);
-
-  // Create a randomized queue of tiles from OSMLR pbf
-  std::deque<vb::GraphId> tempqueue;
-  for (auto level : vb::TileHierarchy::levels()) {
-    auto level_id = level.second.level;
-    auto tiles = level.second.tiles;
-    for (uint32_t id = 0; id < tiles.TileCount(); ++id) {
-      // Get the location/filename for the OSMLR tile
-      vb::GraphId tile_id(id, level_id, 0);
-      std::string osmlr_tile = get_osmlr_tilename(input_dir, tile_id);
-
-      // If OSMLR pbf tile exists add it to the queue
-      if (exists(osmlr_tile)) {
-        tempqueue.push_back(tile_id);
-      }
-    }
+  if (!trace_file.empty()) {
+    util::trace::start();
+    util::trace::name_thread("main");
   }
 
-  std::random_shuffle(tempqueue.begin(), tempqueue.end());
-  std::queue<vb::GraphId> tilequeue(tempqueue);
+  // All the threads write into the same output directory, so it has to be
+  // purged before any of them start.
+  util::tile_writer::purge(output_dir);
 
-  // An atomic object we can use to do the synchronization
-  std::mutex lock;
+  // A place to hold worker threads and their results, exceptions or otherwise
+  uint32_t nthreads = std::max(static_cast<unsigned int>(1), concurrency);
+  std::vector<std::shared_ptr<std::thread> > threads(nthreads);
+  std::vector<worker_stats> stats(nthreads, worker_stats{0, 0.0});
+
+  // List the tiles from OSMLR pbf, largest first. The size of a .osmlr file
+  // is an estimate of how much work the tile is, and handing out the largest
+  // tiles first means that a dense tile doesn't hold up the end of the run
+  // while the other threads sit idle.
+  std::vector<util::tile_file> jobs = util::scan_tiles(input_dir, ".osmlr", nthreads);
+  jobs.erase(std::remove_if(jobs.begin(), jobs.end(), [&](const util::tile_file& t) {
+    return !shard.owns(t.tile_id);
+  }), jobs.end());
+  std::stable_sort(jobs.begin(), jobs.end(), [](const util::tile_file& a, const util::tile_file& b) {
+    return a.size > b.size;
+  });
+  std::atomic<size_t> next_job(0);
 
   // Start the threads
-  LOG_INFO("Forming GeoJSON for " + std::to_string(tilequeue.size()) + " OSMLR tiles");
+  LOG_INFO("Forming GeoJSON for " + std::to_string(jobs.size()) + " OSMLR tiles" +
+           (shard.whole() ? "" : " in shard " + shard.name()));
   boost::property_tree::ptree hierarchy_properties = pt.get_child("mjolnir");
-  for (auto& thread : threads) {
-    //results.emplace_back();
-    thread.reset(new std::thread(create_geojson,
-                    std::ref(tilequeue),
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i].reset(new std::thread(create_geojson,
+                    std::cref(jobs),
+                    std::ref(next_job),
+                    std::ref(stats[i]),
+                    start,
                     std::cref(output_dir),
                     std::cref(hierarchy_properties),
-                    std::cref(input_dir),
-                    std::ref(lock)));
-          //          std::ref(results.back())));
+                    precision,
+                    size_t(shape_cache_size),
+                    codec));
   }
 
   // Wait for them to finish up their work
   for (auto& thread : threads) {
     thread->join();
   }
+
+  // Every thread's writer is closed, so an archive can be indexed
+  util::tile_writer::write_index(output_dir);
+
+  // Report how busy each thread was over the run
+  double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  for (size_t i = 0; i < stats.size(); ++i) {
+    double utilization = total > 0.0 ? 100.0 * stats[i].busy / total : 100.0;
+    LOG_INFO("Thread " + std::to_string(i) + ": " + std::to_string(stats[i].tiles) +
+             " tiles, busy " + std::to_string(stats[i].busy) + "s of " +
+             std::to_string(total) + "s (" + std::to_string(int(std::round(utilization))) + "%)");
+  }
 /*
   // Check all of the outcomes
   enhancer_stats stats{std::numeric_limits<float>::min(), 0};
@@ -424,6 +499,20 @@ int main(int argc, char** argv) {
     }
   }
 */
+  if (!manifest_file.empty()) {
+    // all the tiles of a build come from the same changeset
+    uint64_t changeset_id = jobs.empty() ? 0 : util::tile_reader(jobs.front().path).changeset_id();
+    util::manifest manifest("geojson_osmlr", VERSION, shard, changeset_id);
+    manifest.add_output(".json", output_dir, nthreads);
+    manifest.write(manifest_file);
+  }
+  if (!metrics_file.empty()) {
+    util::metrics::get_counter("geojson_osmlr.elapsed_ms").add(uint64_t(total * 1000.0));
+    util::metrics::write_json(metrics_file);
+  }
+  if (!trace_file.empty()) {
+    util::trace::write_json(trace_file);
+  }
   LOG_INFO("Done");
   return EXIT_SUCCESS;
 }
@@ -10,11 +10,34 @@
 #include <boost/range/adaptor/map.hpp>
 #include <boost/algorithm/string.hpp>
 #include <time.h>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include <utility>
 
 #include "config.h"
 #include "osmlr/output/output.hpp"
+#include "osmlr/output/path_plan.hpp"
 #include "osmlr/output/geojson.hpp"
 #include "osmlr/output/tiles.hpp"
+#include "osmlr/output/lookup_table.hpp"
+#include "osmlr/output/spatial_index.hpp"
+#include "osmlr/output/mvt.hpp"
+#include "osmlr/util/compression.hpp"
+#include "osmlr/util/tile_writer.hpp"
+#include "osmlr/util/tile_archive.hpp"
+#include "osmlr/util/json_writer.hpp"
+#include "osmlr/util/metrics.hpp"
+#include "osmlr/util/trace.hpp"
+#include "osmlr/util/shape_cache.hpp"
+#include "osmlr/util/tile_scan.hpp"
+#include "osmlr/util/shard.hpp"
+#include "osmlr/util/manifest.hpp"
 
 namespace vm = valhalla::midgard;
 namespace vb = valhalla::baldr;
@@ -107,9 +130,13 @@ struct tiles_max_level {
     }
   };
 
-  tiles_max_level(unsigned int max_level) {
+  tiles_max_level(unsigned int max_level)
+    : tiles_max_level(0, max_level) {
+  }
+
+  tiles_max_level(unsigned int min_level, unsigned int max_level) {
     for (auto level : vb::TileHierarchy::levels() | bra::map_values) {
-      if (level.level <= max_level) {
+      if (level.level >= min_level && level.level <= max_level) {
         m_levels.push_back(level);
       }
     }
@@ -192,20 +219,180 @@ struct tile_exists_filter {
   }
 };
 
-bool check_access(vb::GraphReader &reader, const vb::merge::path &p) {
+// Hands a list of tiles to merging, clearing the reader's cache between tiles
+// once it holds more than it should. Merging doesn't hold on to a tile once
+// it moves on to the next, so that is when the cache can be cleared without
+// pulling tiles out from under it. on_clear is called after each clear, so
+// that anything else holding tiles from the reader can drop them.
+struct cache_bounded_tiles {
+  const std::vector<vb::GraphId> &m_tiles;
+  vb::GraphReader &m_reader;
+  std::function<void()> m_on_clear;
+
+  struct const_iterator {
+    std::vector<vb::GraphId>::const_iterator m_itr;
+    const cache_bounded_tiles *m_owner;
+
+    bool operator==(const const_iterator &other) const {
+      return m_itr == other.m_itr;
+    }
+
+    inline bool operator!=(const const_iterator &other) const {
+      return !operator==(other);
+    }
+
+    const_iterator &operator++() {
+      if (m_owner->m_reader.OverCommitted()) {
+        m_owner->m_reader.Clear();
+        m_owner->m_on_clear();
+      }
+      m_itr++;
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      const_iterator ret(*this);
+      ++(*this);
+      return ret;
+    }
+
+    vb::GraphId operator*() const {
+      return *m_itr;
+    }
+  };
+
+  cache_bounded_tiles(const std::vector<vb::GraphId> &tiles, vb::GraphReader &reader,
+                      std::function<void()> on_clear)
+    : m_tiles(tiles)
+    , m_reader(reader)
+    , m_on_clear(std::move(on_clear)) {
+  }
+
+  const_iterator begin() const { return const_iterator{m_tiles.begin(), this}; }
+  const_iterator end() const { return const_iterator{m_tiles.end(), this}; }
+};
+
+// The distance along a Hilbert curve filling a side by side grid, where side
+// is a power of two, of the cell at x, y.
+uint64_t hilbert_index(uint32_t side, uint32_t x, uint32_t y) {
+  uint64_t d = 0;
+  for (uint32_t s = side / 2; s > 0; s /= 2) {
+    const uint32_t rx = (x & s) != 0;
+    const uint32_t ry = (y & s) != 0;
+    d += uint64_t(s) * s * ((3 * rx) ^ ry);
+    // turn the quadrant so that the curve through it joins up
+    if (ry == 0) {
+      if (rx == 1) {
+        x = side - 1 - x;
+        y = side - 1 - y;
+      }
+      std::swap(x, y);
+    }
+  }
+  return d;
+}
+
+// Orders the tiles of a level along a Hilbert curve over its grid, rather
+// than row by row. Paths which cross out of a tile then mostly go into tiles
+// which were loaded recently or will be soon, so fewer tiles are reloaded
+// after the reader's cache is cleared. Segment ids are handed out in the
+// order paths are found, so this order decides them.
+void sort_spatially(std::vector<vb::GraphId>& tiles) {
+  if (tiles.empty()) {
+    return;
+  }
+  const auto& levels = vb::TileHierarchy::levels();
+  auto level = levels.find(tiles.front().level());
+  if (level == levels.end()) {
+    return;
+  }
+  const uint32_t columns = level->second.tiles.ncolumns();
+  const uint32_t rows = level->second.tiles.nrows();
+  uint32_t side = 1;
+  while (side < std::max(columns, rows)) {
+    side *= 2;
+  }
+
+  std::vector<std::pair<uint64_t, vb::GraphId> > keyed;
+  keyed.reserve(tiles.size());
+  for (auto tile_id : tiles) {
+    keyed.emplace_back(hilbert_index(side, tile_id.tileid() % columns,
+                                     tile_id.tileid() / columns), tile_id);
+  }
+  std::sort(keyed.begin(), keyed.end(),
+            [](const std::pair<uint64_t, vb::GraphId>& a,
+               const std::pair<uint64_t, vb::GraphId>& b) {
+              return a.first < b.first;
+            });
+  for (size_t i = 0; i < keyed.size(); ++i) {
+    tiles[i] = keyed[i].second;
+  }
+}
+
+// Lists the Valhalla tiles up to max_level, ordered by level and then tile
+// id, as sweeping the hierarchy would. They are read from tile_list if one is
+// given, otherwise found by scanning the tile directory. Failing both (e.g:
+// tiles in an extract), every possible tile is checked for.
+std::vector<vb::GraphId> list_graph_tiles(const bpt::ptree& hierarchy_properties,
+                                          vb::GraphReader& reader,
+                                          const unsigned int max_level,
+                                          const std::string& tile_list,
+                                          const size_t threads) {
+  std::vector<vb::GraphId> tiles;
+  if (!tile_list.empty()) {
+    // one tile path per line, as written by e.g: find . -name '*.gph'
+    std::ifstream in(tile_list);
+    if (!in) {
+      throw std::runtime_error("Unable to open tile list " + tile_list);
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+      boost::algorithm::trim(line);
+      if (!line.empty() && line[0] != '#') {
+        tiles.push_back(vb::GraphTile::GetTileId(line));
+      }
+    }
+    LOG_INFO("Read " + std::to_string(tiles.size()) + " tiles from " + tile_list);
+
+  } else {
+    const std::string tile_dir = hierarchy_properties.get<std::string>("tile_dir", "");
+    for (const auto& t : osmlr::util::scan_tiles(tile_dir, ".gph", threads)) {
+      tiles.push_back(t.tile_id);
+    }
+    if (!tiles.empty()) {
+      LOG_INFO("Found " + std::to_string(tiles.size()) + " tiles in " + tile_dir);
+    } else {
+      for (vb::GraphId tile_id : tile_exists_filter<tiles_max_level>(
+             tiles_max_level(max_level), reader)) {
+        tiles.push_back(tile_id);
+      }
+    }
+  }
+
+  tiles.erase(std::remove_if(tiles.begin(), tiles.end(), [&](const vb::GraphId& id) {
+    return id.level() > max_level;
+  }), tiles.end());
+  std::sort(tiles.begin(), tiles.end(), [](const vb::GraphId& a, const vb::GraphId& b) {
+    return a.level() < b.level() || (a.level() == b.level() && a.tileid() < b.tileid());
+  });
+  tiles.erase(std::unique(tiles.begin(), tiles.end()), tiles.end());
+  return tiles;
+}
+
+bool check_access(const osmlr::output::path_plan &plan) {
   // TODO: make traffic mask configurable
   int i = 0;
   uint32_t access = vb::kAllAccess;
-  for (auto edge_id : p.m_edges) {
-    auto edge = reader.GetGraphTile(edge_id)->directededge(edge_id);
+  for (const auto &e : plan.edges) {
+    auto edge = e.directededge;
     access &= edge->forwardaccess();
 
     // If the allow edge predicate is false for any edge, then drop
     // the whole path.
     if (!allow_edge_pred(edge)) {
       // Output an error if we find a disallowed edge along a multi-edge path
-      if (p.m_edges.size() > 1) {
-        LOG_WARN("Disallow path due to non-allowed edge. " +  std::to_string(p.m_edges.size()) +
+      if (plan.edges.size() > 1) {
+        LOG_WARN("Disallow path due to non-allowed edge. " +  std::to_string(plan.edges.size()) +
                  " edges: i = " + std::to_string(i));
       }
       return false;
@@ -215,31 +402,223 @@ bool check_access(vb::GraphReader &reader, const vb::merge::path &p) {
   return access & vb::kVehicularAccess;
 }
 
-bool recursive_copy(const bfs::path &src, const bfs::path &dst,
-                    const std::string &extension) {
-  try {
+// The work, and the state which must outlive it, for a single hierarchy
+// level. Merged paths never cross hierarchy levels (see allow_merge_pred) and
+// segment ids are indices within a tile, so each level can be processed by a
+// different thread. Within a level, paths are visited in the same order as a
+// single-threaded run, so the .osmlr and GeoJSON ids are the same. That order
+// follows the tiles along a Hilbert curve (see sort_spatially) rather than
+// row by row as releases before it did, so a fresh build numbers segments
+// differently from those. A shard only visits the paths found from its own
+// tiles, so its ids are the same as another build with the same number of
+// shards, though not an unsharded one.
+struct level_job {
+  uint8_t level;
+  std::vector<vb::GraphId> graph_tiles;
+  std::vector<std::string> osmlr_tiles, geojson_tiles;
+  std::shared_ptr<vb::GraphReader> reader;
+  std::shared_ptr<osmlr::output::output> output_tiles, output_geojson;
+  // single file outputs, which are shared by all the levels.
+  std::vector<std::shared_ptr<osmlr::output::output> > shared_outputs;
+  // when resuming, the number of merged paths which had been output at the
+  // checkpoint, and whether the level had been finished.
+  size_t resume_paths;
+  bool resume_done;
+  std::exception_ptr error;
 
-    if (bfs::is_directory(src)) {
-      bfs::create_directories(dst);
-      bfs::directory_iterator dir_itr(src), end_iter;
-      for (; dir_itr != end_iter; ++dir_itr)
-        recursive_copy(dir_itr->path(), dst/dir_itr->path().filename(), extension);
-    }
-    else if (bfs::is_regular_file(src)) {
-      // only grab the files that we want.
-      auto ext = src.extension();
-      if (ext == extension)
-        bfs::copy(src, dst);
+  explicit level_job(uint8_t level_)
+    : level(level_), resume_paths(0), resume_done(false) {}
+};
+
+// Checkpoints let a long run be carried on with --resume after it dies. The
+// edges used by merging carry over from one graph tile to the next, so a
+// level can't be resumed part way through its tiles. Instead, merged paths
+// are always visited in the same order, so a checkpoint records how many of
+// them had been output, along with the segment ids and file sizes of the
+// tiles at that point. Resuming merges the level again from the start and
+// skips the paths which were already output.
+//
+// Checkpoints are renamed into place once written, but aren't synced, so
+// they survive the process dying rather than the machine.
+std::string checkpoint_name(const std::string& checkpoint_dir, uint8_t level) {
+  return (bfs::path(checkpoint_dir) /
+          ("level_" + std::to_string(level) + ".checkpoint")).string();
+}
+
+// Identifies the graph tiles of a level, which must be the same when resuming
+// for the paths to come out in the same order.
+uint64_t fingerprint(const std::vector<vb::GraphId>& graph_tiles) {
+  uint64_t hash = 14695981039346656037ull;
+  for (auto tile_id : graph_tiles) {
+    hash = (hash ^ tile_id.value) * 1099511628211ull;
+  }
+  return hash;
+}
+
+void write_checkpoint(const std::string& checkpoint_dir, level_job& job,
+                      size_t paths, bool done) {
+  osmlr::util::trace::span span("checkpoint", vb::GraphId(0, job.level, 0));
+  const std::string file_name = checkpoint_name(checkpoint_dir, job.level);
+  const std::string tmp_name = file_name + ".tmp";
+  std::ofstream out(tmp_name, std::ios::out | std::ios::trunc);
+  out << "osmlr_checkpoint 1\n"
+      << "level " << unsigned(job.level) << "\n"
+      << "graph_tiles " << job.graph_tiles.size() << "\n"
+      << "fingerprint " << fingerprint(job.graph_tiles) << "\n"
+      << "paths " << paths << "\n"
+      << "done " << done << "\n";
+  job.output_tiles->checkpoint(out);
+  job.output_geojson->checkpoint(out);
+  out.close();
+  if (!out) {
+    throw std::runtime_error("Unable to write checkpoint " + tmp_name);
+  }
+  bfs::rename(tmp_name, file_name);
+}
+
+template <typename T>
+T read_checkpoint_field(std::istream& in, const std::string& key,
+                        const std::string& file_name) {
+  std::string name;
+  T value;
+  if (!(in >> name >> value) || name != key) {
+    throw std::runtime_error("Expected " + key + " in checkpoint " + file_name);
+  }
+  return value;
+}
+
+// Restores the level's outputs to its checkpoint. A level without one is
+// started again, removing whatever it had output.
+void read_checkpoint(const std::string& checkpoint_dir, level_job& job) {
+  const std::string file_name = checkpoint_name(checkpoint_dir, job.level);
+  std::ifstream in(file_name);
+  if (!in) {
+    std::istringstream none("end\nend\n");
+    job.output_tiles->resume(none, job.level);
+    job.output_geojson->resume(none, job.level);
+    return;
+  }
+
+  if (read_checkpoint_field<unsigned>(in, "osmlr_checkpoint", file_name) != 1) {
+    throw std::runtime_error("Unknown version of checkpoint " + file_name);
+  }
+  if (read_checkpoint_field<unsigned>(in, "level", file_name) != job.level) {
+    throw std::runtime_error("Checkpoint " + file_name + " is of another level");
+  }
+  if (read_checkpoint_field<size_t>(in, "graph_tiles", file_name) != job.graph_tiles.size() ||
+      read_checkpoint_field<uint64_t>(in, "fingerprint", file_name) != fingerprint(job.graph_tiles)) {
+    throw std::runtime_error("Checkpoint " + file_name + " was made with other graph tiles");
+  }
+  job.resume_paths = read_checkpoint_field<size_t>(in, "paths", file_name);
+  job.resume_done = read_checkpoint_field<bool>(in, "done", file_name);
+  // a finished level's tiles are complete, so are left as they are
+  if (!job.resume_done) {
+    job.output_tiles->resume(in, job.level);
+    job.output_geojson->resume(in, job.level);
+  }
+}
+
+/**
+ * Create OSMLR segments for each level taken from the job list.
+ */
+void create_segments(std::vector<level_job>& jobs, size_t& next_job,
+                     std::mutex& lock, const size_t shape_cache_size,
+                     const osmlr::util::shard& shard,
+                     const std::string& checkpoint_dir,
+                     const std::chrono::seconds checkpoint_interval) {
+  while (true) {
+    // Get the next level to work on
+    lock.lock();
+    if (next_job >= jobs.size()) {
+      lock.unlock();
+      break;
     }
-    else {
-      LOG_ERROR(dst.generic_string() + " not a directory or file");
-      return false;
+    level_job& job = jobs[next_job++];
+    lock.unlock();
+
+    try {
+      osmlr::util::trace::name_thread("level " + std::to_string(job.level));
+      osmlr::util::trace::span level_span("level", vb::GraphId(0, job.level, 0));
+      vb::GraphReader& reader = *job.reader;
+
+      // Merge edges to create OSMLR segments. Each path is planned once and
+      // then output to both pbf and GeoJSON
+      osmlr::output::path_plan plan;
+      osmlr::util::shape_cache shapes(shape_cache_size);
+      size_t clears = 0;
+      cache_bounded_tiles tiles(job.graph_tiles, reader, [&]() {
+        plan.clear_tiles();
+        clears++;
+      });
+      size_t paths = 0;
+      auto last_checkpoint = std::chrono::steady_clock::now();
+      // paths output before the checkpoint being resumed from only have to go
+      // to the shared outputs, which are kept in memory until the end.
+      const bool replay_shared = !job.shared_outputs.empty();
+      if (!job.resume_done || replay_shared) {
+        vb::merge::merge(
+          tiles, reader, allow_merge_pred, allow_edge_pred,
+          [&](const vb::merge::path &p) {
+            osmlr::util::trace::span span("path");
+            const bool replay = job.resume_done || paths < job.resume_paths;
+            paths++;
+            if (replay && !replay_shared) {
+              return;
+            }
+            plan.resolve(reader, p);
+            if (check_access(plan)) {
+              plan.split(reader, shapes);
+              // paths cross into tiles of other shards, which make the
+              // segments allocated in those tiles themselves
+              if (!shard.whole()) {
+                plan.segments.erase(
+                  std::remove_if(plan.segments.begin(), plan.segments.end(),
+                                 [&](const osmlr::output::path_plan::segment& seg) {
+                                   return !shard.owns(seg.tile_id);
+                                 }),
+                  plan.segments.end());
+              }
+              if (!replay) {
+                job.output_tiles->add_path(plan);
+                job.output_geojson->add_path(plan);
+              }
+              for (auto& output : job.shared_outputs) {
+                output->add_path(plan);
+              }
+            }
+            if (!replay && !checkpoint_dir.empty() &&
+                std::chrono::steady_clock::now() - last_checkpoint >= checkpoint_interval) {
+              write_checkpoint(checkpoint_dir, job, paths, false);
+              last_checkpoint = std::chrono::steady_clock::now();
+            }
+          });
+      }
+
+      // GeoJSON has to close the feature collection in every tile it touched,
+      // so finish it here rather than serially in the main thread.
+      if (!job.resume_done) {
+        job.output_geojson->finish();
+        if (!checkpoint_dir.empty()) {
+          write_checkpoint(checkpoint_dir, job, paths, true);
+        }
+      }
+
+      osmlr::util::metrics::get_counter("graph_reader.clears").add(clears);
+      LOG_INFO("Level " + std::to_string(job.level) + " graph tile cache cleared " +
+               std::to_string(clears) + " times");
+
+      const auto &stats = shapes.get_stats();
+      osmlr::util::metrics::get_counter("shape_cache.hits").add(stats.hits);
+      osmlr::util::metrics::get_counter("shape_cache.misses").add(stats.misses);
+      osmlr::util::metrics::get_counter("shape_cache.evictions").add(stats.evictions);
+      LOG_INFO("Level " + std::to_string(job.level) + " shape cache hits = " +
+               std::to_string(stats.hits) + " misses = " + std::to_string(stats.misses) +
+               " evictions = " + std::to_string(stats.evictions));
+
+    } catch (...) {
+      job.error = std::current_exception();
     }
-  } catch (boost::filesystem::filesystem_error const & e) {
-    std::cerr << "Exception checking or creating directories or files " << e.what() << std::endl;
-    return false;
   }
-  return true;
 }
 
 int main(int argc, char** argv) {
@@ -252,18 +631,41 @@ int main(int argc, char** argv) {
                                    "\n");
 
   // Parse options
-  unsigned int max_level, max_fds;
-  std::string config;
+  unsigned int max_level, max_fds, buffer_size, concurrency, precision, shape_cache_size;
+  unsigned int checkpoint_interval, graph_cache_size;
+  unsigned int default_concurrency = std::thread::hardware_concurrency();
+  std::string config, tile_list;
   std::string input_osmlr_dir, input_geojson_dir, output_osmlr_dir, output_geojson_dir;
+  std::string output_table_file, output_index_file, output_mvt_dir, mvt_zooms;
+  std::string compression_name, metrics_file, trace_file, checkpoint_dir;
+  std::string shard_spec, manifest_file;
   options.add_options()
-    ("input-tiles,P", bpo::value<std::string>(&input_osmlr_dir), "Required for update. The base path to use when inputting OSMLR tiles.")
-    ("input-geojson,G", bpo::value<std::string>(&input_geojson_dir), "Required for update. The base path to use when inputting GeoJSON tiles.")
+    ("input-tiles,P", bpo::value<std::string>(&input_osmlr_dir), "Required for update. The base path to use when inputting OSMLR tiles, or a .pack archive of them.")
+    ("input-geojson,G", bpo::value<std::string>(&input_geojson_dir), "Required for update. The base path to use when inputting GeoJSON tiles, or a .pack archive of them.")
     ("help,h", "Print this help message.")
     ("version,v", "Print the version of this software.")
     ("max-level,m", bpo::value<unsigned int>(&max_level)->default_value(255), "Maximum level to evaluate")
     ("max-fds,f", bpo::value<unsigned int>(&max_fds)->default_value(512), "Maximum number of files to have open in each output.")
-    ("output-tiles,T", bpo::value<std::string>(&output_osmlr_dir), "Required. The base path to use when outputting OSMLR tiles.")
-    ("output-geojson,J", bpo::value<std::string>(&output_geojson_dir), "Required. The base path to use when outputting GeoJSON tiles.")
+    ("buffer-size,b", bpo::value<unsigned int>(&buffer_size)->default_value(0), "Megabytes of tile data to buffer in memory before writing, in total across all the OSMLR and GeoJSON tiles being written. Zero writes through immediately.")
+    ("precision,p", bpo::value<unsigned int>(&precision)->default_value(7), "Number of decimal places in GeoJSON coordinates.")
+    ("compression", bpo::value<std::string>(&compression_name)->default_value("none"), "Compression of the output OSMLR and GeoJSON tiles: none, gzip or zstd. Compressed input tiles are read whatever this is.")
+    ("shape-cache", bpo::value<unsigned int>(&shape_cache_size)->default_value(65536), "Number of decoded edge shapes to cache on each thread.")
+    ("graph-cache", bpo::value<unsigned int>(&graph_cache_size)->default_value(0), "Megabytes of Valhalla tiles each level's reader keeps before clearing its cache. Zero uses max_cache_size from the config.")
+    ("tile-list,l", bpo::value<std::string>(&tile_list), "Optional. A file listing the Valhalla tiles to use, one tile path per line. Without it the tile directory is scanned.")
+    ("threads,t", bpo::value<unsigned int>(&concurrency)->default_value(default_concurrency), "Concurrency, number of threads. Existing tiles are updated in parallel, then each hierarchy level is processed by a single thread.")
+    ("output-tiles,T", bpo::value<std::string>(&output_osmlr_dir), "Required. The base path to use when outputting OSMLR tiles, or a .pack archive to write them to.")
+    ("output-geojson,J", bpo::value<std::string>(&output_geojson_dir), "Required. The base path to use when outputting GeoJSON tiles, or a .pack archive to write them to.")
+    ("output-table", bpo::value<std::string>(&output_table_file), "Optional. A file to write a flat, memory mappable lookup table of all the segments to.")
+    ("output-index", bpo::value<std::string>(&output_index_file), "Optional. A file to write a spatial index (packed R-tree) of the segments' bounding boxes to.")
+    ("output-mvt", bpo::value<std::string>(&output_mvt_dir), "Optional. The base path to use when outputting Mapbox Vector Tiles of the segments.")
+    ("mvt-zooms", bpo::value<std::string>(&mvt_zooms)->default_value("12"), "Comma separated zoom levels to output vector tiles at.")
+    ("metrics", bpo::value<std::string>(&metrics_file), "Optional. A file to write a JSON report of the run's counters and histograms to.")
+    ("trace", bpo::value<std::string>(&trace_file), "Optional. A file to write a trace of the time spent in each stage to, in Chrome trace-event format.")
+    ("checkpoint", bpo::value<std::string>(&checkpoint_dir), "Optional. A directory to save checkpoints of each level's progress to, which --resume carries on from.")
+    ("checkpoint-interval", bpo::value<unsigned int>(&checkpoint_interval)->default_value(600), "Seconds between checkpoints of each level.")
+    ("resume", "Optional. Carry on from the checkpoints in the --checkpoint directory after a run died, rather than starting again.")
+    ("shard", bpo::value<std::string>(&shard_spec), "Optional. Build only part i/N of the tiles (counting from 0), to spread a build over N machines. osmlr_merge puts the parts back together.")
+    ("manifest", bpo::value<std::string>(&manifest_file), "Optional. A file to write a list of the output tiles to, which osmlr_merge uses to check and stitch together shards.")
     ("update,u", "Optional.  Do you want to update the OSMLR data?")
     // positional arguments
     ("config", bpo::value<std::string>(&config), "Valhalla configuration file [required]");
@@ -293,6 +695,7 @@ int main(int argc, char** argv) {
   }
 
   bool is_update = vm.count("update") ? true : false;
+  bool is_resume = vm.count("resume") ? true : false;
   if (is_update) {
     // Make sure both input directories are present
     if (input_osmlr_dir.empty() || input_osmlr_dir == "--config") {
@@ -304,7 +707,7 @@ int main(int argc, char** argv) {
       return EXIT_FAILURE;
     }
 
-  } else {
+  } else if (!is_resume) {
     std::string doit;
     std::cout << "Are you sure you want to create new OSMLR data [Y|N]?" << std::endl;
     std::getline(std::cin,doit);
@@ -323,6 +726,56 @@ int main(int argc, char** argv) {
     return EXIT_FAILURE;
   }
 
+  if (is_resume && checkpoint_dir.empty()) {
+    LOG_ERROR("Must specify a checkpoint directory to resume from");
+    return EXIT_FAILURE;
+  }
+  // an update's existing tiles are changed in place as it goes, and archives
+  // are appended to, so neither can be cut back to a checkpoint.
+  if (!checkpoint_dir.empty() && is_update) {
+    LOG_ERROR("Checkpoints can't be used when updating");
+    return EXIT_FAILURE;
+  }
+  if (!checkpoint_dir.empty() &&
+      (osmlr::util::tile_archive::is_archive(output_osmlr_dir) ||
+       osmlr::util::tile_archive::is_archive(output_geojson_dir))) {
+    LOG_ERROR("Checkpoints can't be used when outputting to an archive");
+    return EXIT_FAILURE;
+  }
+
+  osmlr::util::shard shard;
+  try {
+    if (!shard_spec.empty()) {
+      shard = osmlr::util::shard::parse(shard_spec);
+    }
+  } catch (const std::exception& e) {
+    LOG_ERROR(e.what());
+    return EXIT_FAILURE;
+  }
+  if (!shard.whole() && (!output_table_file.empty() || !output_index_file.empty() ||
+                         !output_mvt_dir.empty())) {
+    LOG_ERROR("Lookup tables, indexes and vector tiles can't be built in shards");
+    return EXIT_FAILURE;
+  }
+
+  if (precision > osmlr::util::json_writer::kMaxPrecision) {
+    LOG_ERROR("Precision must be at most " + std::to_string(osmlr::util::json_writer::kMaxPrecision));
+    return EXIT_FAILURE;
+  }
+  osmlr::util::compression codec;
+  try {
+    codec = osmlr::util::parse_compression(compression_name);
+  } catch (const std::exception& e) {
+    LOG_ERROR(e.what());
+    return EXIT_FAILURE;
+  }
+
+  const auto start_time = std::chrono::steady_clock::now();
+  if (!trace_file.empty()) {
+    osmlr::util::trace::start();
+    osmlr::util::trace::name_thread("main");
+  }
+
   //parse the config
   bpt::ptree pt;
   bpt::read_json(config.c_str(), pt);
@@ -331,17 +784,30 @@ int main(int argc, char** argv) {
   vm::logging::Configure({{"type","std_err"},{"color","true"}});
 
   //get something we can use to fetch tiles
-  vb::GraphReader reader(pt.get_child("mjolnir"));
+  bpt::ptree& hierarchy_properties = pt.get_child("mjolnir");
+  if (graph_cache_size > 0) {
+    hierarchy_properties.put("max_cache_size", size_t(graph_cache_size) * 1024 * 1024);
+  }
+  vb::GraphReader reader(hierarchy_properties);
 
   assert(max_level <= std::numeric_limits<uint8_t>::max());
-  auto filtered_tiles = tile_exists_filter<tiles_max_level>(
-    tiles_max_level(max_level), reader);
+  concurrency = std::max(static_cast<unsigned int>(1), concurrency);
+
+  // Find the tiles to work on, just once
+  std::vector<vb::GraphId> graph_tiles;
+  try {
+    graph_tiles = list_graph_tiles(hierarchy_properties, reader, max_level,
+                                   tile_list, concurrency);
+  } catch (const std::exception& e) {
+    LOG_ERROR(std::string("Unable to list tiles: ") + e.what());
+    return EXIT_FAILURE;
+  }
 
   // Get the OSM changeset Id and current date. Do this here so common across
   // all tiles.
   uint64_t osm_changeset_id = 0;
   time_t creation_date = time(nullptr);
-  for (vb::GraphId tile_id : filtered_tiles) {
+  for (vb::GraphId tile_id : graph_tiles) {
     const auto *tile = reader.GetGraphTile(tile_id);
     if (tile != nullptr) {
       osm_changeset_id = tile->header()->dataset_id();
@@ -349,80 +815,227 @@ int main(int argc, char** argv) {
     }
   }
 
-  // Create output for OSMLR (pbf) and GeoJSON tiles
-  std::shared_ptr<osmlr::output::output> output_tiles, output_geojson;
-  output_tiles = std::make_shared<osmlr::output::tiles>(reader, output_osmlr_dir, max_fds,
-                             creation_date, osm_changeset_id);
+  // One job per level to be evaluated, with the tiles on that level
+  std::vector<level_job> jobs;
+  for (auto level : vb::TileHierarchy::levels() | bra::map_values) {
+    if (level.level <= max_level) {
+      jobs.emplace_back(level.level);
+    }
+  }
+  for (auto tile_id : graph_tiles) {
+    if (!shard.owns(tile_id)) {
+      continue;
+    }
+    for (auto& job : jobs) {
+      if (job.level == tile_id.level()) {
+        job.graph_tiles.push_back(tile_id);
+      }
+    }
+  }
+  for (auto& job : jobs) {
+    sort_spatially(job.graph_tiles);
+  }
 
-  if (!output_tiles) {
-    LOG_ERROR("Error creating output - exiting");
-    return EXIT_FAILURE;
+  // Start with empty output directories. These are shared by all the jobs, so
+  // have to be purged once, up front. When resuming they are kept, and each
+  // level's tiles are cut back to its checkpoint below.
+  if (!is_resume) {
+    osmlr::util::tile_writer::purge(output_osmlr_dir);
+    osmlr::util::tile_writer::purge(output_geojson_dir);
+    if (!checkpoint_dir.empty()) {
+      bfs::create_directories(checkpoint_dir);
+      for (const auto& job : jobs) {
+        bfs::remove(checkpoint_name(checkpoint_dir, job.level));
+      }
+    }
   }
 
-  std::unordered_map<valhalla::baldr::GraphId, uint32_t> tile_index;
   if (is_update) {
-
-    if (!recursive_copy(input_osmlr_dir,output_osmlr_dir, ".osmlr")) {
-      LOG_ERROR("Data copy failed.");
+    // Carry the previous release over into the output directories. Files are
+    // shared with the input where possible, and only get copies of their own
+    // when they are changed.
+    std::vector<std::string> osmlr_tiles, geojson_tiles;
+    try {
+      osmlr_tiles = osmlr::util::tile_writer::carry_over(input_osmlr_dir, output_osmlr_dir, ".osmlr", codec);
+      geojson_tiles = osmlr::util::tile_writer::carry_over(input_geojson_dir, output_geojson_dir, ".json", codec);
+    } catch (const std::exception &e) {
+      LOG_ERROR(std::string("Data copy failed: ") + e.what());
       return EXIT_FAILURE;
     }
 
-    std::vector<std::string> osmlr_tiles;
-    auto osmlr_itr = bfs::recursive_directory_iterator(output_osmlr_dir);
-    auto osmlr_end = bfs::recursive_directory_iterator();
-    for (; osmlr_itr != osmlr_end; ++osmlr_itr) {
-      auto dir_entry = *osmlr_itr;
-      if (bfs::is_regular_file(dir_entry)) {
-        auto ext = dir_entry.path().extension();
-        if (ext == ".osmlr") {
-          osmlr_tiles.emplace_back(dir_entry.path().string());
+    // Hand the existing tiles to the job for their level. Those of other
+    // shards are carried over too, but left as they are.
+    for (const auto& t : osmlr_tiles) {
+      auto tile_id = vb::GraphTile::GetTileId(osmlr::util::uncompressed_name(t));
+      if (!shard.owns(tile_id)) {
+        continue;
+      }
+      auto level = tile_id.level();
+      for (auto& job : jobs) {
+        if (job.level == level) {
+          job.osmlr_tiles.push_back(t);
+        }
+      }
+    }
+    for (const auto& t : geojson_tiles) {
+      auto tile_id = vb::GraphTile::GetTileId(osmlr::util::uncompressed_name(t));
+      if (!shard.owns(tile_id)) {
+        continue;
+      }
+      auto level = tile_id.level();
+      for (auto& job : jobs) {
+        if (job.level == level) {
+          job.geojson_tiles.push_back(t);
         }
       }
     }
-    tile_index = output_tiles->update_tiles(osmlr_tiles);
   }
 
-  output_geojson = std::make_shared<osmlr::output::geojson>(reader, output_geojson_dir, max_fds,
-                                                            creation_date, osm_changeset_id,
-                                                            tile_index);
-  if (!output_geojson) {
-    LOG_ERROR("Error creating output - exiting");
-    return EXIT_FAILURE;
+  // Each level has two outputs with up to max_fds files open, on top of the
+  // files the process needs for everything else.
+  size_t wanted_fds = size_t(max_fds) * 2 * jobs.size() + 64;
+  size_t fd_limit = osmlr::util::tile_writer::raise_fd_limit(wanted_fds);
+  if (fd_limit < wanted_fds) {
+    LOG_WARN("Open file limit is " + std::to_string(fd_limit) + " but " +
+             std::to_string(wanted_fds) + " may be needed. Consider lowering "
+             "--max-fds or --threads.");
   }
-  if (is_update) {
 
-    if (!recursive_copy(input_geojson_dir,output_geojson_dir, ".json")) {
-      LOG_ERROR("Data copy failed.");
-      return EXIT_FAILURE;
-    }
+  // Every tile writer of every level buffers within the one budget
+  std::shared_ptr<osmlr::util::buffer_budget> budget;
+  if (buffer_size > 0) {
+    budget = std::make_shared<osmlr::util::buffer_budget>(size_t(buffer_size) * 1024 * 1024);
+  }
 
-    std::vector<std::string> geojson_tiles;
-    auto geojson_itr = bfs::recursive_directory_iterator(output_geojson_dir);
-    auto geojson_end = bfs::recursive_directory_iterator();
-    for (; geojson_itr != geojson_end; ++geojson_itr) {
-      auto dir_entry = *geojson_itr;
-      if (bfs::is_regular_file(dir_entry)) {
-        auto ext = dir_entry.path().extension();
-        if (ext == ".json") {
-          geojson_tiles.emplace_back(dir_entry.path().string());
-        }
+  // Create the outputs for each level. When updating, the existing tiles of
+  // each level are brought up to date first, spread over all the threads.
+  std::vector<std::shared_ptr<osmlr::output::output> > shared_outputs;
+  if (!output_table_file.empty()) {
+    shared_outputs.push_back(std::make_shared<osmlr::output::lookup_table>(
+      reader, output_table_file, creation_date, osm_changeset_id));
+  }
+  if (!output_index_file.empty()) {
+    shared_outputs.push_back(std::make_shared<osmlr::output::spatial_index>(
+      reader, output_index_file));
+  }
+  if (!output_mvt_dir.empty()) {
+    std::vector<std::string> zoom_strs;
+    boost::split(zoom_strs, mvt_zooms, boost::is_any_of(","));
+    std::vector<unsigned int> zooms;
+    for (const auto &zoom : zoom_strs) {
+      try {
+        zooms.push_back(std::stoul(zoom));
+      }
+      catch (const std::exception &) {
+        LOG_ERROR("Invalid vector tile zoom: " + zoom);
+        return EXIT_FAILURE;
       }
     }
-    output_geojson->update_tiles(geojson_tiles);
+    shared_outputs.push_back(std::make_shared<osmlr::output::mvt>(
+      reader, output_mvt_dir, zooms));
   }
+  for (auto& job : jobs) {
+    // Each level gets its own reader, as they are not thread safe
+    job.reader = std::make_shared<vb::GraphReader>(hierarchy_properties);
+    job.shared_outputs = shared_outputs;
+    if (is_update) {
+      // these have to read the existing tiles before they are updated below
+      for (auto& output : shared_outputs) {
+        output->update_tiles(job.osmlr_tiles, hierarchy_properties, concurrency);
+      }
+    }
+
+    // Create output for OSMLR (pbf) and GeoJSON tiles
+    job.output_tiles = std::make_shared<osmlr::output::tiles>(
+      *job.reader, output_osmlr_dir, max_fds, budget,
+      creation_date, osm_changeset_id, codec);
+
+    std::unordered_map<vb::GraphId, uint32_t> tile_index;
+    if (is_update) {
+      LOG_INFO("Updating " + std::to_string(job.osmlr_tiles.size()) +
+               " OSMLR tiles on level " + std::to_string(job.level));
+      tile_index = job.output_tiles->update_tiles(job.osmlr_tiles, hierarchy_properties,
+                                                  concurrency);
+    }
 
-  // Merge edges to create OSMLR segments. Output to both pbf and GeoJSON
-  vb::merge::merge(
-    filtered_tiles, reader, allow_merge_pred, allow_edge_pred,
-    [&](const vb::merge::path &p) {
-      if (check_access(reader, p)) {
-        output_tiles->add_path(p);
-        output_geojson->add_path(p);
+    job.output_geojson = std::make_shared<osmlr::output::geojson>(
+      *job.reader, output_geojson_dir, max_fds, budget,
+      creation_date, osm_changeset_id, tile_index, precision, codec);
+    if (is_update) {
+      LOG_INFO("Updating " + std::to_string(job.geojson_tiles.size()) +
+               " GeoJSON tiles on level " + std::to_string(job.level));
+      job.output_geojson->update_tiles(job.geojson_tiles, hierarchy_properties,
+                                       concurrency);
+    }
+
+    if (is_resume) {
+      try {
+        read_checkpoint(checkpoint_dir, job);
+      } catch (const std::exception& e) {
+        LOG_ERROR("Unable to resume level " + std::to_string(job.level) + ": " + e.what());
+        return EXIT_FAILURE;
       }
-    });
+      LOG_INFO("Resuming level " + std::to_string(job.level) +
+               (job.resume_done ? " which had finished"
+                : " after " + std::to_string(job.resume_paths) + " paths"));
+    }
+  }
+
+  // No point in having more threads than levels
+  uint32_t nthreads = std::min(concurrency, static_cast<uint32_t>(std::max(jobs.size(), size_t(1))));
+  std::vector<std::shared_ptr<std::thread> > threads(nthreads);
 
-  output_tiles->finish();
-  output_geojson->finish();
+  // Start the threads
+  LOG_INFO("Creating OSMLR segments for " + std::to_string(jobs.size()) +
+           " levels using " + std::to_string(nthreads) + " threads" +
+           (shard.whole() ? "" : " in shard " + shard.name()));
+  size_t next_job = 0;
+  std::mutex lock;
+  for (auto& thread : threads) {
+    thread.reset(new std::thread(create_segments,
+                    std::ref(jobs),
+                    std::ref(next_job),
+                    std::ref(lock),
+                    size_t(shape_cache_size),
+                    std::cref(shard),
+                    std::cref(checkpoint_dir),
+                    std::chrono::seconds(checkpoint_interval)));
+  }
+
+  // Wait for them to finish up their work
+  for (auto& thread : threads) {
+    thread->join();
+  }
+
+  // Finish the pbf output in level order, so that the stats come out in a
+  // predictable order.
+  for (auto& job : jobs) {
+    if (job.error) {
+      std::rethrow_exception(job.error);
+    }
+    job.output_tiles->finish();
+  }
+  for (auto& output : shared_outputs) {
+    output->finish();
+  }
+  // Every writer is done, so archives can be indexed
+  osmlr::util::tile_writer::write_index(output_osmlr_dir);
+  osmlr::util::tile_writer::write_index(output_geojson_dir);
+  if (!manifest_file.empty()) {
+    osmlr::util::manifest manifest("osmlr", VERSION, shard, osm_changeset_id);
+    manifest.add_output(".osmlr", output_osmlr_dir, concurrency);
+    manifest.add_output(".json", output_geojson_dir, concurrency);
+    manifest.write(manifest_file);
+  }
+  if (!metrics_file.empty()) {
+    osmlr::util::metrics::get_counter("osmlr.elapsed_ms").add(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start_time).count());
+    osmlr::util::metrics::write_json(metrics_file);
+  }
+  if (!trace_file.empty()) {
+    osmlr::util::trace::write_json(trace_file);
+  }
   LOG_INFO("Done");
   return EXIT_SUCCESS;
 }
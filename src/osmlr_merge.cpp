@@ -0,0 +1,238 @@
+#include <valhalla/midgard/logging.h>
+
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "config.h"
+#include "osmlr/util/compression.hpp"
+#include "osmlr/util/manifest.hpp"
+#include "osmlr/util/shard.hpp"
+#include "osmlr/util/tile_scan.hpp"
+#include "osmlr/util/tile_writer.hpp"
+
+namespace vm = valhalla::midgard;
+namespace vb = valhalla::baldr;
+namespace util = osmlr::util;
+
+namespace bpo = boost::program_options;
+
+// Checks that the manifests are of one build, with each of its shards once.
+void check_shards(const std::vector<util::manifest>& manifests) {
+  const auto& first = manifests.front();
+  std::vector<bool> seen(first.part.count, false);
+  for (const auto& m : manifests) {
+    if (m.tool != first.tool) {
+      throw std::runtime_error("Can't merge shards of " + m.tool + " with shards of " + first.tool);
+    }
+    if (m.version != first.version) {
+      LOG_WARN("Shard " + m.part.name() + " was built by version " + m.version +
+               " but shard " + first.part.name() + " by version " + first.version);
+    }
+    if (m.changeset_id != first.changeset_id) {
+      throw std::runtime_error("Shard " + m.part.name() + " was built from changeset " +
+                               std::to_string(m.changeset_id) + " but shard " +
+                               first.part.name() + " from changeset " +
+                               std::to_string(first.changeset_id));
+    }
+    if (m.part.count != first.part.count) {
+      throw std::runtime_error("Shard " + m.part.name() + " is of a build in " +
+                               std::to_string(m.part.count) + " shards, not " +
+                               std::to_string(first.part.count));
+    }
+    if (seen[m.part.index]) {
+      throw std::runtime_error("Shard " + m.part.name() + " was given more than once");
+    }
+    seen[m.part.index] = true;
+  }
+  for (uint32_t i = 0; i < seen.size(); ++i) {
+    if (!seen[i]) {
+      throw std::runtime_error("Shard " + util::shard(i, first.part.count).name() + " is missing");
+    }
+  }
+}
+
+// Checks that the tiles of each output of the shard are on disk as the
+// manifest lists them, and are only those the shard owns. Fills in where
+// each tile is.
+void check_tiles(util::manifest& m, size_t threads,
+                 std::map<std::string, std::unordered_set<vb::GraphId> >& merged) {
+  for (auto& entry : m.outputs) {
+    const std::string& extension = entry.first;
+    auto& output = entry.second;
+    std::unordered_map<vb::GraphId, util::tile_file> on_disk;
+    for (const auto& t : util::scan_tiles(output.base, extension, threads)) {
+      if (m.part.owns(t.tile_id)) {
+        on_disk.emplace(t.tile_id, t);
+      }
+    }
+
+    auto& seen = merged[extension];
+    for (auto& t : output.tiles) {
+      const std::string name = std::to_string(t.tile_id.level()) + "/" +
+                               std::to_string(t.tile_id.tileid()) + extension;
+      if (!m.part.owns(t.tile_id)) {
+        throw std::runtime_error("Shard " + m.part.name() + " lists tile " + name +
+                                 " which belongs to another shard");
+      }
+      if (!seen.insert(t.tile_id).second) {
+        throw std::runtime_error("Tile " + name + " is listed by more than one shard");
+      }
+      auto itr = on_disk.find(t.tile_id);
+      if (itr == on_disk.end()) {
+        throw std::runtime_error("Tile " + name + " of shard " + m.part.name() +
+                                 " is missing from " + output.base);
+      }
+      if (itr->second.size != t.size) {
+        throw std::runtime_error(itr->second.path + " is " + std::to_string(itr->second.size) +
+                                 " bytes but shard " + m.part.name() + " lists it as " +
+                                 std::to_string(t.size));
+      }
+      t.path = itr->second.path;
+      on_disk.erase(itr);
+    }
+    if (!on_disk.empty()) {
+      throw std::runtime_error(std::to_string(on_disk.size()) + " " + extension +
+                               " tiles of shard " + m.part.name() + " in " + output.base +
+                               " aren't in its manifest, e.g: " + on_disk.begin()->second.path);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  bpo::options_description options("osmlr_merge " VERSION "\n"
+                                   "\n"
+                                   " Usage: osmlr_merge [options] manifest...\n"
+                                   "\n"
+                                   "osmlr_merge checks the manifests of a build done in shards "
+                                   "against the tiles each shard wrote, and stitches the tiles "
+                                   "of all the shards together. Without any outputs it only checks."
+                                   "\n"
+                                   "\n");
+
+  unsigned int concurrency;
+  std::vector<std::string> manifest_files;
+  std::string output_osmlr_dir, output_geojson_dir, compression_name, manifest_file;
+  options.add_options()
+    ("help,h", "Print this help message.")
+    ("version,v", "Print the version of this software.")
+    ("threads,t", bpo::value<unsigned int>(&concurrency)->default_value(std::thread::hardware_concurrency()), "Number of threads to list the tiles of each shard with.")
+    ("output-tiles,T", bpo::value<std::string>(&output_osmlr_dir), "Optional. The base path to put the OSMLR tiles of all the shards, or a .pack archive to write them to.")
+    ("output-geojson,J", bpo::value<std::string>(&output_geojson_dir), "Optional. The base path to put the GeoJSON tiles of all the shards, or a .pack archive to write them to.")
+    ("compression", bpo::value<std::string>(&compression_name)->default_value("none"), "Compression of the output tiles: none, gzip or zstd. Tiles compressed this way are linked rather than copied where possible.")
+    ("manifest", bpo::value<std::string>(&manifest_file), "Optional. A file to write a manifest of the merged outputs to.")
+    // positional arguments
+    ("manifests", bpo::value<std::vector<std::string> >(&manifest_files)->multitoken(), "Manifests of the shards [required]");
+
+  bpo::positional_options_description pos_options;
+  pos_options.add("manifests", -1);
+  bpo::variables_map vm;
+  try {
+    bpo::store(bpo::command_line_parser(argc, argv).options(options).positional(pos_options).run(), vm);
+    bpo::notify(vm);
+  }
+  catch (std::exception &e) {
+    std::cerr << "Unable to parse command line options because: " << e.what()
+              << "\n" << "This is a bug, please report it at " PACKAGE_BUGREPORT
+              << "\n";
+    return EXIT_FAILURE;
+  }
+
+  if (vm.count("help") || manifest_files.empty()) {
+    std::cout << options << "\n";
+    return EXIT_SUCCESS;
+  }
+
+  if (vm.count("version")) {
+    std::cout << "osmlr " << VERSION << "\n";
+    return EXIT_SUCCESS;
+  }
+
+  // Configure logging before anything is logged
+  vm::logging::Configure({{"type","std_err"},{"color","true"}});
+
+  util::compression codec;
+  try {
+    codec = util::parse_compression(compression_name);
+  } catch (const std::exception& e) {
+    LOG_ERROR(e.what());
+    return EXIT_FAILURE;
+  }
+
+  const size_t threads = std::max(concurrency, 1u);
+
+  std::vector<util::manifest> manifests;
+  std::map<std::string, std::unordered_set<vb::GraphId> > merged;
+  try {
+    for (const auto& file_name : manifest_files) {
+      manifests.push_back(util::manifest::read(file_name));
+    }
+    check_shards(manifests);
+    std::sort(manifests.begin(), manifests.end(),
+              [](const util::manifest& a, const util::manifest& b) {
+                return a.part.index < b.part.index;
+              });
+    for (auto& m : manifests) {
+      check_tiles(m, threads, merged);
+    }
+  } catch (const std::exception& e) {
+    LOG_ERROR(e.what());
+    return EXIT_FAILURE;
+  }
+  for (const auto& entry : merged) {
+    LOG_INFO("Checked " + std::to_string(entry.second.size()) + " " + entry.first +
+             " tiles in " + std::to_string(manifests.size()) + " shards");
+  }
+
+  // Stitch each output of the shards together
+  const auto& first = manifests.front();
+  util::manifest result(first.tool, first.version, util::shard(), first.changeset_id);
+  const std::map<std::string, std::string> destinations{
+    {".osmlr", output_osmlr_dir}, {".json", output_geojson_dir}};
+  try {
+    for (const auto& destination : destinations) {
+      if (destination.second.empty()) {
+        continue;
+      }
+      if (merged.find(destination.first) == merged.end()) {
+        LOG_WARN("The shards have no " + destination.first + " tiles to put in " +
+                 destination.second);
+        continue;
+      }
+
+      util::tile_writer::purge(destination.second);
+      util::tile_writer writer(destination.second, destination.first.substr(1), 1, 0, codec);
+      for (const auto& m : manifests) {
+        auto output = m.outputs.find(destination.first);
+        if (output == m.outputs.end()) {
+          continue;
+        }
+        for (const auto& t : output->second.tiles) {
+          writer.write_tile(t.tile_id, t.path);
+        }
+      }
+      writer.close_all();
+      util::tile_writer::write_index(destination.second);
+      LOG_INFO("Merged " + std::to_string(merged[destination.first].size()) + " " +
+               destination.first + " tiles into " + destination.second);
+      result.add_output(destination.first, destination.second, threads);
+    }
+
+    if (!manifest_file.empty()) {
+      result.write(manifest_file);
+    }
+  } catch (const std::exception& e) {
+    LOG_ERROR(e.what());
+    return EXIT_FAILURE;
+  }
+
+  LOG_INFO("Done");
+  return EXIT_SUCCESS;
+}
@@ -1,43 +1,87 @@
 #include "osmlr/output/geojson.hpp"
+#include "osmlr/util/feature_collection.hpp"
+#include "osmlr/util/tile_archive.hpp"
+#include "osmlr/util/trace.hpp"
+#include <valhalla/midgard/logging.h>
 #include <valhalla/midgard/util.h>
 #include "segment.pb.h"
 #include "tile.pb.h"
 #include <boost/filesystem.hpp>
-#include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/ini_parser.hpp>
-#include <boost/property_tree/json_parser.hpp>
-#include <boost/algorithm/string/replace.hpp>
-#include <boost/regex.hpp>
 #include <stdexcept>
-#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 namespace vm = valhalla::midgard;
 namespace vb = valhalla::baldr;
-namespace bpt = boost::property_tree;
 namespace bfs = boost::filesystem;
-namespace bal = boost::algorithm;
 namespace pbf = opentraffic::osmlr;
 
 namespace {
 
-// Minimum length for an OSMLR segment
-constexpr uint32_t kMinimumLength = 5;
-
-// Maximum length for an OSMLR segment
-constexpr uint32_t kMaximumLength = 1000;
-
 // Check if oneway. Assumes forward access is allowed. Edge is oneway if
 // no reverse vehicular access is allowed
 bool is_oneway(const vb::DirectedEdge *e) {
   return (e->reverseaccess() & vb::kVehicularAccess) == 0;
 }
 
-// writes out numbers without quotes.
-// ptree writes everything out with quotes and we don't want
-// this for json.
-std::string fix_json_numbers(const std::string &json_str) {
-  boost::regex re("\"(-?[0-9]+\\.{0,1}[0-9]*)\"");
-  return  boost::regex_replace(json_str, re, "$1");
+// Reads a whole tile, wherever it is and however it's compressed.
+std::string read_file(const std::string &file_name) {
+  try {
+    return osmlr::util::tile_archive::read_tile(file_name);
+  } catch (const std::exception &) {
+    throw std::runtime_error("Unable to open traffic geojson file. " + file_name);
+  }
+}
+
+// Truncates a complete FeatureCollection just before the ']' closing its
+// features array, so that more features can be appended to it. Only the end
+// of the file is read. Sets empty if the array has no features in it.
+bool reopen_collection(const std::string &file_name, bool &empty) {
+  // the file may be linked to the previous release's copy
+  osmlr::util::tile_writer::unshare(file_name);
+  int fd = open(file_name.c_str(), O_RDWR);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  bool ok = false;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    const off_t tail = std::min(st.st_size, off_t(4096));
+    std::string buf(tail, '\0');
+    size_t cut;
+    if (pread(fd, &buf[0], tail, st.st_size - tail) == tail &&
+        osmlr::util::find_collection_end(buf, cut, empty)) {
+      ok = (ftruncate(fd, st.st_size - tail + cut) == 0);
+    }
+  }
+  close(fd);
+  return ok;
+}
+
+// As reopen_collection, but for a collection which can't be truncated in
+// place, e.g: because it's compressed. The start of the collection up to the
+// ']' is returned in head, to be written again in place of the original.
+bool reread_collection(const std::string &file_name, bool &empty,
+                       std::string &head) {
+  head = read_file(file_name);
+  size_t cut;
+  if (!osmlr::util::find_collection_end(head, cut, empty)) {
+    return false;
+  }
+  head.resize(cut);
+  return true;
+}
+
+// The tile description, as written by GraphId's stream operator.
+std::string describe(const vb::GraphId &tile_id) {
+  std::ostringstream out;
+  out << tile_id;
+  return out.str();
 }
 
 } // anonymous namespace
@@ -46,12 +90,15 @@ namespace osmlr {
 namespace output {
 
 geojson::geojson(vb::GraphReader &reader, std::string base_dir, size_t max_fds,
-                 time_t creation_date, const uint64_t osm_changeset_id,
-                 const std::unordered_map<valhalla::baldr::GraphId, uint32_t> tile_index)
+                 std::shared_ptr<util::buffer_budget> budget, time_t creation_date,
+                 const uint64_t osm_changeset_id,
+                 const std::unordered_map<valhalla::baldr::GraphId, uint32_t> tile_index,
+                 unsigned int precision, util::compression codec)
   : m_osm_changeset_id(osm_changeset_id)
   , m_reader(reader)
-  , m_writer(base_dir, "json", max_fds)
-  , m_tile_index(tile_index){
+  , m_writer(base_dir, "json", max_fds, budget, codec)
+  , m_tile_index(tile_index)
+  , m_json(precision) {
   // Change cration date into string plus int
   m_creation_date = creation_date;
   std::tm tm = *std::gmtime(&creation_date);
@@ -64,341 +111,224 @@ geojson::geojson(vb::GraphReader &reader, std::string base_dir, size_t max_fds,
 geojson::~geojson() {
 }
 
-void geojson::add_path(const vb::merge::path &p) {
-
-  // Get the length of the path
-  uint32_t total_length = 0;
-  for (auto edge_id : p.m_edges) {
-    const auto *tile = m_reader.GetGraphTile(edge_id);
-    const auto *edge = tile->directededge(edge_id);
-    total_length += edge->length();
-  }
-
-  // Skip very short segments that are only 1 edge
-  if (total_length < kMinimumLength && p.m_edges.size() == 1) {
-    return;
-  }
-
-  // Split longer segments
-  if (total_length < kMaximumLength) {
-    output_segment(p);
-  } else {
-    split_path(p, total_length);
+void geojson::add_path(const path_plan &plan) {
+  util::trace::span span("geojson", "output");
+  for (const auto &seg : plan.segments) {
+    output_segment(plan, seg);
   }
 }
 
-void geojson::split_path(const vb::merge::path& p, const uint32_t total_length) {
-  // Walk the merged path and split where needed
-  uint32_t accumulated_length = 0;
-  vb::merge::path split_path(p.m_start);
-  for (auto edge_id : p.m_edges) {
-    // TODO - do we need to check if we enter a new tile or does the writer
-    // handle this?
-
-    const auto* tile = m_reader.GetGraphTile(edge_id);
-    const auto* edge = tile->directededge(edge_id);
-    uint32_t edge_len = edge->length();
-
-    if (edge_len >= kMaximumLength) {
-      // Output prior segment
-      if (split_path.m_edges.size() > 0) {
-        output_segment(split_path);
-      }
+std::unordered_map<valhalla::baldr::GraphId, uint32_t> geojson::update_tiles(
+    const std::vector<std::string>& tiles,
+    const boost::property_tree::ptree &hierarchy_properties, size_t threads) {
 
-      // TODO - split this edge - for now just add the entire edge
-      uint32_t edgeinfo_offset = edge->edgeinfo_offset();
-      auto edgeinfo = tile->edgeinfo(edgeinfo_offset);
-      std::vector<PointLL> shape = tile->edgeinfo(edge->edgeinfo_offset()).shape();
-      if (!edge->forward()) {
-        std::reverse(shape.begin(), shape.end());
+  // each tile is read and scanned independently, only recording the results
+  // and writing the updated tile are done under the lock.
+  std::mutex lock;
+  for (const auto& t : tiles) {
+    m_tile_paths.emplace(vb::GraphTile::GetTileId(util::uncompressed_name(t)), t);
+  }
+  parallel_for(
+    count_existing(tiles, m_reader), m_reader, hierarchy_properties, threads,
+    [&](vb::GraphReader &reader, size_t index) {
+      const auto& t = tiles[index];
+      auto base_id = vb::GraphTile::GetTileId(util::uncompressed_name(t));
+      util::trace::span span("update tile", base_id, "update");
+
+      const auto traffic_seg = traffic_segments(reader.GetGraphTile(base_id));
+
+      // Find the features in the existing tile and keep the ones which are
+      // still associated with the Valhalla tile.
+      const std::string json = read_file(t);
+      util::collection_layout layout;
+      if (!util::scan_collection(json, layout)) {
+        throw std::runtime_error("Unable to parse traffic geojson file. " + t);
       }
-
-      float shape_length = length(shape);
-
-      // Split the edge
-      int n = (edge_len / kMaximumLength);
-      float dist = static_cast<float>(edge_len) / static_cast<float>(n+1);
-      uint32_t d = std::ceil(dist);
-      for (int i = 0; i < n; i++) {
-       // if (shape.size() == 0) break;
-        auto sub_shape = trim_front(shape, d);
-        if (sub_shape.size() > 0) {
-          output_segment(sub_shape, edge, edge_id);
+      std::vector<const util::feature_range *> kept;
+      for (const auto& feature : layout.features) {
+        if (traffic_seg.find(vb::GraphId(feature.osmlr_id)) != traffic_seg.end()) {
+          kept.push_back(&feature);
         }
       }
-      if (shape.size() > 0) {
-        output_segment(shape, edge, edge_id);
+      bool is_updated = kept.size() != layout.features.size();
+      if (!is_updated) {
+        return;
       }
 
-      // Start a new path at the end of this edge
-      split_path.m_start = edge->endnode();
-      split_path.m_edges.clear();
-      accumulated_length = 0;
-    } else if (accumulated_length + edge_len >= kMaximumLength) {
-      // TODO - optimize the split to avoid short segments
-
-      // Output the current split path and start a new split path
-      output_segment(split_path);
-      split_path.m_start = split_path.m_end;
-      split_path.m_edges.clear();
-      split_path.m_edges.push_back(edge_id);
-      split_path.m_end = edge->endnode();
-      accumulated_length = edge_len;
-    } else {
-      // Add this edge to the new path
-      split_path.m_edges.push_back(edge_id);
-      split_path.m_end = edge->endnode();
-      accumulated_length += edge_len;
-    }
-  }
-
-  // Output the last
-  if (split_path.m_edges.size() > 0) {
-    output_segment(split_path);
-  }
-}
-
-std::unordered_map<valhalla::baldr::GraphId, uint32_t> geojson::update_tiles(
-    const std::vector<std::string>& tiles) {
-
-  for (const auto& t : tiles) {
-
-    auto base_id = vb::GraphTile::GetTileId(t);
-
-    if (!m_reader.DoesTileExist(base_id)) {
-      return m_tile_index;
-    }
+      // m_tile_index isn't changed while updating, so can be read unlocked
+      auto tile_index_itr = m_tile_index.find(base_id);
+      if (tile_index_itr == m_tile_index.end()) {
+        return;
+      }
 
-    std::unordered_set<vb::GraphId> traffic_seg;
-    const auto *graph_tile = m_reader.GetGraphTile(base_id);
-    const auto num_edges = graph_tile->header()->directededgecount();
-    vb::GraphId edge_id(base_id.tileid(), base_id.level(), 0);
-    for (uint32_t i = 0; i < num_edges; ++i, ++edge_id) {
-      auto* edge = graph_tile->directededge(edge_id);
-
-      if (edge->traffic_seg()) {
-        std::vector<vb::TrafficSegment> segments = graph_tile->GetTrafficSegments(edge_id);
-        for (const auto& seg : segments) {
-          traffic_seg.emplace(seg.segment_id_);
+      // copy the collection up to its features, then the features which are
+      // kept. the end is left off so that we can add to this feature
+      // collection.
+      std::string updated(json, 0, layout.features_begin);
+      for (size_t i = 0; i < kept.size(); ++i) {
+        if (i > 0) {
+          updated.push_back(',');
         }
+        updated.append(json, kept[i]->begin, kept[i]->end - kept[i]->begin);
       }
-    }
 
-    bpt::ptree pt;
-    bpt::read_json(t.c_str(), pt);
-    bool is_updated = false;
-    bpt::ptree features = pt.get_child("features");
-
-    for(bpt::ptree::iterator iter = features.begin(); iter != features.end();)
-    {
-      vb::GraphId seg_id = vb::GraphId(iter->second.get<uint64_t>("properties.osmlr_id"));
-      if (traffic_seg.find(seg_id) == traffic_seg.end()) {
-        iter = features.erase(iter);
-        is_updated = true;
-      } else iter++;
-    }
-
-    if (is_updated) {
-
-      pt.put_child("features", features);
-      auto tile_index_itr = m_tile_index.find(base_id);
-      if (tile_index_itr != m_tile_index.end()) {
-
-        bfs::remove(t);
-        //add the tileid and index to the map
-        m_tile_path_ids.emplace(base_id, tile_index_itr->second);
-        std::ostringstream oss;
-        oss.precision(9);
-        write_json(oss, pt, false);
-        std::string json = oss.str();
-        // remove the last chars so that we can add to this feature collection.
-        json.erase(json.size()-3, 2);
-        m_writer.write_to(base_id, fix_json_numbers(json));
+      std::lock_guard<std::mutex> guard(lock);
+      m_writer.remove(base_id);
+      //add the tileid and index to the map
+      m_tile_path_ids.emplace(base_id, tile_index_itr->second);
+      if (kept.empty()) {
+        m_empty_collections.insert(base_id);
       }
-    }
-  }
+      m_writer.write_to(base_id, updated);
+    });
 
   return m_tile_index;
 }
 
-void geojson::output_segment(const vb::merge::path &p) {
-  std::ostringstream out;
-  out.precision(9);
+// Starts a feature in the tile's feature collection, opening the collection
+// first if this is the first feature written to the tile. Returns the entry
+// holding the id the feature will get.
+std::unordered_map<vb::GraphId, uint32_t>::iterator
+geojson::begin_feature(const vb::GraphId &tile_id) {
+  m_json.clear();
 
-  auto tile_id = p.m_start.Tile_Base();
   auto tile_path_itr = m_tile_path_ids.find(tile_id);
   if (tile_path_itr == m_tile_path_ids.end()) {
-    if (m_tile_index.size()) { // is update?
-      auto tile_index_itr = m_tile_index.find(tile_id);
-      if (tile_index_itr != m_tile_index.end()) {
-        std::string file_name = m_writer.get_name_for_tile(tile_id);
-
-        if (bfs::exists(file_name) && bfs::is_regular_file(file_name)) { //existing file
-
-          //add the tileid and index to the map
-          std::tie(tile_path_itr, std::ignore) = m_tile_path_ids.emplace(tile_id, tile_index_itr->second);
-          bpt::ptree pt;
-          bpt::read_json(file_name.c_str(), pt);
-          std::ostringstream oss;
-
-          write_json(oss, pt, false);
-          std::string json = oss.str();
-          // remove the last chars so that we can add to this feature collection.
-          json.erase(json.size()-3, 2);
-          out << fix_json_numbers(json);
-          out << ",";
-          bfs::remove(file_name);
-
-        } else throw std::runtime_error("Unable to open traffic geojson file. " + file_name); // should never happen
-      } else { // new file
-        out << "{\"type\":\"FeatureCollection\",\"properties\":{"
-            << "\"creation_time\":" << m_creation_date << ","
-            << "\"creation_date\":\"" << m_date_str << "\","
-            << "\"description\":\"" << tile_id << "\","
-            << "\"changeset_id\":" << m_osm_changeset_id << "},";
-        out << "\"features\":[";
-        std::tie(tile_path_itr, std::ignore) = m_tile_path_ids.emplace(tile_id, 0);
+    auto tile_index_itr = m_tile_index.find(tile_id);
+    if (tile_index_itr != m_tile_index.end()) { // is update of an existing tile?
+      std::string file_name = m_writer.get_name_for_tile(tile_id);
+      auto path_itr = m_tile_paths.find(tile_id);
+      if (path_itr != m_tile_paths.end()) {
+        file_name = path_itr->second;
       }
+
+      // cut the end off the existing file so that we can add to this feature
+      // collection. finish() puts it back.
+      bool empty = false;
+      std::string head;
+      bool reopened = m_writer.in_place()
+        ? reopen_collection(file_name, empty)
+        : reread_collection(file_name, empty, head);
+      if (reopened) { //existing file
+        if (!m_writer.in_place()) {
+          m_writer.remove(tile_id);
+          m_json.raw(head);
+        }
+
+        //add the tileid and index to the map
+        std::tie(tile_path_itr, std::ignore) = m_tile_path_ids.emplace(tile_id, tile_index_itr->second);
+        if (!empty) {
+          m_json.raw(',');
+        }
+
+      } else throw std::runtime_error("Unable to open traffic geojson file. " + file_name); // should never happen
     } else { // new file
-      out << "{\"type\":\"FeatureCollection\",\"properties\":{"
-          << "\"creation_time\":" << m_creation_date << ","
-          << "\"creation_date\":\"" << m_date_str << "\","
-          << "\"description\":\"" << tile_id << "\","
-          << "\"changeset_id\":" << m_osm_changeset_id << "},";
-      out << "\"features\":[";
+      m_json.raw("{\"type\":\"FeatureCollection\",\"properties\":{")
+        .raw("\"creation_time\":").number(int64_t(m_creation_date)).raw(',')
+        .raw("\"creation_date\":").quoted(m_date_str).raw(',')
+        .raw("\"description\":").quoted(describe(tile_id)).raw(',')
+        .raw("\"changeset_id\":").number(m_osm_changeset_id).raw("},")
+        .raw("\"features\":[");
       std::tie(tile_path_itr, std::ignore) = m_tile_path_ids.emplace(tile_id, 0);
     }
-  } else out << ",";//already in the map
+  } else if (m_empty_collections.erase(tile_id) == 0) {
+    m_json.raw(',');//already in the map, and has features
+  }
+
+  m_json.raw("{\"type\":\"Feature\",\"geometry\":")
+    .raw("{\"type\":\"LineString\",\"coordinates\":[");
+  return tile_path_itr;
+}
+
+// Finishes the feature started by begin_feature with the properties of this
+// OSMLR segment.
+void geojson::end_feature(const vb::GraphId &tile_id, uint32_t id,
+                          vb::RoadClass best_frc, bool oneway,
+                          bool drive_on_right) {
+  vb::GraphId osmlr_id(tile_id.tileid(), tile_id.level(), id);
+  m_json.raw("]},\"properties\":{")
+    .raw("\"id\":").number(id).raw(',')
+    .raw("\"osmlr_id\":").number(osmlr_id.value).raw(',')
+    .raw("\"best_frc\":").quoted(vb::to_string(best_frc)).raw(',')
+    .raw("\"oneway\":").number(oneway).raw(',')
+    .raw("\"drive_on_right\":").number(drive_on_right)
+    .raw("}}");
+}
 
-  out << "{\"type\":\"Feature\",\"geometry\":";
-  out << "{\"type\":\"LineString\",\"coordinates\":[";
+void geojson::output_segment(const path_plan &plan, const path_plan::segment &seg) {
+  util::trace::span span("format", "output");
+  auto tile_id = seg.tile_id;
+  auto tile_path_itr = begin_feature(tile_id);
 
   bool first_pt = true;
-  bool oneway = false;
-  bool drive_on_right = false;
-  vb::RoadClass best_frc = vb::RoadClass::kServiceOther;
-  vm::PointLL prev_pt;
-  for (auto edge_id : p.m_edges) {
-    const auto *tile = m_reader.GetGraphTile(edge_id);
-    const auto* directededge = tile->directededge(edge_id);
-    oneway = is_oneway(directededge);
-    drive_on_right = directededge->drive_on_right();
-    if (directededge->classification() < best_frc) {
-      best_frc = directededge->classification();
+  if (seg.partial) {
+    // Output a segment that is part of an edge.
+    for (const auto& pt : seg.shape) {
+      if (first_pt) { first_pt = false; } else { m_json.raw(','); }
+      m_json.point(pt);
     }
 
-    // Get the edge shape. reverse the order if needed
-    auto edgeinfo_offset = directededge->edgeinfo_offset();
-    std::vector<PointLL> shape = tile->edgeinfo(edgeinfo_offset).shape();
-    if (!directededge->forward()) {
-      std::reverse(shape.begin(), shape.end());
-    }
+    const auto* directededge = plan.edges[seg.begin].directededge;
+    end_feature(tile_id, tile_path_itr->second, directededge->classification(),
+                is_oneway(directededge), directededge->drive_on_right());
 
-    // Serialize the shape
-    for (const auto& pt : shape) {
-      if (pt == prev_pt) {
-        continue;
+  } else {
+    bool oneway = false;
+    bool drive_on_right = false;
+    vb::RoadClass best_frc = vb::RoadClass::kServiceOther;
+    vm::PointLL prev_pt;
+    for (size_t i = seg.begin; i < seg.end; ++i) {
+      const auto* directededge = plan.edges[i].directededge;
+      oneway = is_oneway(directededge);
+      drive_on_right = directededge->drive_on_right();
+      if (directededge->classification() < best_frc) {
+        best_frc = directededge->classification();
+      }
+
+      // Serialize the shape
+      for (const auto& pt : plan.edges[i].shape) {
+        if (pt == prev_pt) {
+          continue;
+        }
+        if (first_pt) { first_pt = false; } else { m_json.raw(','); }
+        m_json.point(pt);
+        prev_pt = pt;
       }
-      if (first_pt) { first_pt = false; } else { out << ","; }
-      out << "[" << pt.lng() << "," << pt.lat() << "]";
-      prev_pt = pt;
     }
+
+    // Add properties for this OSMLR segment
+    end_feature(tile_id, tile_path_itr->second, best_frc, oneway, drive_on_right);
   }
 
-  // Add properties for this OSMLR segment
-  vb::GraphId osmlr_id(tile_id.tileid(), tile_id.level(), tile_path_itr->second);
-  out << "]},\"properties\":{"
-      << "\"id\":" << tile_path_itr->second << ","
-      << "\"osmlr_id\":" << osmlr_id.value << ","
-      << "\"best_frc\":\"" << vb::to_string(best_frc) << "\","
-      << "\"oneway\":" << oneway << ","
-      << "\"drive_on_right\":" << drive_on_right;
-  out << "}}";
-
-  m_writer.write_to(tile_id, out.str());
+  m_writer.write_to(tile_id, m_json.str());
   tile_path_itr->second += 1;
 }
 
-// Output a segment that is part of an edge.
-void geojson::output_segment(const std::vector<vm::PointLL>& shape,
-                             const vb::DirectedEdge* edge,
-                             const vb::GraphId& edgeid) {
-  std::ostringstream out;
-  out.precision(9);
-
-  auto tile_id = edgeid.Tile_Base();
-  auto tile_path_itr = m_tile_path_ids.find(tile_id);
-  if (tile_path_itr == m_tile_path_ids.end()) {
-    if (m_tile_index.size()) { // is update?
-      auto tile_index_itr = m_tile_index.find(tile_id);
-      if (tile_index_itr != m_tile_index.end()) {
-        std::string file_name = m_writer.get_name_for_tile(tile_id);
-
-        if (bfs::exists(file_name) && bfs::is_regular_file(file_name)) { //existing file
-
-          //add the tileid and index to the map
-          std::tie(tile_path_itr, std::ignore) = m_tile_path_ids.emplace(tile_id, tile_index_itr->second);
-          bpt::ptree pt;
-          bpt::read_json(file_name.c_str(), pt);
-
-          std::ostringstream oss;
-          write_json(oss, pt, false);
-          std::string json = oss.str();
-          // remove the last chars so that we can add to this feature collection.
-          json.erase(json.size()-3, 2);
-          out << fix_json_numbers(json);
-          out << ",";
-          bfs::remove(file_name);
-
-        } else throw std::runtime_error("Unable to open traffic geojson file." + file_name); // should never happen
-      } else { // new file
-        out << "{\"type\":\"FeatureCollection\",\"properties\":{"
-            << "\"creation_time\":" << m_creation_date << ","
-            << "\"creation_date\":\"" << m_date_str << "\","
-            << "\"description\":\"" << tile_id << "\","
-            << "\"changeset_id\":" << m_osm_changeset_id << "},";
-        out << "\"features\":[";
-        std::tie(tile_path_itr, std::ignore) = m_tile_path_ids.emplace(tile_id, 0);
-      }
-    } else { // new file
-      out << "{\"type\":\"FeatureCollection\",\"properties\":{"
-          << "\"creation_time\":" << m_creation_date << ","
-          << "\"creation_date\":\"" << m_date_str << "\","
-          << "\"description\":\"" << tile_id << "\","
-          << "\"changeset_id\":" << m_osm_changeset_id << "},";
-      out << "\"features\":[";
-      std::tie(tile_path_itr, std::ignore) = m_tile_path_ids.emplace(tile_id, 0);
-    }
-  } else out << ",";//already in the map
-
-  out << "{\"type\":\"Feature\",\"geometry\":";
-  out << "{\"type\":\"LineString\",\"coordinates\":[";
+void geojson::checkpoint(std::ostream &out) {
+  checkpoint_tiles(out, m_tile_path_ids, m_writer);
+}
 
-  bool first_pt = true;
-  for (const auto pt : shape) {
-    if (first_pt) { first_pt = false; } else { out << ","; }
-    out << "[" << pt.lng() << "," << pt.lat() << "]";
+void geojson::resume(std::istream &in, uint8_t level) {
+  // the feature collections are left open, for finish() to close
+  for (const auto &entry : resume_tiles(in, level, m_writer)) {
+    m_tile_path_ids[entry.first] = entry.second;
   }
-
-  vb::GraphId osmlr_id(tile_id.tileid(), tile_id.level(), tile_path_itr->second);
-  bool first = true;
-  out << "]},\"properties\":{"
-      << "\"id\":" << tile_path_itr->second << ","
-      << "\"osmlr_id\":" << osmlr_id.value << ","
-      << "\"best_frc\":\"" << vb::to_string(edge->classification()) << "\","
-      << "\"oneway\":" << is_oneway(edge) << ","
-      << "\"drive_on_right\":" << edge->drive_on_right();
-  out << "}}";
-
-  m_writer.write_to(tile_id, out.str());
-  tile_path_itr->second += 1;
 }
 
 void geojson::finish() {
+  util::trace::span span("finish geojson", "output");
   for (auto entry : m_tile_path_ids) {
     m_writer.write_to(entry.first, "]}");
   }
   m_writer.close_all();
+
+  const auto &stats = m_writer.get_stats();
+  record_writer_stats("geojson", stats);
+  LOG_INFO("GeoJSON files opened = " + std::to_string(stats.opens) +
+           " evicted = " + std::to_string(stats.evictions) +
+           " hits = " + std::to_string(stats.hits) +
+           " writes = " + std::to_string(stats.writes) +
+           " bytes written = " + std::to_string(stats.bytes_written));
 }
 
 } // namespace output
@@ -0,0 +1,240 @@
+#include "osmlr/output/lookup_table.hpp"
+#include "osmlr/output/tiles.hpp"
+#include "osmlr/util/compression.hpp"
+#include "osmlr/util/tile_reader.hpp"
+#include "osmlr/util/trace.hpp"
+#include "segment.pb.h"
+#include "tile.pb.h"
+#include <valhalla/baldr/tilehierarchy.h>
+#include <valhalla/midgard/logging.h>
+#include <valhalla/midgard/util.h>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+namespace vm = valhalla::midgard;
+namespace vb = valhalla::baldr;
+namespace pbf = opentraffic::osmlr;
+
+namespace {
+
+typedef osmlr::util::segment_table table;
+
+void set_start(table::record &r, const vm::PointLL &ll) {
+  r.start_lat = int32_t(ll.lat() * 1.0e7);
+  r.start_lng = int32_t(ll.lng() * 1.0e7);
+}
+
+void set_end(table::record &r, const vm::PointLL &ll) {
+  r.end_lat = int32_t(ll.lat() * 1.0e7);
+  r.end_lng = int32_t(ll.lng() * 1.0e7);
+}
+
+// a record for an entry of an existing .osmlr tile.
+table::record entry_record(const char *data, size_t size) {
+  table::record r{};
+  pbf::Tile_Entry entry;
+  if (!entry.ParseFromArray(data, int(size))) {
+    throw std::runtime_error("Unable to parse traffic segment file.");
+  }
+  if (entry.has_marker()) {
+    r.flags = table::kDeleted;
+    return r;
+  }
+
+  const auto &lrps = entry.segment().lrps();
+  if (lrps.size() > 0) {
+    const auto &first = lrps.Get(0), &last = lrps.Get(lrps.size() - 1);
+    r.start_lat = first.coord().lat();
+    r.start_lng = first.coord().lng();
+    r.end_lat = last.coord().lat();
+    r.end_lng = last.coord().lng();
+    for (int i = 0; i < lrps.size() - 1; ++i) {
+      r.length += lrps.Get(i).length();
+    }
+    r.bearing = first.bear();
+    r.frc = first.start_frc();
+    r.least_frc = first.least_frc();
+    r.fow = first.start_fow();
+  }
+  r.flags = table::kSegment;
+  return r;
+}
+
+void write(std::ofstream &out, const void *data, size_t size) {
+  out.write(static_cast<const char *>(data), size);
+}
+
+} // anonymous namespace
+
+namespace osmlr {
+namespace output {
+
+lookup_table::lookup_table(vb::GraphReader &reader, std::string file_name,
+                           time_t creation_date, const uint64_t osm_changeset_id)
+  : m_reader(reader)
+  , m_file_name(file_name)
+  , m_creation_date(creation_date)
+  , m_osm_changeset_id(osm_changeset_id) {
+}
+
+lookup_table::~lookup_table() {
+}
+
+// Builds the record for a segment from the same values as the LRPs in the
+// .osmlr tiles.
+lookup_table::record lookup_table::make_record(const path_plan &plan,
+                                               const path_plan::segment &seg) const {
+  record r{};
+  const auto *edge = plan.edges[seg.begin].directededge;
+  if (seg.partial) {
+    set_start(r, seg.shape.front());
+    set_end(r, seg.shape.back());
+    r.length = uint32_t(vm::length(seg.shape));
+    r.bearing = bearing(seg.shape);
+    r.frc = r.least_frc = uint8_t(edge->classification());
+
+  } else {
+    const auto &first = plan.edges[seg.begin];
+    set_start(r, first.shape[0]);
+    set_end(r, seg.end_ll);
+    r.length = seg.length;
+    r.bearing = bearing(first.shape);
+    vb::RoadClass least_frc = edge->classification();
+    for (size_t i = seg.begin; i < seg.end; ++i) {
+      least_frc = std::min(least_frc, plan.edges[i].directededge->classification());
+    }
+    r.frc = uint8_t(edge->classification());
+    r.least_frc = uint8_t(least_frc);
+  }
+  r.fow = uint8_t(form_of_way(edge));
+  r.flags = util::segment_table::kSegment;
+  return r;
+}
+
+void lookup_table::add_path(const path_plan &plan) {
+  // ids are handed out in the same order as the tiles output does.
+  for (const auto &seg : plan.segments) {
+    record r = make_record(plan, seg);
+    std::unique_lock<std::mutex> guard(m_lock, std::defer_lock);
+    {
+      util::trace::span span("lock wait", seg.tile_id, "lock");
+      guard.lock();
+    }
+    m_records[seg.tile_id].push_back(r);
+  }
+}
+
+std::unordered_map<vb::GraphId, uint32_t> lookup_table::update_tiles(
+    const std::vector<std::string>& tiles,
+    const boost::property_tree::ptree &hierarchy_properties, size_t threads) {
+
+  std::unordered_map<vb::GraphId, uint32_t> tile_index;
+
+  // every existing entry keeps its id, but only the tiles which the tiles
+  // output will look at get their segments deprecated.
+  const size_t existing = count_existing(tiles, m_reader);
+  parallel_for(
+    tiles.size(), m_reader, hierarchy_properties, threads,
+    [&](vb::GraphReader &reader, size_t index) {
+      const auto& t = tiles[index];
+      auto base_id = vb::GraphTile::GetTileId(util::uncompressed_name(t));
+
+      std::vector<record> records;
+      util::tile_reader tile(t);
+      records.reserve(tile.entry_count());
+      for (const auto &entry : tile) {
+        records.push_back(entry_record(entry.message_begin,
+                                       entry.message_end - entry.message_begin));
+      }
+
+      if (index < existing) {
+        const auto traffic_seg = traffic_segments(reader.GetGraphTile(base_id));
+        for (uint32_t idx = 0; idx < records.size(); ++idx) {
+          vb::GraphId seg_id(base_id.tileid(), base_id.level(), idx);
+          if (records[idx].flags == util::segment_table::kSegment &&
+              traffic_seg.find(seg_id) == traffic_seg.end()) {
+            records[idx].flags = util::segment_table::kDeleted;
+          }
+        }
+      }
+
+      std::lock_guard<std::mutex> guard(m_lock);
+      tile_index.emplace(base_id, records.size());
+      m_records[base_id] = std::move(records);
+    });
+
+  return tile_index;
+}
+
+void lookup_table::finish() {
+  std::lock_guard<std::mutex> guard(m_lock);
+
+  std::vector<vb::TileLevel> levels;
+  for (const auto &level : vb::TileHierarchy::levels()) {
+    levels.push_back(level.second);
+  }
+
+  // lay the file out: header, levels, then each level's offsets and finally
+  // the records.
+  util::segment_table::header header{};
+  std::copy(util::segment_table::kMagic, util::segment_table::kMagic + 8, header.magic);
+  header.version = util::segment_table::kVersion;
+  header.record_size = sizeof(record);
+  header.creation_date = m_creation_date;
+  header.changeset_id = m_osm_changeset_id;
+  header.level_count = levels.size();
+
+  uint64_t offset = sizeof(header) + levels.size() * sizeof(util::segment_table::level);
+  std::vector<util::segment_table::level> level_entries;
+  for (const auto &level : levels) {
+    const uint32_t tile_count = level.tiles.TileCount();
+    level_entries.push_back(util::segment_table::level{level.level, tile_count, offset});
+    offset += (uint64_t(tile_count) + 1) * sizeof(uint64_t);
+  }
+  header.records = offset;
+
+  const std::string tmp_name = m_file_name + ".tmp";
+  std::ofstream out(tmp_name, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    throw std::runtime_error("Unable to open " + tmp_name);
+  }
+  write(out, &header, sizeof(header));
+  write(out, level_entries.data(), level_entries.size() * sizeof(level_entries[0]));
+
+  // the offsets of each tile's records, then all the records in the same
+  // order.
+  uint64_t record_count = 0;
+  std::vector<const std::vector<record> *> order;
+  for (const auto &level : levels) {
+    std::vector<uint64_t> offsets(level.tiles.TileCount() + 1);
+    for (uint32_t tile = 0; tile < level.tiles.TileCount(); ++tile) {
+      offsets[tile] = record_count;
+      auto itr = m_records.find(vb::GraphId(tile, level.level, 0));
+      if (itr != m_records.end()) {
+        record_count += itr->second.size();
+        order.push_back(&itr->second);
+      }
+    }
+    offsets.back() = record_count;
+    write(out, offsets.data(), offsets.size() * sizeof(uint64_t));
+  }
+  for (const auto *records : order) {
+    write(out, records->data(), records->size() * sizeof(record));
+  }
+
+  // now that the number of records is known, the header can be completed.
+  header.record_count = record_count;
+  out.seekp(0);
+  write(out, &header, sizeof(header));
+  out.close();
+  if (!out || std::rename(tmp_name.c_str(), m_file_name.c_str()) != 0) {
+    std::remove(tmp_name.c_str());
+    throw std::runtime_error("Unable to write segment table " + m_file_name);
+  }
+
+  LOG_INFO("Wrote " + std::to_string(record_count) + " segments to " + m_file_name);
+}
+
+} // namespace output
+} // namespace osmlr
@@ -0,0 +1,353 @@
+#include "osmlr/output/mvt.hpp"
+#include "osmlr/util/tile_reader.hpp"
+#include "osmlr/util/tile_writer.hpp"
+#include "osmlr/util/trace.hpp"
+#include "segment.pb.h"
+#include "tile.pb.h"
+#include <valhalla/midgard/logging.h>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+namespace vm = valhalla::midgard;
+namespace vb = valhalla::baldr;
+namespace bfs = boost::filesystem;
+namespace pbf = opentraffic::osmlr;
+
+namespace {
+
+// field numbers and values from the vector tile spec's vector_tile.proto
+constexpr uint32_t kTileLayers = 3;
+constexpr uint32_t kLayerName = 1, kLayerFeatures = 2, kLayerKeys = 3,
+  kLayerValues = 4, kLayerExtent = 5, kLayerVersion = 15;
+constexpr uint32_t kFeatureId = 1, kFeatureTags = 2, kFeatureType = 3,
+  kFeatureGeometry = 4;
+constexpr uint32_t kValueString = 1, kValueUint = 5, kValueBool = 7;
+constexpr uint32_t kLineString = 2;
+constexpr uint32_t kMoveTo = 1, kLineTo = 2;
+
+// the keys of the feature properties, in the order of their indices.
+const char *const kKeys[] = {"osmlr_id", "best_frc", "oneway", "drive_on_right"};
+
+// how far outside a tile, in its own units, a feature can be and still be
+// put in it, so that lines don't end short of the edge when drawn.
+constexpr double kBuffer = 64.0;
+
+// furthest north and south that web mercator covers.
+constexpr double kMaxLatitude = 85.0511287798;
+
+void varint(std::string &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(char((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(char(value));
+}
+
+void tag(std::string &out, uint32_t field, uint32_t wire_type) {
+  varint(out, (uint64_t(field) << 3) | wire_type);
+}
+
+void bytes(std::string &out, uint32_t field, const std::string &data) {
+  tag(out, field, 2);
+  varint(out, data.size());
+  out.append(data);
+}
+
+uint32_t zigzag(int32_t value) {
+  return (uint32_t(value) << 1) ^ uint32_t(value >> 31);
+}
+
+uint32_t command(uint32_t id, uint32_t count) {
+  return (id & 0x7) | (count << 3);
+}
+
+// position of ll in web mercator, in units of tiles at zoom z.
+void project(const vm::PointLL &ll, unsigned int z, double &x, double &y) {
+  const double n = double(uint64_t(1) << z);
+  const double lat = std::max(-kMaxLatitude, std::min(kMaxLatitude, double(ll.lat()))) * M_PI / 180.0;
+  x = (ll.lng() + 180.0) / 360.0 * n;
+  y = (1.0 - std::log(std::tan(lat) + 1.0 / std::cos(lat)) / M_PI) / 2.0 * n;
+}
+
+uint64_t layer_key(unsigned int z, uint32_t x, uint32_t y) {
+  return (uint64_t(z) << 58) | (uint64_t(x) << 29) | y;
+}
+
+// the geometry commands for a line, relative to tile (tx, ty). empty if the
+// line has less than two distinct points at this resolution.
+std::string line_geometry(const std::vector<std::pair<double, double> > &points,
+                          uint32_t tx, uint32_t ty, uint32_t extent) {
+  std::vector<std::pair<int32_t, int32_t> > coords;
+  for (const auto &p : points) {
+    std::pair<int32_t, int32_t> c(int32_t(std::lround((p.first - tx) * extent)),
+                                  int32_t(std::lround((p.second - ty) * extent)));
+    if (coords.empty() || coords.back() != c) {
+      coords.push_back(c);
+    }
+  }
+  std::string geometry;
+  if (coords.size() < 2) {
+    return geometry;
+  }
+
+  varint(geometry, command(kMoveTo, 1));
+  varint(geometry, zigzag(coords[0].first));
+  varint(geometry, zigzag(coords[0].second));
+  varint(geometry, command(kLineTo, coords.size() - 1));
+  for (size_t i = 1; i < coords.size(); ++i) {
+    varint(geometry, zigzag(coords[i].first - coords[i - 1].first));
+    varint(geometry, zigzag(coords[i].second - coords[i - 1].second));
+  }
+  return geometry;
+}
+
+} // anonymous namespace
+
+namespace osmlr {
+namespace output {
+
+struct mvt::feature {
+  vb::GraphId osmlr_id;
+  std::vector<vm::PointLL> shape;
+  vb::RoadClass best_frc;
+  // whether oneway and drive_on_right are known.
+  bool has_direction;
+  bool oneway, drive_on_right;
+};
+
+mvt::mvt(vb::GraphReader &reader, std::string base_dir,
+         std::vector<unsigned int> zooms, uint32_t extent)
+  : m_reader(reader)
+  , m_base_dir(base_dir)
+  , m_zooms(zooms)
+  , m_extent(extent) {
+  for (auto z : m_zooms) {
+    if (z > 28) {
+      throw std::invalid_argument("Vector tile zoom " + std::to_string(z) + " is too deep");
+    }
+  }
+}
+
+mvt::~mvt() {
+}
+
+uint32_t mvt::add_value(layer &l, const std::string &value) {
+  auto itr = l.value_index.find(value);
+  if (itr == l.value_index.end()) {
+    itr = l.value_index.emplace(value, l.values.size()).first;
+    l.values.push_back(value);
+  }
+  return itr->second;
+}
+
+void mvt::add_feature(const feature &f) {
+  // the encoded property values, looked up in each layer's table below.
+  std::string id_value, frc_value, oneway_value, right_value;
+  tag(id_value, kValueUint, 0);
+  varint(id_value, f.osmlr_id.value);
+  bytes(frc_value, kValueString, vb::to_string(f.best_frc));
+  tag(oneway_value, kValueBool, 0);
+  varint(oneway_value, f.oneway);
+  tag(right_value, kValueBool, 0);
+  varint(right_value, f.drive_on_right);
+
+  // find the geometry in each tile the feature is in, outside the lock.
+  std::vector<std::pair<uint64_t, std::string> > geometries;
+  std::vector<std::pair<double, double> > points(f.shape.size());
+  for (auto z : m_zooms) {
+    for (size_t i = 0; i < f.shape.size(); ++i) {
+      project(f.shape[i], z, points[i].first, points[i].second);
+    }
+    double min_x = points[0].first, max_x = min_x, min_y = points[0].second, max_y = min_y;
+    for (const auto &p : points) {
+      min_x = std::min(min_x, p.first);
+      max_x = std::max(max_x, p.first);
+      min_y = std::min(min_y, p.second);
+      max_y = std::max(max_y, p.second);
+    }
+
+    const double buffer = kBuffer / m_extent;
+    const double last = double((uint64_t(1) << z) - 1);
+    const uint32_t x0 = uint32_t(std::max(0.0, std::floor(min_x - buffer)));
+    const uint32_t x1 = uint32_t(std::min(last, std::floor(max_x + buffer)));
+    const uint32_t y0 = uint32_t(std::max(0.0, std::floor(min_y - buffer)));
+    const uint32_t y1 = uint32_t(std::min(last, std::floor(max_y + buffer)));
+    for (uint32_t x = x0; x <= x1; ++x) {
+      for (uint32_t y = y0; y <= y1; ++y) {
+        std::string geometry = line_geometry(points, x, y, m_extent);
+        if (!geometry.empty()) {
+          geometries.emplace_back(layer_key(z, x, y), std::move(geometry));
+        }
+      }
+    }
+  }
+
+  std::unique_lock<std::mutex> guard(m_lock, std::defer_lock);
+  {
+    util::trace::span span("lock wait", "lock");
+    guard.lock();
+  }
+  for (const auto &g : geometries) {
+    layer &l = m_layers[g.first];
+    std::string tags;
+    varint(tags, 0);
+    varint(tags, add_value(l, id_value));
+    varint(tags, 1);
+    varint(tags, add_value(l, frc_value));
+    if (f.has_direction) {
+      varint(tags, 2);
+      varint(tags, add_value(l, oneway_value));
+      varint(tags, 3);
+      varint(tags, add_value(l, right_value));
+    }
+
+    std::string encoded;
+    tag(encoded, kFeatureId, 0);
+    varint(encoded, f.osmlr_id.value);
+    bytes(encoded, kFeatureTags, tags);
+    tag(encoded, kFeatureType, 0);
+    varint(encoded, kLineString);
+    bytes(encoded, kFeatureGeometry, g.second);
+    bytes(l.features, kLayerFeatures, encoded);
+  }
+}
+
+void mvt::add_path(const path_plan &plan) {
+  for (const auto &seg : plan.segments) {
+    // the same geometry and properties as the GeoJSON output
+    feature f;
+    f.has_direction = true;
+    if (seg.partial) {
+      const auto *directededge = plan.edges[seg.begin].directededge;
+      f.shape = seg.shape;
+      f.best_frc = directededge->classification();
+      f.oneway = (directededge->reverseaccess() & vb::kVehicularAccess) == 0;
+      f.drive_on_right = directededge->drive_on_right();
+
+    } else {
+      f.best_frc = vb::RoadClass::kServiceOther;
+      for (size_t i = seg.begin; i < seg.end; ++i) {
+        const auto *directededge = plan.edges[i].directededge;
+        f.oneway = (directededge->reverseaccess() & vb::kVehicularAccess) == 0;
+        f.drive_on_right = directededge->drive_on_right();
+        f.best_frc = std::min(f.best_frc, directededge->classification());
+        for (const auto &pt : plan.edges[i].shape) {
+          if (f.shape.empty() || !(pt == f.shape.back())) {
+            f.shape.push_back(pt);
+          }
+        }
+      }
+    }
+    if (f.shape.empty()) {
+      continue;
+    }
+
+    // ids are handed out in the same order as the tiles output does.
+    {
+      std::lock_guard<std::mutex> guard(m_lock);
+      uint32_t &count = m_counts[seg.tile_id];
+      f.osmlr_id = vb::GraphId(seg.tile_id.tileid(), seg.tile_id.level(), count++);
+    }
+    add_feature(f);
+  }
+}
+
+std::unordered_map<vb::GraphId, uint32_t> mvt::update_tiles(
+    const std::vector<std::string>& tiles,
+    const boost::property_tree::ptree &hierarchy_properties, size_t threads) {
+
+  std::unordered_map<vb::GraphId, uint32_t> tile_index;
+
+  // every existing entry keeps its id, but only the tiles which the tiles
+  // output will look at get their segments deprecated.
+  const size_t existing = count_existing(tiles, m_reader);
+  parallel_for(
+    tiles.size(), m_reader, hierarchy_properties, threads,
+    [&](vb::GraphReader &reader, size_t index) {
+      const auto& t = tiles[index];
+      auto base_id = vb::GraphTile::GetTileId(util::uncompressed_name(t));
+
+      std::unordered_set<vb::GraphId> traffic_seg;
+      if (index < existing) {
+        traffic_seg = traffic_segments(reader.GetGraphTile(base_id));
+      }
+
+      util::tile_reader tile(t);
+      uint32_t idx = 0;
+      for (const auto &entry : tile) {
+        vb::GraphId seg_id(base_id.tileid(), base_id.level(), idx++);
+        if (!entry.has_segment ||
+            (index < existing && traffic_seg.find(seg_id) == traffic_seg.end())) {
+          continue;
+        }
+
+        pbf::Tile_Entry e;
+        if (!e.ParseFromArray(entry.message_begin, int(entry.message_end - entry.message_begin))) {
+          throw std::runtime_error("Unable to parse traffic segment file.");
+        }
+        const auto &lrps = e.segment().lrps();
+        if (lrps.size() < 2) {
+          continue;
+        }
+        feature f;
+        f.osmlr_id = seg_id;
+        f.best_frc = vb::RoadClass(lrps.Get(0).least_frc());
+        f.has_direction = f.oneway = f.drive_on_right = false;
+        for (const auto &lrp : lrps) {
+          f.shape.emplace_back(lrp.coord().lng() * 1.0e-7, lrp.coord().lat() * 1.0e-7);
+        }
+        add_feature(f);
+      }
+
+      std::lock_guard<std::mutex> guard(m_lock);
+      tile_index.emplace(base_id, tile.entry_count());
+      m_counts[base_id] = tile.entry_count();
+    });
+
+  return tile_index;
+}
+
+void mvt::finish() {
+  std::lock_guard<std::mutex> guard(m_lock);
+  util::tile_writer::purge(m_base_dir);
+
+  for (const auto &l : m_layers) {
+    const unsigned int z = l.first >> 58;
+    const uint32_t x = (l.first >> 29) & ((1u << 29) - 1);
+    const uint32_t y = l.first & ((1u << 29) - 1);
+
+    std::string encoded;
+    tag(encoded, kLayerVersion, 0);
+    varint(encoded, 2);
+    bytes(encoded, kLayerName, "osmlr");
+    encoded.append(l.second.features);
+    for (const char *key : kKeys) {
+      bytes(encoded, kLayerKeys, key);
+    }
+    for (const auto &value : l.second.values) {
+      bytes(encoded, kLayerValues, value);
+    }
+    tag(encoded, kLayerExtent, 0);
+    varint(encoded, m_extent);
+
+    std::string tile;
+    bytes(tile, kTileLayers, encoded);
+
+    bfs::path dir = bfs::path(m_base_dir) / std::to_string(z) / std::to_string(x);
+    bfs::create_directories(dir);
+    const std::string file_name = (dir / (std::to_string(y) + ".mvt")).string();
+    std::ofstream out(file_name, std::ios::binary | std::ios::trunc);
+    out.write(tile.data(), tile.size());
+    if (!out) {
+      throw std::runtime_error("Unable to write vector tile " + file_name);
+    }
+  }
+
+  LOG_INFO("Wrote " + std::to_string(m_layers.size()) + " vector tiles to " + m_base_dir);
+}
+
+} // namespace output
+} // namespace osmlr
@@ -1,4 +1,15 @@
 #include "osmlr/output/output.hpp"
+#include "osmlr/util/compression.hpp"
+#include "osmlr/util/metrics.hpp"
+#include <valhalla/baldr/graphtile.h>
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace vb = valhalla::baldr;
 
 namespace osmlr {
 namespace output {
@@ -6,5 +17,141 @@ namespace output {
 output::~output() {
 }
 
+size_t output::count_existing(const std::vector<std::string> &tiles,
+                              vb::GraphReader &reader) {
+  size_t count = 0;
+  for (const auto& t : tiles) {
+    if (!reader.DoesTileExist(vb::GraphTile::GetTileId(util::uncompressed_name(t)))) {
+      break;
+    }
+    count++;
+  }
+  return count;
+}
+
+std::unordered_set<vb::GraphId> output::traffic_segments(const vb::GraphTile *tile) {
+  std::unordered_set<vb::GraphId> traffic_seg;
+  const auto num_edges = tile->header()->directededgecount();
+  vb::GraphId edge_id = tile->header()->graphid();
+  for (uint32_t i = 0; i < num_edges; ++i, ++edge_id) {
+    auto* edge = tile->directededge(edge_id);
+
+    if (edge->traffic_seg()) {
+      std::vector<vb::TrafficSegment> segments = tile->GetTrafficSegments(edge_id);
+      for (const auto& seg : segments) {
+        traffic_seg.emplace(seg.segment_id_);
+      }
+    }
+  }
+  return traffic_seg;
+}
+
+void output::parallel_for(
+    size_t count, vb::GraphReader &reader,
+    const boost::property_tree::ptree &hierarchy_properties, size_t threads,
+    const std::function<void(vb::GraphReader &, size_t)> &work) {
+
+  threads = std::min(std::max(threads, size_t(1)), count);
+  if (threads <= 1) {
+    for (size_t i = 0; i < count; ++i) {
+      work(reader, i);
+    }
+    return;
+  }
+
+  size_t next = 0;
+  std::mutex lock;
+  std::exception_ptr error;
+  auto worker = [&]() {
+    try {
+      // readers aren't thread safe, so each thread needs one of its own
+      vb::GraphReader thread_reader(hierarchy_properties);
+      while (true) {
+        size_t i;
+        {
+          std::lock_guard<std::mutex> guard(lock);
+          if (error || next >= count) {
+            break;
+          }
+          i = next++;
+        }
+        work(thread_reader, i);
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> guard(lock);
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  };
+
+  std::vector<std::shared_ptr<std::thread> > pool(threads);
+  for (auto& thread : pool) {
+    thread.reset(new std::thread(worker));
+  }
+  for (auto& thread : pool) {
+    thread->join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+void output::record_writer_stats(const std::string &name,
+                                 const util::tile_writer::stats &stats) {
+  util::metrics::get_counter(name + ".opens").add(stats.opens);
+  util::metrics::get_counter(name + ".evictions").add(stats.evictions);
+  util::metrics::get_counter(name + ".hits").add(stats.hits);
+  util::metrics::get_counter(name + ".writes").add(stats.writes);
+  util::metrics::get_counter(name + ".bytes_written").add(stats.bytes_written);
+}
+
+void output::checkpoint(std::ostream &) {
+  throw std::runtime_error("This output can't be checkpointed");
+}
+
+void output::resume(std::istream &, uint8_t) {
+  throw std::runtime_error("This output can't be resumed");
+}
+
+void output::checkpoint_tiles(std::ostream &out,
+                              const std::unordered_map<vb::GraphId, uint32_t> &counts,
+                              util::tile_writer &writer) {
+  for (const auto &entry : counts) {
+    out << entry.first.value << ' ' << entry.second << ' '
+        << writer.flushed_size(entry.first) << '\n';
+  }
+  out << "end\n";
+}
+
+std::unordered_map<vb::GraphId, uint32_t> output::resume_tiles(
+    std::istream &in, uint8_t level, util::tile_writer &writer) {
+  std::unordered_map<vb::GraphId, uint32_t> counts;
+  std::unordered_map<vb::GraphId, off_t> sizes;
+  std::string token;
+  while (in >> token && token != "end") {
+    uint32_t count;
+    off_t size;
+    if (!(in >> count >> size)) {
+      break;
+    }
+    vb::GraphId tile_id(std::stoull(token));
+    if (tile_id.level() != level) {
+      throw std::runtime_error("Checkpoint of level " + std::to_string(level) +
+                               " has a tile on level " + std::to_string(tile_id.level()));
+    }
+    // a tile with nothing on disk yet is started afresh
+    if (size > 0) {
+      counts[tile_id] = count;
+      sizes[tile_id] = size;
+    }
+  }
+  if (token != "end") {
+    throw std::runtime_error("Checkpoint of level " + std::to_string(level) + " is incomplete");
+  }
+  writer.restore(level, sizes);
+  return counts;
+}
+
 } // namespace output
 } // namespace osmlr
@@ -0,0 +1,172 @@
+#include "osmlr/output/path_plan.hpp"
+#include "osmlr/util/metrics.hpp"
+#include "osmlr/util/trace.hpp"
+#include <valhalla/baldr/graphtile.h>
+#include <valhalla/midgard/util.h>
+#include <algorithm>
+#include <cmath>
+
+namespace vm = valhalla::midgard;
+namespace vb = valhalla::baldr;
+
+namespace osmlr {
+namespace output {
+
+std::vector<std::vector<vm::PointLL> > split_shape(std::vector<vm::PointLL> shape,
+                                                   uint32_t length) {
+  std::vector<std::vector<vm::PointLL> > pieces;
+  int n = (length / kMaximumLength);
+  float dist = static_cast<float>(length) / static_cast<float>(n+1);
+  for (int j = 0; j < n; j++) {
+    pieces.emplace_back(trim_front(shape, std::ceil(dist)));
+  }
+  pieces.emplace_back(std::move(shape));
+  return pieces;
+}
+
+const vb::GraphTile *path_plan::get_tile(vb::GraphReader &reader, vb::GraphId id) {
+  static const auto hits = util::metrics::get_counter("graph_reader.hits");
+  static const auto loads = util::metrics::get_counter("graph_reader.loads");
+
+  const uint64_t tile_id = id.Tile_Base().value;
+  if (tile_id != m_last_tile && m_loaded_tiles.insert(tile_id).second) {
+    loads.add();
+    m_last_tile = tile_id;
+    util::trace::span span("load tile", id.Tile_Base(), "graph");
+    return reader.GetGraphTile(id);
+  }
+  hits.add();
+  m_last_tile = tile_id;
+  return reader.GetGraphTile(id);
+}
+
+void path_plan::clear_tiles() {
+  m_loaded_tiles.clear();
+  m_last_tile = ~uint64_t(0);
+  edges.clear();
+  segments.clear();
+}
+
+void path_plan::resolve(vb::GraphReader &reader, const vb::merge::path &p) {
+  util::trace::span span("resolve");
+  start = p.m_start;
+  edges.clear();
+  segments.clear();
+
+  for (auto edge_id : p.m_edges) {
+    const auto *tile = get_tile(reader, edge_id);
+    edges.push_back(edge{edge_id, tile, tile->directededge(edge_id), util::shape_view()});
+  }
+}
+
+void path_plan::split(vb::GraphReader &reader, util::shape_cache &shapes) {
+  util::trace::span span("split");
+  segments.clear();
+
+  // Get the length of the path
+  uint32_t total_length = 0;
+  for (const auto &e : edges) {
+    total_length += e.directededge->length();
+  }
+
+  // Skip very short segments that are only 1 edge
+  if (total_length < kMinimumLength && edges.size() == 1) {
+    return;
+  }
+
+  // Get the edge shapes, in the direction of travel
+  for (auto &e : edges) {
+    e.shape = shapes.get(e.tile, e.directededge);
+  }
+
+  // Short enough to be a single segment
+  if (total_length < kMaximumLength) {
+    add_edges(reader, start, 0, edges.size());
+    return;
+  }
+
+  // Walk the merged path and split where needed
+  uint32_t accumulated_length = 0;
+  vb::GraphId split_start = start;
+  size_t split_begin = 0;
+  for (size_t i = 0; i < edges.size(); ++i) {
+    const auto *edge = edges[i].directededge;
+    uint32_t edge_len = edge->length();
+
+    if (edge_len >= kMaximumLength) {
+      // Output prior segment
+      if (i > split_begin) {
+        add_edges(reader, split_start, split_begin, i);
+      }
+
+      // Split this edge into equal pieces
+      auto pieces = split_shape(
+        std::vector<vm::PointLL>(edges[i].shape.begin(), edges[i].shape.end()), edge_len);
+      for (size_t j = 0; j < pieces.size(); j++) {
+        if (pieces[j].size() > 0) {
+          add_partial(i, std::move(pieces[j]), (j==0), (j+1 == pieces.size()));
+        }
+      }
+
+      // Start a new path at the end of this edge
+      split_start = edge->endnode();
+      split_begin = i + 1;
+      accumulated_length = 0;
+    } else if (accumulated_length + edge_len >= kMaximumLength) {
+      // TODO - optimize the split to avoid short segments
+
+      // Output the current split path and start a new one at its end
+      add_edges(reader, split_start, split_begin, i);
+      split_start = edges[i - 1].directededge->endnode();
+      split_begin = i;
+      accumulated_length = edge_len;
+    } else {
+      // Add this edge to the current split path
+      accumulated_length += edge_len;
+    }
+  }
+
+  // Output the last
+  if (edges.size() > split_begin) {
+    add_edges(reader, split_start, split_begin, edges.size());
+  }
+}
+
+void path_plan::add_edges(vb::GraphReader &reader, vb::GraphId start_node,
+                          size_t begin, size_t end) {
+  segment seg;
+  seg.tile_id = start_node.Tile_Base();
+  seg.begin = begin;
+  seg.end = end;
+  seg.partial = false;
+  seg.start_at_node = true;
+  seg.end_at_node = true;
+
+  seg.length = 0;
+  for (size_t i = begin; i < end; ++i) {
+    seg.length += edges[i].directededge->length();
+  }
+
+  vb::GraphId last_node = edges[end - 1].directededge->endnode();
+  seg.end_ll = get_tile(reader, last_node)->node(last_node)->latlng();
+
+  segments.emplace_back(std::move(seg));
+}
+
+void path_plan::add_partial(size_t index, std::vector<vm::PointLL> &&shape,
+                            bool start_at_node, bool end_at_node) {
+  segment seg;
+  seg.tile_id = edges[index].id.Tile_Base();
+  seg.begin = index;
+  seg.end = index + 1;
+  seg.partial = true;
+  seg.start_at_node = start_at_node;
+  seg.end_at_node = end_at_node;
+  seg.shape = std::move(shape);
+  seg.length = 0;
+
+  segments.emplace_back(std::move(seg));
+}
+
+} // namespace output
+} // namespace osmlr
@@ -0,0 +1,135 @@
+#include "osmlr/output/spatial_index.hpp"
+#include "osmlr/util/compression.hpp"
+#include "osmlr/util/tile_reader.hpp"
+#include "osmlr/util/trace.hpp"
+#include "segment.pb.h"
+#include "tile.pb.h"
+#include <valhalla/midgard/logging.h>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace vm = valhalla::midgard;
+namespace vb = valhalla::baldr;
+namespace pbf = opentraffic::osmlr;
+
+namespace {
+
+typedef osmlr::util::segment_index::box box;
+
+box empty_box() {
+  return box{std::numeric_limits<int32_t>::max(), std::numeric_limits<int32_t>::max(),
+             std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::min()};
+}
+
+void expand(box &b, int32_t lng, int32_t lat) {
+  b.min_lng = std::min(b.min_lng, lng);
+  b.min_lat = std::min(b.min_lat, lat);
+  b.max_lng = std::max(b.max_lng, lng);
+  b.max_lat = std::max(b.max_lat, lat);
+}
+
+void expand(box &b, const vm::PointLL &ll) {
+  // round outwards, so the box covers the point exactly
+  expand(b, int32_t(std::floor(ll.lng() * 1.0e7)), int32_t(std::floor(ll.lat() * 1.0e7)));
+  expand(b, int32_t(std::ceil(ll.lng() * 1.0e7)), int32_t(std::ceil(ll.lat() * 1.0e7)));
+}
+
+} // anonymous namespace
+
+namespace osmlr {
+namespace output {
+
+spatial_index::spatial_index(vb::GraphReader &reader, std::string file_name)
+  : m_reader(reader)
+  , m_file_name(file_name) {
+}
+
+spatial_index::~spatial_index() {
+}
+
+void spatial_index::add_path(const path_plan &plan) {
+  for (const auto &seg : plan.segments) {
+    box b = empty_box();
+    if (seg.partial) {
+      for (const auto &ll : seg.shape) {
+        expand(b, ll);
+      }
+    } else {
+      for (size_t i = seg.begin; i < seg.end; ++i) {
+        for (const auto &ll : plan.edges[i].shape) {
+          expand(b, ll);
+        }
+      }
+    }
+
+    // ids are handed out in the same order as the tiles output does.
+    std::unique_lock<std::mutex> guard(m_lock, std::defer_lock);
+    {
+      util::trace::span span("lock wait", seg.tile_id, "lock");
+      guard.lock();
+    }
+    uint32_t &count = m_counts[seg.tile_id];
+    vb::GraphId id(seg.tile_id.tileid(), seg.tile_id.level(), count++);
+    m_items.push_back(util::segment_index::item{b, id});
+  }
+}
+
+std::unordered_map<vb::GraphId, uint32_t> spatial_index::update_tiles(
+    const std::vector<std::string>& tiles,
+    const boost::property_tree::ptree &hierarchy_properties, size_t threads) {
+
+  std::unordered_map<vb::GraphId, uint32_t> tile_index;
+
+  // every existing entry keeps its id, but only the tiles which the tiles
+  // output will look at get their segments deprecated.
+  const size_t existing = count_existing(tiles, m_reader);
+  parallel_for(
+    tiles.size(), m_reader, hierarchy_properties, threads,
+    [&](vb::GraphReader &reader, size_t index) {
+      const auto& t = tiles[index];
+      auto base_id = vb::GraphTile::GetTileId(util::uncompressed_name(t));
+
+      std::unordered_set<vb::GraphId> traffic_seg;
+      if (index < existing) {
+        traffic_seg = traffic_segments(reader.GetGraphTile(base_id));
+      }
+
+      std::vector<util::segment_index::item> items;
+      util::tile_reader tile(t);
+      uint32_t idx = 0;
+      for (const auto &entry : tile) {
+        vb::GraphId seg_id(base_id.tileid(), base_id.level(), idx++);
+        if (!entry.has_segment ||
+            (index < existing && traffic_seg.find(seg_id) == traffic_seg.end())) {
+          continue;
+        }
+
+        pbf::Tile_Entry e;
+        if (!e.ParseFromArray(entry.message_begin, int(entry.message_end - entry.message_begin))) {
+          throw std::runtime_error("Unable to parse traffic segment file.");
+        }
+        box b = empty_box();
+        for (const auto &lrp : e.segment().lrps()) {
+          expand(b, lrp.coord().lng(), lrp.coord().lat());
+        }
+        items.push_back(util::segment_index::item{b, seg_id});
+      }
+
+      std::lock_guard<std::mutex> guard(m_lock);
+      tile_index.emplace(base_id, tile.entry_count());
+      m_counts[base_id] = tile.entry_count();
+      m_items.insert(m_items.end(), items.begin(), items.end());
+    });
+
+  return tile_index;
+}
+
+void spatial_index::finish() {
+  std::lock_guard<std::mutex> guard(m_lock);
+  util::segment_index::write(m_file_name, m_items);
+  LOG_INFO("Indexed " + std::to_string(m_items.size()) + " segments in " + m_file_name);
+}
+
+} // namespace output
+} // namespace osmlr
@@ -1,10 +1,14 @@
 #include "osmlr/output/tiles.hpp"
+#include "osmlr/util/tile_reader.hpp"
+#include "osmlr/util/trace.hpp"
 #include "segment.pb.h"
 #include "tile.pb.h"
 #include <boost/filesystem.hpp>
 #include <valhalla/midgard/logging.h>
 #include <valhalla/midgard/util.h>
+#include <map>
 #include <stdexcept>
+#include <mutex>
 
 namespace vm = valhalla::midgard;
 namespace vb = valhalla::baldr;
@@ -13,40 +17,21 @@ namespace bfs = boost::filesystem;
 
 namespace {
 
-// Minimum length for an OSMLR segment
-constexpr uint32_t kMinimumLength = 5;
-
-// Maximum length for an OSMLR segment
-constexpr uint32_t kMaximumLength = 1000;
-
-// Local stats for testing
-std::unordered_map<uint32_t, uint32_t> count;
-std::unordered_map<uint32_t, uint32_t> still_valid_count;
-std::unordered_map<uint32_t, uint32_t> deprecated_count;
-
-int shortsegs = 0;
-int longsegs = 0;
-int chunks = 0;
-std::unordered_map<uint32_t, double> accum;
-
-uint16_t bearing(const std::vector<vm::PointLL> &shape) {
-  // OpenLR says to use 20m along the edge, but we could use the
-  // GetOffsetForHeading function, which adapts it to the road class.
-  float heading = vm::PointLL::HeadingAlongPolyline(shape, 20);
-  assert(heading >= 0.0);
-  assert(heading < 360.0);
-  return uint16_t(std::round(heading));
-}
-
-vb::RoadClass lowest_frc(vb::GraphReader &m_reader, const vb::merge::path &p) {
-  vb::RoadClass min = vb::RoadClass::kServiceOther;
-  for (auto edge_id : p.m_edges) {
-    vb::RoadClass c = m_reader.GetGraphTile(edge_id)->directededge(edge_id)->classification();
-    if (c < min) {
-      min = c;
-    }
+// appends a copy of the entry to buf with its segment swapped for a marker
+// carrying the deletion date. only deprecated entries are parsed this way.
+void deprecate_entry(const osmlr::util::tile_reader::entry &entry,
+                     time_t deletion_date, std::string &buf) {
+  pbf::Tile tile;
+  auto *e = tile.add_entries();
+  if (!e->ParseFromArray(entry.message_begin, int(entry.message_end - entry.message_begin))) {
+    throw std::runtime_error("Unable to parse traffic segment file.");
+  }
+  e->clear_segment();
+  e->mutable_marker()->set_segment_deleted_date(deletion_date);
+  // a tile holding just this entry serializes to exactly one entries field
+  if (!tile.AppendToString(&buf)) {
+    throw std::runtime_error("Unable to serialize Tile message.");
   }
-  return min;
 }
 
 // Check if oneway. Assumes forward access is allowed. Edge is oneway if
@@ -85,6 +70,28 @@ std::ostream &operator<<(std::ostream &out, FormOfWay fow) {
   return out;
 }
 
+uint16_t bearing(const std::vector<vm::PointLL> &shape) {
+  // OpenLR says to use 20m along the edge, but we could use the
+  // GetOffsetForHeading function, which adapts it to the road class.
+  float heading = vm::PointLL::HeadingAlongPolyline(shape, 20);
+  assert(heading >= 0.0);
+  assert(heading < 360.0);
+  return uint16_t(std::round(heading));
+}
+
+uint16_t bearing(const util::shape_view &shape) {
+  // Only the start of the shape is needed for the heading, so copy just
+  // enough points to cover that rather than the whole (maybe reversed) shape.
+  std::vector<vm::PointLL> start;
+  float dist = 0.0f;
+  start.push_back(shape[0]);
+  for (size_t i = 1; i < shape.size() && dist < 20.0f; ++i) {
+    dist += shape[i - 1].Distance(shape[i]);
+    start.push_back(shape[i]);
+  }
+  return bearing(start);
+}
+
 FormOfWay form_of_way(const vb::DirectedEdge *e) {
   bool oneway = is_oneway(e);
   auto rclass = e->classification();
@@ -117,175 +124,109 @@ FormOfWay form_of_way(const vb::DirectedEdge *e) {
 }
 
 tiles::tiles(vb::GraphReader &reader, std::string base_dir, size_t max_fds,
-             time_t creation_date, const uint64_t osm_changeset_id,
-             uint32_t max_length)
+             std::shared_ptr<util::buffer_budget> budget, time_t creation_date,
+             const uint64_t osm_changeset_id,
+             util::compression codec, uint32_t max_length)
   : m_creation_date(creation_date)
   , m_osm_changeset_id(osm_changeset_id)
   , m_reader(reader)
-  , m_writer(base_dir, "osmlr", max_fds)
+  , m_writer(base_dir, "osmlr", max_fds, budget, codec)
   , m_max_length(max_length) {
 }
 
-tiles::~tiles() {
+tiles::level_metrics::level_metrics(uint32_t level)
+  : length(util::metrics::get_histogram("tiles.segment_length.level_" + std::to_string(level)))
+  , segments_per_tile(util::metrics::get_histogram("tiles.segments_per_tile.level_" + std::to_string(level)))
+  , still_valid(util::metrics::get_counter("tiles.still_valid.level_" + std::to_string(level)))
+  , deprecated(util::metrics::get_counter("tiles.deprecated.level_" + std::to_string(level)))
+  , short_segments(util::metrics::get_counter("tiles.short_segments.level_" + std::to_string(level)))
+  , long_segments(util::metrics::get_counter("tiles.long_segments.level_" + std::to_string(level)))
+  , chunks(util::metrics::get_counter("tiles.chunks.level_" + std::to_string(level))) {
 }
 
-void tiles::split_path(const vb::merge::path& p, const uint32_t total_length) {
-  // Walk the merged path and split where needed
-  uint32_t accumulated_length = 0;
-  vb::merge::path split_path(p.m_start);
-  for (auto edge_id : p.m_edges) {
-    // TODO - do we need to check if we enter a new tile or does the writer
-    // handle this?
-
-    const auto* tile = m_reader.GetGraphTile(edge_id);
-    const auto* edge = tile->directededge(edge_id);
-    uint32_t edge_len = edge->length();
-
-    if (edge_len >= kMaximumLength) {
-      // Output prior segment
-      if (split_path.m_edges.size() > 0) {
-        output_segment(split_path);
-      }
-
-      // Split this edge
-      uint32_t edgeinfo_offset = edge->edgeinfo_offset();
-      auto edgeinfo = tile->edgeinfo(edgeinfo_offset);
-      std::vector<PointLL> shape = tile->edgeinfo(edge->edgeinfo_offset()).shape();
-      if (!edge->forward()) {
-        std::reverse(shape.begin(), shape.end());
-      }
-      int n = (edge_len / kMaximumLength);
-      float dist = static_cast<float>(edge_len) / static_cast<float>(n+1);
-      for (int i = 0; i < n; i++) {
-        auto sub_shape = trim_front(shape, std::ceil(dist));
-        if (sub_shape.size() > 0) {
-          output_segment(sub_shape, edge, edge_id, (i==0), false);
-          chunks++;
-        }
-      }
-      if (shape.size() > 0) {
-        output_segment(shape, edge, edge_id, false, true);
-        chunks++;
-      }
-
-      // Start a new path at the end of this edge
-      split_path.m_start = edge->endnode();
-      split_path.m_edges.clear();
-      accumulated_length = 0;
-    } else if (accumulated_length + edge_len >= kMaximumLength) {
-      // TODO - optimize the split to avoid short segments
-
-      // Output the current split path and start a new split path
-      output_segment(split_path);
-      split_path.m_start = split_path.m_end;
-      split_path.m_edges.clear();
-      split_path.m_edges.push_back(edge_id);
-      split_path.m_end = edge->endnode();
-      accumulated_length = edge_len;
-    } else {
-      // Add this edge to the new path
-      split_path.m_edges.push_back(edge_id);
-      split_path.m_end = edge->endnode();
-      accumulated_length += edge_len;
-    }
+tiles::level_metrics &tiles::metrics_for(uint32_t level) {
+  auto itr = m_levels.find(level);
+  if (itr == m_levels.end()) {
+    itr = m_levels.emplace(level, level_metrics(level)).first;
   }
+  return itr->second;
+}
 
-  // Output the last
-  if (split_path.m_edges.size() > 0) {
-    output_segment(split_path);
-  }
+tiles::~tiles() {
 }
 
 std::unordered_map<valhalla::baldr::GraphId, uint32_t> tiles::update_tiles(
-    const std::vector<std::string>& tiles) {
+    const std::vector<std::string>& tiles,
+    const boost::property_tree::ptree &hierarchy_properties, size_t threads) {
 
   std::unordered_map<valhalla::baldr::GraphId, uint32_t> tile_index;
 
-  for (const auto& t : tiles) {
-    auto base_id = vb::GraphTile::GetTileId(t);
-
-    if (!m_reader.DoesTileExist(base_id)) {
-      return tile_index;
-    }
-
-    // Read the OSMLR tile
-    pbf::Tile tile;
-    {
-      std::ifstream in(t);
-      if (!tile.ParseFromIstream(&in)) {
-        throw std::runtime_error("Unable to parse traffic segment file.");
-      }
-    }
-
-    std::unordered_set<vb::GraphId> traffic_seg;
-    const auto *graph_tile = m_reader.GetGraphTile(base_id);
-    const auto num_edges = graph_tile->header()->directededgecount();
-    vb::GraphId edge_id(base_id.tileid(), base_id.level(), 0);
-    for (uint32_t i = 0; i < num_edges; ++i, ++edge_id) {
-      auto* edge = graph_tile->directededge(edge_id);
-
-      if (edge->traffic_seg()) {
-        std::vector<vb::TrafficSegment> segments = graph_tile->GetTrafficSegments(edge_id);
-        for (const auto& seg : segments) {
-          traffic_seg.emplace(seg.segment_id_);
+  // each tile is read and updated independently, only recording the results
+  // and writing the updated tile are done under the lock.
+  std::mutex lock;
+  parallel_for(
+    count_existing(tiles, m_reader), m_reader, hierarchy_properties, threads,
+    [&](vb::GraphReader &reader, size_t index) {
+      const auto& t = tiles[index];
+      auto base_id = vb::GraphTile::GetTileId(util::uncompressed_name(t));
+      util::trace::span span("update tile", base_id, "update");
+
+      // Read the OSMLR tile
+      util::tile_reader tile(t);
+      const auto traffic_seg = traffic_segments(reader.GetGraphTile(base_id));
+
+      //if has_segment and not in set of associated osmlr ids in the valhalla tiles,
+      //replace the entry with one carrying a marker with the deletion date. all
+      //other bytes of the tile are copied through untouched.
+      std::string buf;
+      const char *copied = tile.data();
+      uint32_t idx = 0, still_valid = 0, deprecated = 0;
+      for (const auto &entry : tile) {
+        if (entry.has_segment) {
+          //build the id based on the base_id and index
+          vb::GraphId seg_id(base_id.tileid(), base_id.level(), idx);
+          if (traffic_seg.find(seg_id) == traffic_seg.end()) {
+            buf.append(copied, entry.record_begin);
+            deprecate_entry(entry, time(nullptr), buf);
+            copied = entry.record_end;
+            deprecated++;
+          }
+          else still_valid++;
         }
+        idx++;
       }
-    }
-
-    tile_index.emplace(base_id,tile.entries_size());
-    bool updated = false;
-    //if has_segment and not in set of associated osmlr ids in the valhalla tiles.
-    //call clear_segment
-    //call mutable marker use that marker to set deletion date.
-    for (uint32_t idx = 0; idx < tile.entries_size(); idx++) {
-      auto *entry = tile.mutable_entries(idx);
-      if ( entry->has_segment()) {
-        //build the id based on the base_id and index
-        vb::GraphId seg_id(base_id.tileid(), base_id.level(), idx);
-        if (traffic_seg.find(seg_id) == traffic_seg.end()) {
-          entry->clear_segment();
-          auto *marker = entry->mutable_marker();
-          time_t deletion_date = time(nullptr);
-          marker->set_segment_deleted_date(deletion_date);
-          deprecated_count[base_id.level()]++;
-          updated = true;
-        }
-        else still_valid_count[base_id.level()]++;
+      if (copied != tile.data()) {
+        buf.append(copied, tile.data() + tile.size());
       }
-    }
 
-    if (updated) {
-      //remove the existing tile and write out the updated pbf.
-      bfs::remove(t);
-      std::string buf;
-      if (!tile.SerializeToString(&buf)) {
-        throw std::runtime_error("Unable to serialize Tile message.");
+      std::lock_guard<std::mutex> guard(lock);
+      tile_index.emplace(base_id, tile.entry_count());
+      auto &level_stats = metrics_for(base_id.level());
+      level_stats.still_valid.add(still_valid);
+      level_stats.deprecated.add(deprecated);
+      if (copied != tile.data()) {
+        //remove the existing tile and write out the updated pbf.
+        m_writer.remove(base_id);
+        m_writer.write_to(base_id, buf);
       }
-      m_writer.write_to(base_id, buf);
-    }
-  }
+    });
+
   return tile_index;
 }
 
-void tiles::add_path(const vb::merge::path &p) {
-  // Get the length of the path
-  uint32_t total_length = 0;
-  for (auto edge_id : p.m_edges) {
-    const auto *tile = m_reader.GetGraphTile(edge_id);
-    const auto *edge = tile->directededge(edge_id);
-    total_length += edge->length();
-  }
-
-  // Skip very short segments that are only 1 edge
-  if (total_length < kMinimumLength && p.m_edges.size() == 1) {
-    return;
-  }
-
-  // Split longer segments
-  if (total_length < kMaximumLength) {
-    output_segment(p);
-  } else {
-    split_path(p, total_length);
+void tiles::add_path(const path_plan &plan) {
+  util::trace::span span("tiles", "output");
+  for (const auto &seg : plan.segments) {
+    std::vector<lrp> lrps;
+    if (seg.partial) {
+      lrps = build_segment_descriptor(seg.shape, plan.edges[seg.begin].directededge,
+                                      seg.start_at_node, seg.end_at_node,
+                                      seg.tile_id.level());
+      metrics_for(seg.tile_id.level()).chunks.add();
+    } else {
+      lrps = build_segment_descriptor(plan, seg);
+    }
+    output_segment(lrps, seg.tile_id);
   }
 }
 
@@ -311,74 +252,59 @@ std::vector<lrp> tiles::build_segment_descriptor(const std::vector<vm::PointLL>&
 
   // Update stats for total, short, and long segments. Add 10 to max segment
   // length to account for roundoff.
-  count[level] += 1;
-  accum[level] += accumulated_length;
+  auto &level_stats = metrics_for(level);
+  level_stats.length.observe(uint64_t(std::round(accumulated_length)));
   if (accumulated_length < 25) {
     LOG_ERROR("Build segment for portion of edge: short length = " +
               std::to_string(accumulated_length) + " should not occur");
-    shortsegs++;
+    level_stats.short_segments.add();
   } else if (accumulated_length > kMaximumLength+100) {
     LOG_ERROR("Build segment for portion of edge: long length = " +
               std::to_string(accumulated_length) + " should not occur");
-    longsegs++;
+    level_stats.long_segments.add();
   }
   return seg;
 }
 
 
-// Build segment LRPs for a single segment. The first LRP is at the beginning node of the path
-// and the last LRP is at the end edge in the path
-std::vector<lrp> tiles::build_segment_descriptor(const vb::merge::path &p, const uint32_t level) {
-  assert(p.m_edges.size() > 0);
+// Build segment LRPs for a segment made of whole edges. The first LRP is at
+// the beginning node of the first edge and the last LRP is at the end node of
+// the last edge.
+std::vector<lrp> tiles::build_segment_descriptor(const path_plan &plan,
+                                                 const path_plan::segment &s) {
+  assert(s.end > s.begin);
 
   std::vector<lrp> seg;
-  uint32_t accumulated_length = 0;
-  vb::GraphId last_node = p.m_start;
-  std::vector<vm::PointLL> shape;
-  vb::RoadClass start_frc, least_frc;
-  FormOfWay start_fow;
-  for (auto edge_id : p.m_edges) {
-    const auto* tile = m_reader.GetGraphTile(edge_id);
-    const auto* edge = tile->directededge(edge_id);
-    uint32_t edge_len = edge->length();
-
-    // First edge - get the shape so we can get bearing. Get FRC and FOW
-    if (accumulated_length == 0) {
-      shape = tile->edgeinfo(edge->edgeinfo_offset()).shape();
-      if (!edge->forward()) {
-        std::reverse(shape.begin(), shape.end());
-      }
-      start_frc = edge->classification();
-      least_frc = start_frc;
-      start_fow = form_of_way(edge);
+  const auto &first = plan.edges[s.begin];
+  vb::RoadClass start_frc = first.directededge->classification();
+  vb::RoadClass least_frc = start_frc;
+  FormOfWay start_fow = form_of_way(first.directededge);
+  for (size_t i = s.begin; i < s.end; ++i) {
+    vb::RoadClass c = plan.edges[i].directededge->classification();
+    if (c < least_frc) {
+      least_frc = c;
     }
-    if (edge->classification() < least_frc) {
-      least_frc = edge->classification();
-    }
-    accumulated_length += edge_len;
-    last_node = edge->endnode();
   }
 
   // Output the start LRP
+  const uint32_t accumulated_length = s.length;
   if (accumulated_length > 0) {
-    assert(shape.size() > 0);
-    seg.emplace_back(true, shape[0], bearing(shape), start_frc, start_fow,
+    assert(first.shape.size() > 0);
+    seg.emplace_back(true, first.shape[0], bearing(first.shape), start_frc, start_fow,
                      least_frc, accumulated_length);
   }
 
   // output last LRP
-  const auto* tile = m_reader.GetGraphTile(last_node);
-  vm::PointLL endll = tile->node(last_node)->latlng();
-  seg.emplace_back(true, endll, 0, start_frc, start_fow, least_frc, 0);
+  seg.emplace_back(true, s.end_ll, 0, start_frc, start_fow, least_frc, 0);
 
   // Update stats
-  count[level] += 1;
-  accum[level] += accumulated_length;
+  auto &level_stats = metrics_for(s.tile_id.level());
+  level_stats.length.observe(accumulated_length);
   if (accumulated_length < 25) {
-    shortsegs++;
+    level_stats.short_segments.add();
   } else if (accumulated_length > kMaximumLength) {
     LOG_INFO("path accumulated length = " + std::to_string(accumulated_length));
-    longsegs++;
+    level_stats.long_segments.add();
   }
   return seg;
 }
@@ -390,28 +316,9 @@ std::vector<lrp> tiles::build_segment_descriptor(const vb::merge::path &p, const
 // there is no Tile header at this time, we can just concatenate individual
 // Tile messages to make the full Tile. this means we don't have to track any
 // additional state for each Tile being built.
-void tiles::output_segment(const vb::merge::path &p) {
-  auto lrps = build_segment_descriptor(p, p.m_start.Tile_Base().level());
-  output_segment(lrps, p.m_start.Tile_Base());
-}
-
-void tiles::output_segment(const std::vector<vm::PointLL>& shape,
-                           const vb::DirectedEdge* edge,
-                           const vb::GraphId& edgeid,
-                           const bool start_at_node, const bool end_at_node) {
-  if (shape.size() > 0) {
-    auto lrps = build_segment_descriptor(shape, edge, start_at_node, end_at_node, edgeid.level());
-    output_segment(lrps, edgeid.Tile_Base());
-  } else {
-    LOG_ERROR("Skip segment with 0 shape points edge Id: " +
-              std::to_string(edgeid.tileid()) + "," +
-              std::to_string(edgeid.level()) + "," +
-              std::to_string(edgeid.id()));
-  }
-}
-
 void tiles::output_segment(std::vector<lrp>& lrps,
                            const vb::GraphId& tile_id) {
+  util::trace::span span("serialize", "output");
   pbf::Tile tile;
 
   // Add creation date and OSM changeset Id
@@ -458,47 +365,55 @@ void tiles::output_segment(std::vector<lrp>& lrps,
 }
 
 
-void tiles::finish() {
-  // Output some simple stats
+void tiles::checkpoint(std::ostream &out) {
+  checkpoint_tiles(out, m_counts, m_writer);
+}
 
-  for( const auto& x : count ) {
-    float avg = accum[x.first] / x.second;
-    std::cout << "average length = " << avg << " at level " << x.first << std::endl;
+void tiles::resume(std::istream &in, uint8_t level) {
+  for (const auto &entry : resume_tiles(in, level, m_writer)) {
+    m_counts[entry.first] = entry.second;
   }
+}
 
-  for( const auto& x : count ) {
-      std::cout << "merge count = " << x.second << " at level " << x.first << std::endl;
-  }
+void tiles::finish() {
+  util::trace::span span("finish tiles", "output");
+  // because protobuf Tile messages can be concatenated and there's no footer to
+  // write, the only thing to ensure is that all the files are flushed to disk.
+  m_writer.close_all();
 
-  for( const auto& x : deprecated_count ) {
-      std::cout << "deprecated count = " << x.second << " at level " << x.first << std::endl;
+  // Output some simple stats
+  for (const auto &tile : m_counts) {
+    metrics_for(tile.first.level()).segments_per_tile.observe(tile.second);
   }
-
-  for( const auto& x : still_valid_count ) {
-      std::cout << "still valid count = " << x.second << " at level " << x.first << std::endl;
+  std::map<uint32_t, const level_metrics *> levels;
+  for (const auto &level : m_levels) {
+    levels.emplace(level.first, &level.second);
   }
-
-  std::cout << " shortsegs = " << shortsegs <<
-          " longsegs " << longsegs << std::endl;
-  std::cout << "chunks " << chunks << std::endl;
-
-  uint32_t total = 0;
-  uint32_t max_count = 0;
-  for (auto tile : m_counts) {
-    if (tile.second > max_count) {
-      max_count = tile.second;
-    }
-    total += tile.second;
+  for (const auto &level : levels) {
+    const auto lengths = util::metrics::total(level.second->length);
+    const auto per_tile = util::metrics::total(level.second->segments_per_tile);
+    LOG_INFO("Level " + std::to_string(level.first) +
+             ": segments = " + std::to_string(lengths.count) +
+             " average length = " + std::to_string(lengths.mean()) +
+             " short = " + std::to_string(util::metrics::total(level.second->short_segments)) +
+             " long = " + std::to_string(util::metrics::total(level.second->long_segments)) +
+             " chunks = " + std::to_string(util::metrics::total(level.second->chunks)));
+    LOG_INFO("Level " + std::to_string(level.first) +
+             ": still valid = " + std::to_string(util::metrics::total(level.second->still_valid)) +
+             " deprecated = " + std::to_string(util::metrics::total(level.second->deprecated)));
+    LOG_INFO("Level " + std::to_string(level.first) +
+             ": tiles = " + std::to_string(per_tile.count) +
+             " max segments per tile = " + std::to_string(per_tile.max) +
+             " average segments per tile = " + std::to_string(per_tile.mean()));
   }
-  std::cout << "Max OSMLR segments within a tile = " << max_count << std::endl;
-  if (m_counts.size() > 0)
-    std::cout << "Average OSMLR count per tile = " << (total / m_counts.size()) << std::endl;
-
-  std::cout << "Tile count = " << m_counts.size() << std::endl;
 
-  // because protobuf Tile messages can be concatenated and there's no footer to
-  // write, the only thing to ensure is that all the files are flushed to disk.
-  m_writer.close_all();
+  const auto &stats = m_writer.get_stats();
+  record_writer_stats("tiles", stats);
+  LOG_INFO("Tile files opened = " + std::to_string(stats.opens) +
+           " evicted = " + std::to_string(stats.evictions) +
+           " hits = " + std::to_string(stats.hits) +
+           " writes = " + std::to_string(stats.writes) +
+           " bytes written = " + std::to_string(stats.bytes_written));
 }
 
 } // namespace output
@@ -0,0 +1,282 @@
+#include "osmlr/util/compression.hpp"
+#include "config.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <stdexcept>
+#include <zlib.h>
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+#define OSMLR_HAVE_ZSTD 1
+#include <zstd.h>
+#endif
+
+namespace {
+
+// size of the pieces that output grows by while (de)compressing.
+constexpr size_t kChunkSize = 64 * 1024;
+
+// how hard to try, a middle ground which keeps up with writing tiles.
+constexpr int kGzipLevel = 6;
+constexpr int kZstdLevel = 3;
+
+bool ends_with(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() &&
+    s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool is_gzip(const char *data, size_t size) {
+  return size >= 2 && uint8_t(data[0]) == 0x1f && uint8_t(data[1]) == 0x8b;
+}
+
+bool is_zstd(const char *data, size_t size) {
+  return size >= 4 && uint8_t(data[0]) == 0x28 && uint8_t(data[1]) == 0xb5 &&
+    uint8_t(data[2]) == 0x2f && uint8_t(data[3]) == 0xfd;
+}
+
+void gzip(const iovec *iov, size_t iovcnt, std::string &out) {
+  z_stream stream = z_stream();
+  // window bits over 15 ask for a gzip header and trailer
+  if (deflateInit2(&stream, kGzipLevel, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    throw std::runtime_error("Failed to start gzip compression");
+  }
+
+  size_t i = 0;
+  const char *next = iovcnt > 0 ? static_cast<const char *>(iov[0].iov_base) : nullptr;
+  size_t left = iovcnt > 0 ? iov[0].iov_len : 0;
+  int status = Z_OK;
+  while (status != Z_STREAM_END) {
+    // move on to the next piece with something in it
+    while (left == 0 && i + 1 < iovcnt) {
+      ++i;
+      next = static_cast<const char *>(iov[i].iov_base);
+      left = iov[i].iov_len;
+    }
+    const uInt in = uInt(std::min(left, size_t(UINT_MAX)));
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(next));
+    stream.avail_in = in;
+    const int flush = (in == left && i + 1 >= iovcnt) ? Z_FINISH : Z_NO_FLUSH;
+
+    do {
+      const size_t used = out.size();
+      out.resize(used + kChunkSize);
+      stream.next_out = reinterpret_cast<Bytef *>(&out[used]);
+      stream.avail_out = uInt(kChunkSize);
+      status = deflate(&stream, flush);
+      out.resize(used + kChunkSize - stream.avail_out);
+      if (status == Z_STREAM_ERROR) {
+        deflateEnd(&stream);
+        throw std::runtime_error("Failed to gzip compress data");
+      }
+    } while (stream.avail_out == 0);
+
+    next += in - stream.avail_in;
+    left -= in - stream.avail_in;
+  }
+  deflateEnd(&stream);
+}
+
+void gunzip(const char *data, size_t size, std::string &out) {
+  z_stream stream = z_stream();
+  if (inflateInit2(&stream, 15 + 16) != Z_OK) {
+    throw std::runtime_error("Failed to start gzip decompression");
+  }
+
+  const char *next = data;
+  size_t left = size;
+  // whether we're between members, and whether the last call filled the
+  // output, in which case there may be more to come without more input.
+  bool between = true, full = false;
+  while (stream.avail_in > 0 || left > 0 || (!between && full)) {
+    if (stream.avail_in == 0 && left > 0) {
+      const uInt in = uInt(std::min(left, size_t(UINT_MAX)));
+      stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(next));
+      stream.avail_in = in;
+      next += in;
+      left -= in;
+    }
+
+    const size_t used = out.size();
+    out.resize(used + kChunkSize);
+    stream.next_out = reinterpret_cast<Bytef *>(&out[used]);
+    stream.avail_out = uInt(kChunkSize);
+    const int status = inflate(&stream, Z_NO_FLUSH);
+    out.resize(used + kChunkSize - stream.avail_out);
+    full = stream.avail_out == 0;
+
+    if (status == Z_STREAM_END) {
+      // another member may follow this one
+      between = true;
+      inflateReset(&stream);
+    } else if (status == Z_OK) {
+      between = false;
+    } else {
+      inflateEnd(&stream);
+      throw std::runtime_error("Failed to gzip decompress data");
+    }
+  }
+  inflateEnd(&stream);
+
+  if (!between) {
+    throw std::runtime_error("Truncated gzip data");
+  }
+}
+
+#ifdef OSMLR_HAVE_ZSTD
+void zstd(const iovec *iov, size_t iovcnt, std::string &out) {
+  ZSTD_CStream *stream = ZSTD_createCStream();
+  if (stream == nullptr || ZSTD_isError(ZSTD_initCStream(stream, kZstdLevel))) {
+    ZSTD_freeCStream(stream);
+    throw std::runtime_error("Failed to start zstd compression");
+  }
+
+  auto check = [&](size_t status) {
+    if (ZSTD_isError(status)) {
+      ZSTD_freeCStream(stream);
+      throw std::runtime_error(std::string("Failed to zstd compress data: ") +
+                               ZSTD_getErrorName(status));
+    }
+    return status;
+  };
+
+  for (size_t i = 0; i < iovcnt; ++i) {
+    ZSTD_inBuffer in = {iov[i].iov_base, iov[i].iov_len, 0};
+    while (in.pos < in.size) {
+      const size_t used = out.size();
+      out.resize(used + kChunkSize);
+      ZSTD_outBuffer buf = {&out[used], kChunkSize, 0};
+      check(ZSTD_compressStream(stream, &buf, &in));
+      out.resize(used + buf.pos);
+    }
+  }
+
+  size_t remaining;
+  do {
+    const size_t used = out.size();
+    out.resize(used + kChunkSize);
+    ZSTD_outBuffer buf = {&out[used], kChunkSize, 0};
+    remaining = check(ZSTD_endStream(stream, &buf));
+    out.resize(used + buf.pos);
+  } while (remaining > 0);
+  ZSTD_freeCStream(stream);
+}
+
+void unzstd(const char *data, size_t size, std::string &out) {
+  ZSTD_DStream *stream = ZSTD_createDStream();
+  if (stream == nullptr || ZSTD_isError(ZSTD_initDStream(stream))) {
+    ZSTD_freeDStream(stream);
+    throw std::runtime_error("Failed to start zstd decompression");
+  }
+
+  // the stream carries on into the next frame by itself
+  ZSTD_inBuffer in = {data, size, 0};
+  size_t status = 0;
+  while (in.pos < in.size) {
+    const size_t used = out.size();
+    out.resize(used + kChunkSize);
+    ZSTD_outBuffer buf = {&out[used], kChunkSize, 0};
+    status = ZSTD_decompressStream(stream, &buf, &in);
+    out.resize(used + buf.pos);
+    if (ZSTD_isError(status)) {
+      ZSTD_freeDStream(stream);
+      throw std::runtime_error(std::string("Failed to zstd decompress data: ") +
+                               ZSTD_getErrorName(status));
+    }
+  }
+  // flush whatever is left of the last frame
+  while (status != 0) {
+    const size_t used = out.size();
+    out.resize(used + kChunkSize);
+    ZSTD_outBuffer buf = {&out[used], kChunkSize, 0};
+    status = ZSTD_decompressStream(stream, &buf, &in);
+    out.resize(used + buf.pos);
+    if (ZSTD_isError(status) || buf.pos == 0) {
+      ZSTD_freeDStream(stream);
+      throw std::runtime_error("Truncated zstd data");
+    }
+  }
+  ZSTD_freeDStream(stream);
+}
+#endif
+
+void no_zstd() {
+  throw std::runtime_error("This build doesn't support zstd compression");
+}
+
+} // anonymous namespace
+
+namespace osmlr {
+namespace util {
+
+compression parse_compression(const std::string &name) {
+  if (name == "none") {
+    return compression::kNone;
+  } else if (name == "gzip") {
+    return compression::kGzip;
+  } else if (name == "zstd") {
+#ifndef OSMLR_HAVE_ZSTD
+    no_zstd();
+#endif
+    return compression::kZstd;
+  }
+  throw std::invalid_argument("Unknown compression " + name);
+}
+
+std::string compression_suffix(compression codec) {
+  switch (codec) {
+  case compression::kGzip: return ".gz";
+  case compression::kZstd: return ".zst";
+  default:                 return "";
+  }
+}
+
+compression compression_of(const std::string &file_name) {
+  if (ends_with(file_name, ".gz")) {
+    return compression::kGzip;
+  } else if (ends_with(file_name, ".zst")) {
+    return compression::kZstd;
+  }
+  return compression::kNone;
+}
+
+std::string uncompressed_name(const std::string &file_name) {
+  return file_name.substr(0, file_name.size() -
+                          compression_suffix(compression_of(file_name)).size());
+}
+
+void compress(compression codec, const iovec *iov, size_t iovcnt, std::string &out) {
+  switch (codec) {
+  case compression::kGzip:
+    gzip(iov, iovcnt, out);
+    break;
+  case compression::kZstd:
+#ifdef OSMLR_HAVE_ZSTD
+    zstd(iov, iovcnt, out);
+#else
+    no_zstd();
+#endif
+    break;
+  default:
+    for (size_t i = 0; i < iovcnt; ++i) {
+      out.append(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len);
+    }
+  }
+}
+
+bool decompress(const char *data, size_t size, std::string &out) {
+  if (is_gzip(data, size)) {
+    gunzip(data, size, out);
+    return true;
+  } else if (is_zstd(data, size)) {
+#ifdef OSMLR_HAVE_ZSTD
+    unzstd(data, size, out);
+#else
+    no_zstd();
+#endif
+    return true;
+  }
+  return false;
+}
+
+} // namespace util
+} // namespace osmlr
@@ -0,0 +1,135 @@
+#include "osmlr/util/feature_collection.hpp"
+
+#include <cctype>
+#include <cstdlib>
+#include <utility>
+
+namespace osmlr {
+namespace util {
+
+bool scan_collection(const std::string &json, collection_layout &layout) {
+  layout.features_begin = layout.features_end = std::string::npos;
+  layout.features.clear();
+
+  // the most recent key at each of the depths we're interested in: 1 is the
+  // collection, 3 a feature and 4 the feature's geometry or properties.
+  constexpr size_t kMaxKeyDepth = 5;
+  std::pair<size_t, size_t> keys[kMaxKeyDepth];
+  auto key_is = [&](size_t depth, const char *name) {
+    return json.compare(keys[depth].first, keys[depth].second - keys[depth].first, name) == 0;
+  };
+
+  size_t depth = 0;
+  bool after_string = false, in_feature = false, has_id = false;
+  std::pair<size_t, size_t> last_string(0, 0);
+  feature_range feature{0, 0, 0};
+
+  for (size_t i = 0; i < json.size(); ++i) {
+    switch (json[i]) {
+    case '"': {
+      // skip to the closing quote, minding any escapes
+      size_t j = i + 1;
+      while (j < json.size() && json[j] != '"') {
+        j += (json[j] == '\\') ? 2 : 1;
+      }
+      if (j >= json.size()) {
+        return false;
+      }
+      last_string = std::make_pair(i + 1, j);
+      after_string = true;
+      i = j;
+      break;
+    }
+    case ':':
+      // the string before a colon is a key
+      if (after_string && depth < kMaxKeyDepth) {
+        keys[depth] = last_string;
+        if (in_feature && depth == 4 && key_is(3, "properties") && key_is(4, "osmlr_id")) {
+          // the value may have been quoted by older versions.
+          size_t v = i + 1;
+          while (v < json.size() && (std::isspace(static_cast<unsigned char>(json[v])) || json[v] == '"')) {
+            ++v;
+          }
+          const char *begin = json.c_str() + v;
+          char *end = nullptr;
+          feature.osmlr_id = std::strtoull(begin, &end, 10);
+          has_id = (end != begin);
+        }
+      }
+      after_string = false;
+      break;
+    case '{':
+    case '[':
+      if (depth == 1 && json[i] == '[' && key_is(1, "features") &&
+          layout.features_begin == std::string::npos) {
+        layout.features_begin = i + 1;
+      } else if (depth == 2 && json[i] == '{' &&
+                 layout.features_begin != std::string::npos &&
+                 layout.features_end == std::string::npos) {
+        in_feature = true;
+        has_id = false;
+        feature.begin = i;
+      }
+      ++depth;
+      after_string = false;
+      break;
+    case '}':
+    case ']':
+      if (depth == 0) {
+        return false;
+      }
+      --depth;
+      if (depth == 2 && in_feature) {
+        if (!has_id) {
+          return false;
+        }
+        feature.end = i + 1;
+        layout.features.push_back(feature);
+        in_feature = false;
+      } else if (depth == 1 && json[i] == ']' &&
+                 layout.features_begin != std::string::npos &&
+                 layout.features_end == std::string::npos) {
+        layout.features_end = i;
+      }
+      after_string = false;
+      break;
+    case ',':
+      after_string = false;
+      break;
+    default:
+      // whitespace, numbers and literals
+      break;
+    }
+  }
+
+  return depth == 0 && layout.features_end != std::string::npos;
+}
+
+bool find_collection_end(const std::string &buf, size_t &cut, bool &empty) {
+  size_t i = buf.size();
+  auto skip_space = [&]() {
+    while (i > 0 && std::isspace(static_cast<unsigned char>(buf[i - 1]))) {
+      --i;
+    }
+  };
+
+  // expect the collection to end with "]}", possibly with whitespace
+  skip_space();
+  if (i > 0 && buf[i - 1] == '}') {
+    --i;
+    skip_space();
+    if (i > 0 && buf[i - 1] == ']') {
+      --i;
+      cut = i;
+      skip_space();
+      if (i > 0) {
+        empty = (buf[i - 1] == '[');
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+} // namespace util
+} // namespace osmlr
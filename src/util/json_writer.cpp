@@ -0,0 +1,93 @@
+#include "osmlr/util/json_writer.hpp"
+
+#include <cmath>
+#include <stdexcept>
+
+namespace osmlr {
+namespace util {
+
+constexpr unsigned int json_writer::kMaxPrecision;
+
+json_writer::json_writer(unsigned int precision)
+  : m_precision(precision)
+  , m_scale(1) {
+  if (precision > kMaxPrecision) {
+    throw std::invalid_argument("Coordinate precision must be at most " +
+                                std::to_string(kMaxPrecision) + " decimal places.");
+  }
+  for (unsigned int i = 0; i < precision; ++i) {
+    m_scale *= 10;
+  }
+}
+
+json_writer &json_writer::quoted(const std::string &s) {
+  static const char hex[] = "0123456789abcdef";
+
+  m_buf.push_back('"');
+  for (char c : s) {
+    switch (c) {
+    case '"':  m_buf.append("\\\""); break;
+    case '\\': m_buf.append("\\\\"); break;
+    case '\n': m_buf.append("\\n");  break;
+    case '\r': m_buf.append("\\r");  break;
+    case '\t': m_buf.append("\\t");  break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        m_buf.append("\\u00");
+        m_buf.push_back(hex[(c >> 4) & 0xf]);
+        m_buf.push_back(hex[c & 0xf]);
+      } else {
+        m_buf.push_back(c);
+      }
+    }
+  }
+  m_buf.push_back('"');
+  return *this;
+}
+
+json_writer &json_writer::coordinate(double value) {
+  if (!std::isfinite(value)) {
+    // not representable in JSON.
+    m_buf.append("null");
+    return *this;
+  }
+
+  // round to the precision as an integer, then split that into the whole and
+  // fractional parts so that all the formatting is integer arithmetic.
+  const uint64_t scaled = uint64_t(std::round(std::fabs(value) * m_scale));
+  if (value < 0 && scaled != 0) {
+    m_buf.push_back('-');
+  }
+  append_unsigned(scaled / m_scale);
+
+  uint64_t fraction = scaled % m_scale;
+  if (fraction != 0) {
+    char digits[kMaxPrecision];
+    unsigned int len = m_precision;
+    for (unsigned int i = m_precision; i > 0; --i) {
+      digits[i - 1] = char('0' + fraction % 10);
+      fraction /= 10;
+    }
+    while (len > 0 && digits[len - 1] == '0') {
+      --len;
+    }
+    m_buf.push_back('.');
+    m_buf.append(digits, len);
+  }
+  return *this;
+}
+
+void json_writer::append_unsigned(uint64_t value) {
+  // 20 digits is enough for the largest uint64_t.
+  char digits[20];
+  char *end = digits + sizeof(digits);
+  char *ptr = end;
+  do {
+    *--ptr = char('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  m_buf.append(ptr, end);
+}
+
+} // namespace util
+} // namespace osmlr
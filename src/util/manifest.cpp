@@ -0,0 +1,93 @@
+#include "osmlr/util/manifest.hpp"
+#include "osmlr/util/json_writer.hpp"
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+namespace bpt = boost::property_tree;
+namespace vb = valhalla::baldr;
+
+namespace osmlr {
+namespace util {
+
+manifest::manifest(std::string tool_, std::string version_, const shard &part_,
+                   uint64_t changeset_id_)
+  : tool(std::move(tool_))
+  , version(std::move(version_))
+  , part(part_)
+  , changeset_id(changeset_id_) {
+}
+
+void manifest::add_output(const std::string &extension, const std::string &base,
+                          size_t threads) {
+  auto &out = outputs[extension];
+  out.base = base;
+  out.tiles = scan_tiles(base, extension, threads);
+  out.tiles.erase(std::remove_if(out.tiles.begin(), out.tiles.end(),
+                                 [this](const tile_file &t) { return !part.owns(t.tile_id); }),
+                  out.tiles.end());
+}
+
+void manifest::write(const std::string &file_name) const {
+  json_writer out;
+  out.raw("{\"tool\":").quoted(tool)
+     .raw(",\"version\":").quoted(version)
+     .raw(",\"shard\":").quoted(part.name())
+     .raw(",\"changeset_id\":").number(changeset_id)
+     .raw(",\"outputs\":{");
+  bool first = true;
+  for (const auto &entry : outputs) {
+    if (!first) out.raw(',');
+    first = false;
+    out.quoted(entry.first).raw(":{\"base\":").quoted(entry.second.base)
+       .raw(",\"tiles\":[");
+    bool first_tile = true;
+    for (const auto &t : entry.second.tiles) {
+      if (!first_tile) out.raw(',');
+      first_tile = false;
+      out.raw('[').number(t.tile_id.value).raw(',').number(int64_t(t.size)).raw(']');
+    }
+    out.raw("]}");
+  }
+  out.raw("}}\n");
+
+  std::ofstream file(file_name, std::ios::out | std::ios::trunc | std::ios::binary);
+  file.write(out.str().data(), out.size());
+  file.close();
+  if (!file) {
+    throw std::runtime_error("Unable to write manifest to " + file_name);
+  }
+}
+
+manifest manifest::read(const std::string &file_name) {
+  bpt::ptree pt;
+  try {
+    bpt::read_json(file_name, pt);
+    manifest m(pt.get<std::string>("tool"), pt.get<std::string>("version"),
+               shard::parse(pt.get<std::string>("shard")),
+               pt.get<uint64_t>("changeset_id"));
+    for (const auto &entry : pt.get_child("outputs")) {
+      auto &out = m.outputs[entry.first];
+      out.base = entry.second.get<std::string>("base");
+      for (const auto &t : entry.second.get_child("tiles")) {
+        std::vector<uint64_t> fields;
+        for (const auto &field : t.second) {
+          fields.push_back(field.second.get_value<uint64_t>());
+        }
+        if (fields.size() != 2) {
+          throw std::runtime_error("a tile should be [id,size]");
+        }
+        out.tiles.push_back(tile_file{vb::GraphId(fields[0]), std::string(), off_t(fields[1])});
+      }
+    }
+    return m;
+  } catch (const std::exception &e) {
+    throw std::runtime_error("Unable to read manifest " + file_name + ": " + e.what());
+  }
+}
+
+} // namespace util
+} // namespace osmlr
@@ -0,0 +1,269 @@
+#include "osmlr/util/metrics.hpp"
+#include "osmlr/util/json_writer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace osmlr {
+namespace util {
+
+constexpr size_t metrics::kMaxCounters;
+constexpr size_t metrics::kMaxHistograms;
+constexpr size_t metrics::kBuckets;
+
+namespace {
+
+typedef std::atomic<uint64_t> value_t;
+
+struct histogram_shard {
+  value_t count, sum, min, max;
+  std::array<value_t, metrics::kBuckets> buckets;
+};
+
+// one thread's part of every metric. only the thread holding the shard
+// writes to it, so adding is a relaxed load and store rather than a locked
+// read-modify-write, and the atomics are only there so that totals can be
+// read while it's being written.
+struct shard {
+  std::array<value_t, metrics::kMaxCounters> counters;
+  std::array<histogram_shard, metrics::kMaxHistograms> histograms;
+
+  shard() {
+    for (auto &c : counters) {
+      c.store(0, std::memory_order_relaxed);
+    }
+    for (auto &h : histograms) {
+      h.count.store(0, std::memory_order_relaxed);
+      h.sum.store(0, std::memory_order_relaxed);
+      h.min.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+      h.max.store(0, std::memory_order_relaxed);
+      for (auto &b : h.buckets) {
+        b.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+};
+
+struct registry {
+  std::mutex lock;
+  std::vector<std::string> counter_names, histogram_names;
+  std::unordered_map<std::string, size_t> counters, histograms;
+  std::vector<std::unique_ptr<shard> > shards;
+  // shards of threads which have exited, to be given to new threads.
+  std::vector<shard *> free_shards;
+};
+
+// never destroyed, so that threads exiting during static destruction can
+// still give back their shards.
+registry &get_registry() {
+  static registry *r = new registry;
+  return *r;
+}
+
+// a thread's shard, handed back when the thread exits.
+struct lease {
+  shard *held = nullptr;
+  ~lease() {
+    if (held != nullptr) {
+      auto &r = get_registry();
+      std::lock_guard<std::mutex> guard(r.lock);
+      r.free_shards.push_back(held);
+    }
+  }
+};
+thread_local lease t_lease;
+
+shard &local_shard() {
+  if (t_lease.held == nullptr) {
+    auto &r = get_registry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    if (!r.free_shards.empty()) {
+      t_lease.held = r.free_shards.back();
+      r.free_shards.pop_back();
+    } else {
+      r.shards.emplace_back(new shard);
+      t_lease.held = r.shards.back().get();
+    }
+  }
+  return *t_lease.held;
+}
+
+void bump(value_t &v, uint64_t n) {
+  v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+size_t bucket_of(uint64_t value) {
+  return value == 0 ? 0 : 64 - __builtin_clzll(value);
+}
+
+uint64_t bucket_upper(size_t bucket) {
+  return bucket == 0 ? 0
+    : bucket >= 64 ? std::numeric_limits<uint64_t>::max()
+    : (uint64_t(1) << bucket) - 1;
+}
+
+size_t register_name(std::unordered_map<std::string, size_t> &indices,
+                     std::vector<std::string> &names, const std::string &name,
+                     size_t max_metrics) {
+  std::lock_guard<std::mutex> guard(get_registry().lock);
+  auto itr = indices.find(name);
+  if (itr != indices.end()) {
+    return itr->second;
+  }
+  if (names.size() >= max_metrics) {
+    throw std::runtime_error("Too many metrics to register " + name);
+  }
+  indices.emplace(name, names.size());
+  names.push_back(name);
+  return names.size() - 1;
+}
+
+// the totals, with the registry locked.
+uint64_t sum_counter(const registry &r, size_t index) {
+  uint64_t total = 0;
+  for (const auto &s : r.shards) {
+    total += s->counters[index].load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+metrics::summary sum_histogram(const registry &r, size_t index) {
+  metrics::summary total;
+  total.count = total.sum = total.max = 0;
+  total.min = std::numeric_limits<uint64_t>::max();
+  total.buckets.fill(0);
+  for (const auto &s : r.shards) {
+    const auto &h = s->histograms[index];
+    total.count += h.count.load(std::memory_order_relaxed);
+    total.sum += h.sum.load(std::memory_order_relaxed);
+    total.min = std::min(total.min, h.min.load(std::memory_order_relaxed));
+    total.max = std::max(total.max, h.max.load(std::memory_order_relaxed));
+    for (size_t i = 0; i < metrics::kBuckets; ++i) {
+      total.buckets[i] += h.buckets[i].load(std::memory_order_relaxed);
+    }
+  }
+  if (total.count == 0) {
+    total.min = 0;
+  }
+  return total;
+}
+
+} // anonymous namespace
+
+void metrics::counter::add(uint64_t n) const {
+  bump(local_shard().counters[index], n);
+}
+
+void metrics::histogram::observe(uint64_t value) const {
+  auto &h = local_shard().histograms[index];
+  bump(h.count, 1);
+  bump(h.sum, value);
+  bump(h.buckets[bucket_of(value)], 1);
+  if (value < h.min.load(std::memory_order_relaxed)) {
+    h.min.store(value, std::memory_order_relaxed);
+  }
+  if (value > h.max.load(std::memory_order_relaxed)) {
+    h.max.store(value, std::memory_order_relaxed);
+  }
+}
+
+metrics::counter metrics::get_counter(const std::string &name) {
+  auto &r = get_registry();
+  return counter{register_name(r.counters, r.counter_names, name, kMaxCounters)};
+}
+
+metrics::histogram metrics::get_histogram(const std::string &name) {
+  auto &r = get_registry();
+  return histogram{register_name(r.histograms, r.histogram_names, name, kMaxHistograms)};
+}
+
+uint64_t metrics::summary::percentile(double p) const {
+  const double target = p * count;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBuckets; ++i) {
+    seen += buckets[i];
+    if (seen > 0 && seen >= target) {
+      return std::min(bucket_upper(i), max);
+    }
+  }
+  return max;
+}
+
+uint64_t metrics::total(counter c) {
+  auto &r = get_registry();
+  std::lock_guard<std::mutex> guard(r.lock);
+  return sum_counter(r, c.index);
+}
+
+metrics::summary metrics::total(histogram h) {
+  auto &r = get_registry();
+  std::lock_guard<std::mutex> guard(r.lock);
+  return sum_histogram(r, h.index);
+}
+
+std::string metrics::to_json() {
+  auto &r = get_registry();
+  std::lock_guard<std::mutex> guard(r.lock);
+
+  // in name order, so that reports can be diffed
+  std::map<std::string, size_t> counters(r.counters.begin(), r.counters.end());
+  std::map<std::string, size_t> histograms(r.histograms.begin(), r.histograms.end());
+
+  json_writer out(3);
+  out.raw("{\"counters\":{");
+  bool first = true;
+  for (const auto &c : counters) {
+    if (!first) out.raw(',');
+    first = false;
+    out.quoted(c.first).raw(':').number(sum_counter(r, c.second));
+  }
+  out.raw("},\"histograms\":{");
+  first = true;
+  for (const auto &h : histograms) {
+    if (!first) out.raw(',');
+    first = false;
+    const auto s = sum_histogram(r, h.second);
+    out.quoted(h.first).raw(":{")
+       .raw("\"count\":").number(s.count)
+       .raw(",\"sum\":").number(s.sum)
+       .raw(",\"min\":").number(s.min)
+       .raw(",\"max\":").number(s.max)
+       .raw(",\"mean\":").coordinate(s.mean())
+       .raw(",\"p50\":").number(s.percentile(0.5))
+       .raw(",\"p90\":").number(s.percentile(0.9))
+       .raw(",\"p99\":").number(s.percentile(0.99))
+       .raw(",\"buckets\":{");
+    // only the buckets with values in them, keyed by their upper bound
+    bool first_bucket = true;
+    for (size_t i = 0; i < kBuckets; ++i) {
+      if (s.buckets[i] == 0) continue;
+      if (!first_bucket) out.raw(',');
+      first_bucket = false;
+      out.raw('"').number(bucket_upper(i)).raw("\":").number(s.buckets[i]);
+    }
+    out.raw("}}");
+  }
+  out.raw("}}\n");
+  return out.str();
+}
+
+void metrics::write_json(const std::string &file_name) {
+  const std::string report = to_json();
+  std::ofstream file(file_name, std::ios::out | std::ios::trunc | std::ios::binary);
+  file.write(report.data(), report.size());
+  file.close();
+  if (!file) {
+    throw std::runtime_error("Unable to write metrics to " + file_name);
+  }
+}
+
+} // namespace util
+} // namespace osmlr
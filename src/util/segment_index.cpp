@@ -0,0 +1,278 @@
+#include "osmlr/util/segment_index.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace vb = valhalla::baldr;
+
+namespace {
+
+// the distance along a Hilbert curve filling a 2^16 x 2^16 grid of the point
+// (x, y). this is the branch free version from "Fast Hilbert curve generation,
+// sorting, and range queries" by rawrunprotected, as used by flatbush.
+uint32_t hilbert(uint32_t x, uint32_t y) {
+  uint32_t a = x ^ y;
+  uint32_t b = 0xFFFF ^ a;
+  uint32_t c = 0xFFFF ^ (x | y);
+  uint32_t d = x & (y ^ 0xFFFF);
+
+  uint32_t A = a | (b >> 1);
+  uint32_t B = (a >> 1) ^ a;
+  uint32_t C = ((c >> 1) ^ (b & (d >> 1))) ^ c;
+  uint32_t D = ((a & (c >> 1)) ^ (d >> 1)) ^ d;
+
+  a = A; b = B; c = C; d = D;
+  A = ((a & (a >> 2)) ^ (b & (b >> 2)));
+  B = ((a & (b >> 2)) ^ (b & ((a ^ b) >> 2)));
+  C ^= ((a & (c >> 2)) ^ (b & (d >> 2)));
+  D ^= ((b & (c >> 2)) ^ ((a ^ b) & (d >> 2)));
+
+  a = A; b = B; c = C; d = D;
+  A = ((a & (a >> 4)) ^ (b & (b >> 4)));
+  B = ((a & (b >> 4)) ^ (b & ((a ^ b) >> 4)));
+  C ^= ((a & (c >> 4)) ^ (b & (d >> 4)));
+  D ^= ((b & (c >> 4)) ^ ((a ^ b) & (d >> 4)));
+
+  a = A; b = B; c = C; d = D;
+  C ^= ((a & (c >> 8)) ^ (b & (d >> 8)));
+  D ^= ((b & (c >> 8)) ^ ((a ^ b) & (d >> 8)));
+
+  a = C ^ (C >> 1);
+  b = D ^ (D >> 1);
+
+  uint32_t i0 = x ^ y;
+  uint32_t i1 = b | (0xFFFF ^ (i0 | a));
+
+  i0 = (i0 | (i0 << 8)) & 0x00FF00FF;
+  i0 = (i0 | (i0 << 4)) & 0x0F0F0F0F;
+  i0 = (i0 | (i0 << 2)) & 0x33333333;
+  i0 = (i0 | (i0 << 1)) & 0x55555555;
+
+  i1 = (i1 | (i1 << 8)) & 0x00FF00FF;
+  i1 = (i1 | (i1 << 4)) & 0x0F0F0F0F;
+  i1 = (i1 | (i1 << 2)) & 0x33333333;
+  i1 = (i1 | (i1 << 1)) & 0x55555555;
+
+  return (i1 << 1) | i0;
+}
+
+// scales a coordinate within [min, min + range] onto the Hilbert grid.
+uint32_t grid(int64_t value, int64_t min, int64_t range) {
+  return range > 0 ? uint32_t((value - min) * 0xFFFF / range) : 0;
+}
+
+void write_raw(std::ofstream &out, const void *data, size_t size) {
+  out.write(static_cast<const char *>(data), size);
+}
+
+} // anonymous namespace
+
+namespace osmlr {
+namespace util {
+
+constexpr char segment_index::kMagic[8];
+constexpr uint32_t segment_index::kVersion;
+constexpr uint32_t segment_index::kNodeSize;
+
+void segment_index::write(const std::string &file_name, std::vector<item> &items) {
+  const uint64_t n = items.size();
+
+  // sort the items along the Hilbert curve through the centres of their
+  // boxes, within the extent of them all.
+  box extent{std::numeric_limits<int32_t>::max(), std::numeric_limits<int32_t>::max(),
+             std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::min()};
+  for (const auto &i : items) {
+    extent.min_lng = std::min(extent.min_lng, i.bbox.min_lng);
+    extent.min_lat = std::min(extent.min_lat, i.bbox.min_lat);
+    extent.max_lng = std::max(extent.max_lng, i.bbox.max_lng);
+    extent.max_lat = std::max(extent.max_lat, i.bbox.max_lat);
+  }
+  // centres are kept doubled, to stay in integers.
+  const int64_t min_x = 2 * int64_t(extent.min_lng), range_x = 2 * (int64_t(extent.max_lng) - extent.min_lng);
+  const int64_t min_y = 2 * int64_t(extent.min_lat), range_y = 2 * (int64_t(extent.max_lat) - extent.min_lat);
+  std::vector<std::pair<uint32_t, uint64_t> > order(n);
+  for (uint64_t i = 0; i < n; ++i) {
+    const box &b = items[i].bbox;
+    order[i].first = hilbert(grid(int64_t(b.min_lng) + b.max_lng, min_x, range_x),
+                             grid(int64_t(b.min_lat) + b.max_lat, min_y, range_y));
+    order[i].second = i;
+  }
+  std::sort(order.begin(), order.end(), [&](const std::pair<uint32_t, uint64_t> &a,
+                                            const std::pair<uint32_t, uint64_t> &b) {
+    return a.first < b.first ||
+      (a.first == b.first && items[a.second].id.value < items[b.second].id.value);
+  });
+
+  // the end of each level of nodes, from the leaves up to the root
+  std::vector<uint64_t> level_ends;
+  uint64_t count = n, nodes = n;
+  if (n > 0) {
+    level_ends.push_back(n);
+    while (count > 1) {
+      count = (count + kNodeSize - 1) / kNodeSize;
+      nodes += count;
+      level_ends.push_back(nodes);
+    }
+  }
+
+  std::vector<box> boxes(nodes);
+  std::vector<uint64_t> indices(nodes);
+  for (uint64_t i = 0; i < n; ++i) {
+    boxes[i] = items[order[i].second].bbox;
+    indices[i] = items[order[i].second].id.value;
+  }
+
+  // each node covers the boxes of up to kNodeSize nodes in the level below
+  uint64_t pos = n;
+  for (size_t level = 1; level < level_ends.size(); ++level) {
+    const uint64_t begin = level == 1 ? 0 : level_ends[level - 2];
+    const uint64_t end = level_ends[level - 1];
+    for (uint64_t child = begin; child < end; child += kNodeSize, ++pos) {
+      box b = boxes[child];
+      for (uint64_t c = child + 1; c < std::min(child + kNodeSize, end); ++c) {
+        b.min_lng = std::min(b.min_lng, boxes[c].min_lng);
+        b.min_lat = std::min(b.min_lat, boxes[c].min_lat);
+        b.max_lng = std::max(b.max_lng, boxes[c].max_lng);
+        b.max_lat = std::max(b.max_lat, boxes[c].max_lat);
+      }
+      boxes[pos] = b;
+      indices[pos] = child;
+    }
+  }
+
+  header h{};
+  std::copy(kMagic, kMagic + sizeof(kMagic), h.magic);
+  h.version = kVersion;
+  h.node_size = kNodeSize;
+  h.item_count = n;
+  h.node_count = nodes;
+  h.level_count = level_ends.size();
+
+  const std::string tmp_name = file_name + ".tmp";
+  std::ofstream out(tmp_name, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    throw std::runtime_error("Unable to open " + tmp_name);
+  }
+  write_raw(out, &h, sizeof(h));
+  write_raw(out, level_ends.data(), level_ends.size() * sizeof(uint64_t));
+  write_raw(out, boxes.data(), boxes.size() * sizeof(box));
+  write_raw(out, indices.data(), indices.size() * sizeof(uint64_t));
+  out.close();
+  if (!out || std::rename(tmp_name.c_str(), file_name.c_str()) != 0) {
+    std::remove(tmp_name.c_str());
+    throw std::runtime_error("Unable to write segment index " + file_name);
+  }
+}
+
+segment_index::segment_index(const std::string &file_name)
+  : m_data(nullptr)
+  , m_size(0)
+  , m_header(nullptr)
+  , m_level_ends(nullptr)
+  , m_boxes(nullptr)
+  , m_indices(nullptr) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::string error(strerror(errno));
+    throw std::runtime_error("Failed to open " + file_name + " because: " + error);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(header)) {
+    close(fd);
+    throw std::runtime_error("Segment index " + file_name + " is too short");
+  }
+  m_size = st.st_size;
+
+  void *ptr = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED) {
+    std::string error(strerror(errno));
+    throw std::runtime_error("Failed to map " + file_name + " because: " + error);
+  }
+  m_data = static_cast<const char *>(ptr);
+  m_header = reinterpret_cast<const header *>(m_data);
+
+  auto fail = [&](const std::string &why) {
+    munmap(const_cast<char *>(m_data), m_size);
+    throw std::runtime_error("Segment index " + file_name + " " + why);
+  };
+  if (memcmp(m_header->magic, kMagic, sizeof(kMagic)) != 0) {
+    fail("is not a segment index");
+  }
+  if (m_header->version != kVersion || m_header->node_size != kNodeSize) {
+    fail("has an unsupported version " + std::to_string(m_header->version));
+  }
+  const uint64_t expected = sizeof(header) + uint64_t(m_header->level_count) * sizeof(uint64_t) +
+    m_header->node_count * (sizeof(box) + sizeof(uint64_t));
+  if (m_header->node_count > m_size || m_header->level_count > m_size || expected > m_size) {
+    fail("is truncated");
+  }
+
+  m_level_ends = reinterpret_cast<const uint64_t *>(m_data + sizeof(header));
+  m_boxes = reinterpret_cast<const box *>(m_level_ends + m_header->level_count);
+  m_indices = reinterpret_cast<const uint64_t *>(m_boxes + m_header->node_count);
+  if (m_header->node_count > 0 &&
+      (m_header->level_count == 0 ||
+       m_level_ends[m_header->level_count - 1] != m_header->node_count)) {
+    fail("has bad levels");
+  }
+}
+
+segment_index::~segment_index() {
+  munmap(const_cast<char *>(m_data), m_size);
+}
+
+void segment_index::query(double min_lng, double min_lat, double max_lng, double max_lat,
+                          const std::function<void(vb::GraphId)> &found) const {
+  const uint64_t nodes = m_header->node_count, items = m_header->item_count;
+  if (nodes == 0) {
+    return;
+  }
+  const box q{int32_t(std::floor(min_lng * 1.0e7)), int32_t(std::floor(min_lat * 1.0e7)),
+              int32_t(std::ceil(max_lng * 1.0e7)), int32_t(std::ceil(max_lat * 1.0e7))};
+  const uint64_t *level_end = m_level_ends + m_header->level_count;
+
+  // start at the root, which is the last node
+  std::vector<uint64_t> pending;
+  uint64_t node = nodes - 1;
+  while (true) {
+    // the node and its siblings are all in the same level
+    const uint64_t end = std::min(node + kNodeSize, *std::upper_bound(m_level_ends, level_end, node));
+    for (uint64_t pos = node; pos < end; ++pos) {
+      if (!q.intersects(m_boxes[pos])) {
+        continue;
+      }
+      if (node < items) {
+        found(vb::GraphId(m_indices[pos]));
+      } else if (m_indices[pos] < pos) {
+        pending.push_back(m_indices[pos]);
+      }
+    }
+    if (pending.empty()) {
+      break;
+    }
+    node = pending.back();
+    pending.pop_back();
+  }
+}
+
+std::vector<vb::GraphId> segment_index::query(double min_lng, double min_lat,
+                                              double max_lng, double max_lat) const {
+  std::vector<vb::GraphId> ids;
+  query(min_lng, min_lat, max_lng, max_lat, [&](vb::GraphId id) { ids.push_back(id); });
+  return ids;
+}
+
+} // namespace util
+} // namespace osmlr
@@ -0,0 +1,104 @@
+#include "osmlr/util/segment_table.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace vb = valhalla::baldr;
+
+namespace osmlr {
+namespace util {
+
+constexpr char segment_table::kMagic[8];
+constexpr uint32_t segment_table::kVersion;
+
+segment_table::segment_table(const std::string &file_name)
+  : m_data(nullptr)
+  , m_size(0)
+  , m_header(nullptr)
+  , m_records(nullptr)
+  , m_levels() {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::string error(strerror(errno));
+    throw std::runtime_error("Failed to open " + file_name + " because: " + error);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(header)) {
+    close(fd);
+    throw std::runtime_error("Segment table " + file_name + " is too short");
+  }
+  m_size = st.st_size;
+
+  void *ptr = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED) {
+    std::string error(strerror(errno));
+    throw std::runtime_error("Failed to map " + file_name + " because: " + error);
+  }
+  m_data = static_cast<const char *>(ptr);
+  m_header = reinterpret_cast<const header *>(m_data);
+
+  // check that everything the header points at is inside the file, so that
+  // lookups don't have to.
+  auto fail = [&](const std::string &why) {
+    munmap(const_cast<char *>(m_data), m_size);
+    throw std::runtime_error("Segment table " + file_name + " " + why);
+  };
+  if (memcmp(m_header->magic, kMagic, sizeof(kMagic)) != 0) {
+    fail("is not a segment table");
+  }
+  if (m_header->version != kVersion || m_header->record_size != sizeof(record)) {
+    fail("has an unsupported version " + std::to_string(m_header->version));
+  }
+  if (m_header->records > m_size ||
+      m_header->record_count > (m_size - m_header->records) / sizeof(record)) {
+    fail("is truncated");
+  }
+  m_records = reinterpret_cast<const record *>(m_data + m_header->records);
+
+  const level *levels = reinterpret_cast<const level *>(m_data + sizeof(header));
+  if (m_header->level_count > (m_size - sizeof(header)) / sizeof(level)) {
+    fail("is truncated");
+  }
+  for (uint32_t i = 0; i < m_header->level_count; ++i) {
+    const level &l = levels[i];
+    if (l.level >= kMaxLevels || l.offsets > m_size ||
+        uint64_t(l.tile_count) + 1 > (m_size - l.offsets) / sizeof(uint64_t)) {
+      fail("has a bad level " + std::to_string(i));
+    }
+    const uint64_t *offsets = reinterpret_cast<const uint64_t *>(m_data + l.offsets);
+    if (offsets[l.tile_count] > m_header->record_count) {
+      fail("has a bad level " + std::to_string(i));
+    }
+    m_levels[l.level] = &l;
+  }
+}
+
+segment_table::~segment_table() {
+  munmap(const_cast<char *>(m_data), m_size);
+}
+
+const segment_table::record *segment_table::find(vb::GraphId id) const {
+  if (id.level() >= kMaxLevels || m_levels[id.level()] == nullptr) {
+    return nullptr;
+  }
+  const level &l = *m_levels[id.level()];
+  if (id.tileid() >= l.tile_count) {
+    return nullptr;
+  }
+  const uint64_t *offsets = reinterpret_cast<const uint64_t *>(m_data + l.offsets);
+  const uint64_t begin = offsets[id.tileid()], end = offsets[id.tileid() + 1];
+  if (end < begin || end > m_header->record_count || id.id() >= end - begin) {
+    return nullptr;
+  }
+  return &m_records[begin + id.id()];
+}
+
+} // namespace util
+} // namespace osmlr
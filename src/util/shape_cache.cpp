@@ -0,0 +1,47 @@
+#include "osmlr/util/shape_cache.hpp"
+
+#include <algorithm>
+
+namespace vb = valhalla::baldr;
+
+namespace osmlr {
+namespace util {
+
+shape_cache::shape_cache(size_t max_shapes)
+  : m_max_shapes(std::max(max_shapes, size_t(1)))
+  , m_stats{0, 0, 0} {
+}
+
+shape_view shape_cache::get(const vb::GraphTile *tile, const vb::DirectedEdge *edge) {
+  const key k{tile->header()->graphid().value, edge->edgeinfo_offset()};
+  const bool reversed = !edge->forward();
+
+  auto itr = m_shapes.find(k);
+  if (itr != m_shapes.end()) {
+    m_lru.splice(m_lru.begin(), m_lru, itr->second.lru);
+    m_stats.hits += 1;
+    return shape_view(itr->second.points, reversed);
+  }
+
+  // make room for the new shape, dropping the least recently used.
+  while (m_shapes.size() >= m_max_shapes) {
+    m_shapes.erase(m_lru.back());
+    m_lru.pop_back();
+    m_stats.evictions += 1;
+  }
+
+  auto points = std::make_shared<const shape_view::points_t>(
+    tile->edgeinfo(edge->edgeinfo_offset()).shape());
+  m_lru.push_front(k);
+  m_shapes.emplace(k, entry{points, m_lru.begin()});
+  m_stats.misses += 1;
+  return shape_view(points, reversed);
+}
+
+void shape_cache::clear() {
+  m_shapes.clear();
+  m_lru.clear();
+}
+
+} // namespace util
+} // namespace osmlr
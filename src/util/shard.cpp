@@ -0,0 +1,71 @@
+#include "osmlr/util/shard.hpp"
+
+#include <valhalla/baldr/tilehierarchy.h>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace vb = valhalla::baldr;
+
+namespace osmlr {
+namespace util {
+
+constexpr double shard::kBlockDegrees;
+
+shard::shard(uint32_t index_, uint32_t count_)
+  : index(index_)
+  , count(count_) {
+  if (count == 0 || index >= count) {
+    throw std::runtime_error("Invalid shard " + name());
+  }
+}
+
+shard shard::parse(const std::string &spec) {
+  const auto slash = spec.find('/');
+  if (slash == std::string::npos) {
+    throw std::runtime_error("Shard must be given as i/N, not " + spec);
+  }
+  try {
+    size_t end;
+    const unsigned long index = std::stoul(spec.substr(0, slash), &end);
+    if (end != slash) {
+      throw std::invalid_argument(spec);
+    }
+    const std::string count_str = spec.substr(slash + 1);
+    const unsigned long count = std::stoul(count_str, &end);
+    if (end != count_str.size()) {
+      throw std::invalid_argument(spec);
+    }
+    return shard(uint32_t(index), uint32_t(count));
+  } catch (const std::logic_error &) {
+    throw std::runtime_error("Shard must be given as i/N, not " + spec);
+  }
+}
+
+bool shard::owns(vb::GraphId tile_id) const {
+  if (count == 1) {
+    return true;
+  }
+
+  const auto &levels = vb::TileHierarchy::levels();
+  auto level = levels.find(tile_id.level());
+  if (level == levels.end()) {
+    // not on a tiled level, so there's nowhere to put it
+    return tile_id.tileid() % count == index;
+  }
+
+  // the block that the tile's south west corner is in
+  const auto base = level->second.tiles.Base(tile_id.tileid());
+  const int columns = int(std::ceil(360.0 / kBlockDegrees));
+  const int rows = int(std::ceil(180.0 / kBlockDegrees));
+  const int column = std::min(std::max(int((base.lng() + 180.0) / kBlockDegrees), 0), columns - 1);
+  const int row = std::min(std::max(int((base.lat() + 90.0) / kBlockDegrees), 0), rows - 1);
+  return uint32_t(row * columns + column) % count == index;
+}
+
+std::string shard::name() const {
+  return std::to_string(index) + "/" + std::to_string(count);
+}
+
+} // namespace util
+} // namespace osmlr
@@ -0,0 +1,391 @@
+#include "osmlr/util/tile_archive.hpp"
+
+#include <boost/filesystem.hpp>
+#include <valhalla/baldr/graphtile.h>
+#include <valhalla/midgard/logging.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace bfs = boost::filesystem;
+namespace vb = valhalla::baldr;
+
+namespace {
+
+typedef osmlr::util::tile_archive archive;
+
+const std::string kExtension = ".pack";
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// holds the archive's lock for as long as it's in scope. the lock is on the
+// open file, so it keeps out other writers in this process as well as
+// other processes.
+struct archive_lock {
+  explicit archive_lock(int fd) : m_fd(fd) {
+    while (flock(m_fd, LOCK_EX) < 0) {
+      if (errno != EINTR) {
+        std::string error(strerror(errno));
+        throw std::runtime_error("Failed to lock archive because: " + error);
+      }
+    }
+  }
+  ~archive_lock() {
+    flock(m_fd, LOCK_UN);
+  }
+
+private:
+  int m_fd;
+};
+
+void write_all(int fd, std::vector<iovec> iov) {
+  size_t i = 0;
+  while (i < iov.size()) {
+    const int count = int(std::min(iov.size() - i, size_t(IOV_MAX)));
+    ssize_t n = writev(fd, &iov[i], count);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::string error(strerror(errno));
+      throw std::runtime_error("Failed to write archive because: " + error);
+    }
+
+    // skip over everything which was written
+    size_t written = n;
+    while (i < iov.size() && written >= iov[i].iov_len) {
+      written -= iov[i].iov_len;
+      ++i;
+    }
+    if (written > 0) {
+      iov[i].iov_base = static_cast<char *>(iov[i].iov_base) + written;
+      iov[i].iov_len -= written;
+    }
+  }
+}
+
+// walks the records in data, adding the data records to the index. stops
+// early at a record which is cut short, which a writer may have been in the
+// middle of when it stopped.
+void walk(const char *data, size_t size, archive::index &index, uint32_t &codecs) {
+  uint64_t pos = 0;
+  while (size - pos >= sizeof(archive::record_header)) {
+    archive::record_header header;
+    memcpy(&header, data + pos, sizeof(header));
+    const uint64_t begin = pos + sizeof(header);
+    if (header.length > size - begin) {
+      LOG_WARN("Ignoring a truncated record at the end of an archive");
+      return;
+    }
+
+    switch (header.type) {
+    case archive::kData:
+      index[header.tile_id].push_back(archive::extent{begin, header.length});
+      codecs |= 1u << header.codec;
+      break;
+    case archive::kRemove:
+      index.erase(header.tile_id);
+      break;
+    case archive::kIndex:
+      break;
+    default:
+      throw std::runtime_error("Unknown record in archive");
+    }
+    pos = begin + header.length;
+  }
+  if (pos != size) {
+    LOG_WARN("Ignoring a truncated record at the end of an archive");
+  }
+}
+
+// reads the index at the end of the file, if there is one.
+bool read_index(const char *data, size_t size, archive::index &index, uint32_t &codecs) {
+  archive::footer footer;
+  archive::record_header header;
+  if (size < sizeof(header) + sizeof(footer)) {
+    return false;
+  }
+  memcpy(&footer, data + size - sizeof(footer), sizeof(footer));
+  if (memcmp(footer.magic, archive::kMagic, sizeof(archive::kMagic)) != 0 ||
+      footer.index > size - sizeof(header) - sizeof(footer)) {
+    return false;
+  }
+  memcpy(&header, data + footer.index, sizeof(header));
+  if (header.type != archive::kIndex ||
+      footer.index + sizeof(header) + header.length != size) {
+    return false;
+  }
+
+  const char *p = data + footer.index + sizeof(header);
+  const char *end = data + size - sizeof(footer);
+  auto next = [&]() {
+    if (end - p < ptrdiff_t(sizeof(uint64_t))) {
+      throw std::runtime_error("Archive index is truncated");
+    }
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    p += sizeof(value);
+    return value;
+  };
+
+  const uint64_t tile_count = next();
+  for (uint64_t i = 0; i < tile_count; ++i) {
+    auto &extents = index[next()];
+    const uint64_t extent_count = next();
+    for (uint64_t j = 0; j < extent_count; ++j) {
+      archive::extent e;
+      e.offset = next();
+      e.length = next();
+      if (e.offset > size || e.length > size - e.offset) {
+        throw std::runtime_error("Archive index is corrupt");
+      }
+      extents.push_back(e);
+    }
+  }
+  codecs = footer.codecs;
+  return true;
+}
+
+} // anonymous namespace
+
+namespace osmlr {
+namespace util {
+
+constexpr char tile_archive::kMagic[8];
+
+bool tile_archive::is_archive(const std::string &path) {
+  return path.size() > kExtension.size() &&
+    path.compare(path.size() - kExtension.size(), kExtension.size(), kExtension) == 0;
+}
+
+bool tile_archive::archive_of(const std::string &name, std::string &archive) {
+  const size_t pos = name.rfind(kExtension + "/");
+  if (pos == std::string::npos) {
+    return false;
+  }
+  archive = name.substr(0, pos + kExtension.size());
+  return true;
+}
+
+std::shared_ptr<const tile_archive> tile_archive::open(const std::string &file_name) {
+  static std::mutex lock;
+  static std::unordered_map<std::string, std::shared_ptr<const tile_archive> > archives;
+
+  std::lock_guard<std::mutex> guard(lock);
+  auto &archive = archives[file_name];
+  if (!archive) {
+    archive = std::make_shared<tile_archive>(file_name);
+  }
+  return archive;
+}
+
+std::string tile_archive::read_tile(const std::string &name) {
+  std::string data, archive;
+  if (archive_of(name, archive)) {
+    data = open(archive)->read(vb::GraphTile::GetTileId(uncompressed_name(name)));
+  } else {
+    std::ifstream in(name, std::ios::binary);
+    if (!in) {
+      throw std::runtime_error("Failed to open " + name);
+    }
+    data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+
+  std::string plain;
+  if (decompress(data.data(), data.size(), plain)) {
+    return plain;
+  }
+  return data;
+}
+
+void tile_archive::append(int fd, record_type type, compression codec,
+                          vb::GraphId tile_id, const iovec *iov, size_t iovcnt) {
+  record_header header{type, uint32_t(codec), tile_id.value, 0};
+  std::vector<iovec> pieces(1 + iovcnt);
+  for (size_t i = 0; i < iovcnt; ++i) {
+    header.length += iov[i].iov_len;
+    pieces[i + 1] = iov[i];
+  }
+  pieces[0].iov_base = &header;
+  pieces[0].iov_len = sizeof(header);
+
+  archive_lock guard(fd);
+  write_all(fd, pieces);
+}
+
+void tile_archive::append_index(int fd) {
+  archive_lock guard(fd);
+
+  // everyone's records are in the index, not just this writer's.
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    std::string error(strerror(errno));
+    throw std::runtime_error("Failed to stat archive because: " + error);
+  }
+  index idx;
+  uint32_t codecs = 0;
+  if (st.st_size > 0) {
+    void *ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+      std::string error(strerror(errno));
+      throw std::runtime_error("Failed to map archive because: " + error);
+    }
+    bool indexed = false;
+    try {
+      // nothing has been written since an index that ends the file
+      indexed = read_index(static_cast<const char *>(ptr), st.st_size, idx, codecs);
+      if (!indexed) {
+        idx.clear();
+        codecs = 0;
+        walk(static_cast<const char *>(ptr), st.st_size, idx, codecs);
+      }
+    } catch (...) {
+      munmap(ptr, st.st_size);
+      throw;
+    }
+    munmap(ptr, st.st_size);
+    if (indexed) {
+      return;
+    }
+  }
+
+  // tiles in id order, so that the index is the same however it was written
+  std::vector<uint64_t> ids;
+  ids.reserve(idx.size());
+  for (const auto &entry : idx) {
+    ids.push_back(entry.first);
+  }
+  std::sort(ids.begin(), ids.end());
+
+  std::vector<uint64_t> values;
+  values.push_back(ids.size());
+  for (auto id : ids) {
+    const auto &extents = idx[id];
+    values.push_back(id);
+    values.push_back(extents.size());
+    for (const auto &e : extents) {
+      values.push_back(e.offset);
+      values.push_back(e.length);
+    }
+  }
+
+  footer foot;
+  memset(&foot, 0, sizeof(foot));
+  foot.index = st.st_size;
+  foot.codecs = codecs;
+  memcpy(foot.magic, kMagic, sizeof(kMagic));
+
+  record_header header{kIndex, 0, 0, values.size() * sizeof(uint64_t) + sizeof(foot)};
+  std::vector<iovec> pieces(3);
+  pieces[0].iov_base = &header;
+  pieces[0].iov_len = sizeof(header);
+  pieces[1].iov_base = values.data();
+  pieces[1].iov_len = values.size() * sizeof(uint64_t);
+  pieces[2].iov_base = &foot;
+  pieces[2].iov_len = sizeof(foot);
+  write_all(fd, pieces);
+}
+
+tile_archive::tile_archive(const std::string &file_name)
+  : m_file_name(file_name)
+  , m_data(nullptr)
+  , m_size(0)
+  , m_codecs(0) {
+  int fd = ::open(file_name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::string error(strerror(errno));
+    throw std::runtime_error("Failed to open " + file_name + " because: " + error);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    std::string error(strerror(errno));
+    close(fd);
+    throw std::runtime_error("Failed to stat " + file_name + " because: " + error);
+  }
+  m_size = st.st_size;
+  if (m_size > 0) {
+    void *ptr = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+      std::string error(strerror(errno));
+      close(fd);
+      throw std::runtime_error("Failed to map " + file_name + " because: " + error);
+    }
+    m_data = static_cast<const char *>(ptr);
+  }
+  close(fd);
+
+  try {
+    if (!read_index(m_data, m_size, m_index, m_codecs)) {
+      LOG_WARN("Archive " + file_name + " has no index at its end, reading all of it");
+      m_index.clear();
+      walk(m_data, m_size, m_index, m_codecs);
+    }
+  } catch (...) {
+    if (m_data != nullptr) {
+      munmap(const_cast<char *>(m_data), m_size);
+    }
+    throw;
+  }
+}
+
+tile_archive::~tile_archive() {
+  if (m_data != nullptr) {
+    munmap(const_cast<char *>(m_data), m_size);
+  }
+}
+
+std::vector<vb::GraphId> tile_archive::tiles() const {
+  std::vector<vb::GraphId> ids;
+  ids.reserve(m_index.size());
+  for (const auto &entry : m_index) {
+    ids.emplace_back(entry.first);
+  }
+  std::sort(ids.begin(), ids.end(), [](const vb::GraphId &a, const vb::GraphId &b) {
+    return a.value < b.value;
+  });
+  return ids;
+}
+
+std::string tile_archive::name_of(vb::GraphId tile_id, const std::string &extension) const {
+  auto path = bfs::path(m_file_name) / vb::GraphTile::FileSuffix(tile_id);
+  return path.replace_extension(extension).string();
+}
+
+std::string tile_archive::read(vb::GraphId tile_id) const {
+  std::string data;
+  auto itr = m_index.find(tile_id.value);
+  if (itr != m_index.end()) {
+    data.reserve(size_of(tile_id));
+    for (const auto &e : itr->second) {
+      data.append(m_data + e.offset, e.length);
+    }
+  }
+  return data;
+}
+
+size_t tile_archive::size_of(vb::GraphId tile_id) const {
+  size_t size = 0;
+  auto itr = m_index.find(tile_id.value);
+  if (itr != m_index.end()) {
+    for (const auto &e : itr->second) {
+      size += e.length;
+    }
+  }
+  return size;
+}
+
+} // namespace util
+} // namespace osmlr
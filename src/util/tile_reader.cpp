@@ -0,0 +1,261 @@
+#include "osmlr/util/tile_reader.hpp"
+#include "osmlr/util/compression.hpp"
+#include "osmlr/util/tile_archive.hpp"
+#include "tile.pb.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace pbf = opentraffic::osmlr;
+
+namespace {
+
+// protocol buffers wire types
+constexpr uint32_t kVarint = 0;
+constexpr uint32_t kFixed64 = 1;
+constexpr uint32_t kLengthDelimited = 2;
+constexpr uint32_t kFixed32 = 5;
+
+void malformed() {
+  throw std::runtime_error("Unable to parse traffic segment file.");
+}
+
+uint64_t read_varint(const char *&p, const char *end) {
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (p >= end) {
+      malformed();
+    }
+    const uint8_t byte = static_cast<uint8_t>(*p++);
+    value |= uint64_t(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+  malformed();
+  return 0;
+}
+
+uint64_t read_fixed(const char *&p, const char *end, size_t width) {
+  if (size_t(end - p) < width) {
+    malformed();
+  }
+  // little-endian on the wire
+  uint64_t value = 0;
+  for (size_t i = 0; i < width; ++i) {
+    value |= uint64_t(static_cast<uint8_t>(p[i])) << (8 * i);
+  }
+  p += width;
+  return value;
+}
+
+// reads the tag of the next field, returning false at the end of the data.
+bool read_tag(const char *&p, const char *end, uint32_t &field, uint32_t &wire_type) {
+  if (p >= end) {
+    return false;
+  }
+  const uint64_t tag = read_varint(p, end);
+  field = uint32_t(tag >> 3);
+  wire_type = uint32_t(tag & 7);
+  return true;
+}
+
+// reads a length-delimited value, leaving p after it.
+void read_bytes(const char *&p, const char *end, const char *&begin, const char *&finish) {
+  const uint64_t len = read_varint(p, end);
+  if (len > uint64_t(end - p)) {
+    malformed();
+  }
+  begin = p;
+  finish = p + len;
+  p = finish;
+}
+
+// reads an integer field, whichever of the integer encodings it uses.
+uint64_t read_integer(const char *&p, const char *end, uint32_t wire_type) {
+  switch (wire_type) {
+  case kVarint:  return read_varint(p, end);
+  case kFixed64: return read_fixed(p, end, 8);
+  case kFixed32: return read_fixed(p, end, 4);
+  default:
+    malformed();
+  }
+  return 0;
+}
+
+void skip_field(const char *&p, const char *end, uint32_t wire_type) {
+  const char *begin, *finish;
+  switch (wire_type) {
+  case kVarint:          read_varint(p, end);               break;
+  case kFixed64:         read_fixed(p, end, 8);             break;
+  case kLengthDelimited: read_bytes(p, end, begin, finish); break;
+  case kFixed32:         read_fixed(p, end, 4);             break;
+  default:
+    // groups aren't used by the tile format
+    malformed();
+  }
+}
+
+} // anonymous namespace
+
+namespace osmlr {
+namespace util {
+
+void tile_reader::map(const std::string &file_name) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::string error(strerror(errno));
+    throw std::runtime_error("Failed to open " + file_name + " because: " + error);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    std::string error(strerror(errno));
+    close(fd);
+    throw std::runtime_error("Failed to stat " + file_name + " because: " + error);
+  }
+
+  m_size = st.st_size;
+  if (m_size > 0) {
+    void *ptr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr == MAP_FAILED) {
+      std::string error(strerror(errno));
+      close(fd);
+      throw std::runtime_error("Failed to map " + file_name + " because: " + error);
+    }
+    m_data = static_cast<const char *>(ptr);
+  }
+  // the mapping stays valid without the descriptor
+  close(fd);
+
+  // a compressed tile is read from memory rather than the mapping
+  try {
+    if (m_data != nullptr && decompress(m_data, m_size, m_plain)) {
+      munmap(const_cast<char *>(m_data), m_size);
+      m_data = m_plain.data();
+      m_size = m_plain.size();
+    }
+  } catch (...) {
+    munmap(const_cast<char *>(m_data), m_size);
+    throw;
+  }
+}
+
+tile_reader::tile_reader(const std::string &file_name)
+  : m_file_name(file_name)
+  , m_data(nullptr)
+  , m_size(0)
+  , m_entry_count(0)
+  , m_creation_date(0)
+  , m_changeset_id(0) {
+  // a tile within an archive is read into memory rather than mapped
+  std::string archive;
+  if (tile_archive::archive_of(file_name, archive)) {
+    m_plain = tile_archive::read_tile(file_name);
+    m_data = m_plain.data();
+    m_size = m_plain.size();
+  } else {
+    map(file_name);
+  }
+
+  // find the header fields and count the entries, without looking inside them
+  try {
+    const char *p = m_data, *end = m_data + m_size;
+    uint32_t field, wire_type;
+    while (read_tag(p, end, field, wire_type)) {
+      if (field == pbf::Tile::kEntriesFieldNumber && wire_type == kLengthDelimited) {
+        skip_field(p, end, wire_type);
+        m_entry_count++;
+      } else if (field == pbf::Tile::kCreationDateFieldNumber) {
+        m_creation_date = read_integer(p, end, wire_type);
+      } else if (field == pbf::Tile::kChangesetIdFieldNumber) {
+        m_changeset_id = read_integer(p, end, wire_type);
+      } else if (field == pbf::Tile::kDescriptionFieldNumber && wire_type == kLengthDelimited) {
+        const char *begin, *finish;
+        read_bytes(p, end, begin, finish);
+        m_description.assign(begin, finish);
+      } else {
+        skip_field(p, end, wire_type);
+      }
+    }
+  } catch (...) {
+    if (m_data != nullptr && m_data != m_plain.data()) {
+      munmap(const_cast<char *>(m_data), m_size);
+    }
+    throw;
+  }
+}
+
+tile_reader::~tile_reader() {
+  if (m_data != nullptr && m_data != m_plain.data()) {
+    munmap(const_cast<char *>(m_data), m_size);
+  }
+}
+
+tile_reader::const_iterator::const_iterator(const char *pos, const char *end)
+  : m_pos(pos)
+  , m_end(end) {
+  advance();
+}
+
+tile_reader::const_iterator &tile_reader::const_iterator::operator++() {
+  advance();
+  return *this;
+}
+
+void tile_reader::const_iterator::advance() {
+  m_entry = entry{nullptr, nullptr, nullptr, nullptr, false, false, 0, 0};
+
+  uint32_t field, wire_type;
+  const char *record = m_pos;
+  while (read_tag(m_pos, m_end, field, wire_type)) {
+    if (field != pbf::Tile::kEntriesFieldNumber || wire_type != kLengthDelimited) {
+      skip_field(m_pos, m_end, wire_type);
+      record = m_pos;
+      continue;
+    }
+
+    m_entry.record_begin = record;
+    read_bytes(m_pos, m_end, m_entry.message_begin, m_entry.message_end);
+    m_entry.record_end = m_pos;
+
+    // decode the fields of the entry, but not the segment itself
+    const char *p = m_entry.message_begin, *end = m_entry.message_end;
+    while (read_tag(p, end, field, wire_type)) {
+      if (field == pbf::Tile_Entry::kSegmentFieldNumber && wire_type == kLengthDelimited) {
+        // segment and marker are alternatives, the last one seen wins.
+        skip_field(p, end, wire_type);
+        m_entry.has_segment = true;
+        m_entry.has_marker = false;
+      } else if (field == pbf::Tile_Entry::kMarkerFieldNumber && wire_type == kLengthDelimited) {
+        m_entry.has_segment = false;
+        m_entry.has_marker = true;
+        const char *q, *marker_end;
+        read_bytes(p, end, q, marker_end);
+        while (read_tag(q, marker_end, field, wire_type)) {
+          if (field == pbf::Tile_Marker::kSegmentDeletedDateFieldNumber) {
+            m_entry.segment_deleted_date = read_integer(q, marker_end, wire_type);
+          } else {
+            skip_field(q, marker_end, wire_type);
+          }
+        }
+      } else if (field == pbf::Tile_Entry::kSegmentCreationDateFieldNumber) {
+        m_entry.segment_creation_date = read_integer(p, end, wire_type);
+      } else {
+        skip_field(p, end, wire_type);
+      }
+    }
+    return;
+  }
+
+  // no more entries, this is now the end iterator
+  m_pos = m_end;
+}
+
+} // namespace util
+} // namespace osmlr
@@ -0,0 +1,129 @@
+#include "osmlr/util/tile_scan.hpp"
+#include "osmlr/util/compression.hpp"
+#include "osmlr/util/tile_archive.hpp"
+
+#include <boost/filesystem.hpp>
+#include <valhalla/baldr/graphtile.h>
+#include <valhalla/midgard/logging.h>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace bfs = boost::filesystem;
+namespace vb = valhalla::baldr;
+
+namespace {
+
+// adds the tile file at path, if it is one. it may be compressed.
+void add_tile(const bfs::path &path, const std::string &extension,
+              std::vector<osmlr::util::tile_file> &tiles) {
+  const bfs::path plain = osmlr::util::uncompressed_name(path.string());
+  if (plain.extension() != extension || !bfs::is_regular_file(path)) {
+    return;
+  }
+  try {
+    tiles.push_back(osmlr::util::tile_file{
+        vb::GraphTile::GetTileId(plain.string()), path.string(),
+        off_t(bfs::file_size(path))});
+  } catch (const std::exception &e) {
+    LOG_WARN("Skipping " + path.string() + ", which isn't a tile: " + e.what());
+  }
+}
+
+// adds all the tile files below dir.
+void scan_dir(const bfs::path &dir, const std::string &extension,
+              std::vector<osmlr::util::tile_file> &tiles) {
+  for (bfs::recursive_directory_iterator itr(dir), end; itr != end; ++itr) {
+    add_tile(itr->path(), extension, tiles);
+  }
+}
+
+} // anonymous namespace
+
+namespace osmlr {
+namespace util {
+
+std::vector<tile_file> scan_tiles(const std::string &base_dir,
+                                  const std::string &extension,
+                                  size_t threads) {
+  std::vector<tile_file> tiles;
+  if (tile_archive::is_archive(base_dir) && bfs::is_regular_file(base_dir)) {
+    // the archive's index already has everything, in order
+    auto archive = tile_archive::open(base_dir);
+    for (const auto &tile_id : archive->tiles()) {
+      tiles.push_back(tile_file{tile_id, archive->name_of(tile_id, extension),
+                                off_t(archive->size_of(tile_id))});
+    }
+    return tiles;
+  }
+  if (!bfs::is_directory(base_dir)) {
+    return tiles;
+  }
+
+  // the level directories hold only a few directories each, so split the
+  // work up over the directories inside them. any files found along the way
+  // are added directly.
+  std::vector<bfs::path> dirs;
+  for (bfs::directory_iterator level(base_dir), end; level != end; ++level) {
+    if (!bfs::is_directory(level->path())) {
+      add_tile(level->path(), extension, tiles);
+      continue;
+    }
+    for (bfs::directory_iterator itr(level->path()); itr != end; ++itr) {
+      if (bfs::is_directory(itr->path())) {
+        dirs.push_back(itr->path());
+      } else {
+        add_tile(itr->path(), extension, tiles);
+      }
+    }
+  }
+
+  threads = std::min(std::max(threads, size_t(1)), dirs.size());
+  std::vector<std::vector<tile_file> > found(threads);
+  std::atomic<size_t> next_dir(0);
+  std::mutex lock;
+  std::exception_ptr error;
+  auto scan = [&](size_t thread) {
+    try {
+      size_t i;
+      while ((i = next_dir.fetch_add(1)) < dirs.size()) {
+        scan_dir(dirs[i], extension, found[thread]);
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> guard(lock);
+      error = std::current_exception();
+    }
+  };
+
+  if (threads <= 1) {
+    if (!dirs.empty()) {
+      scan(0);
+    }
+  } else {
+    std::vector<std::shared_ptr<std::thread> > pool(threads);
+    for (size_t i = 0; i < pool.size(); ++i) {
+      pool[i].reset(new std::thread(scan, i));
+    }
+    for (auto &thread : pool) {
+      thread->join();
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+
+  for (auto &f : found) {
+    tiles.insert(tiles.end(), std::make_move_iterator(f.begin()),
+                 std::make_move_iterator(f.end()));
+  }
+  std::sort(tiles.begin(), tiles.end(), [](const tile_file &a, const tile_file &b) {
+    return a.tile_id.value < b.tile_id.value;
+  });
+  return tiles;
+}
+
+} // namespace util
+} // namespace osmlr
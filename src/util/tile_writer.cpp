@@ -1,21 +1,232 @@
 #include "osmlr/util/tile_writer.hpp"
+#include "osmlr/util/tile_archive.hpp"
+#include "osmlr/util/tile_scan.hpp"
+#include "osmlr/util/trace.hpp"
 
 #include <boost/filesystem.hpp>
 #include <valhalla/baldr/graphtile.h>
 #include <valhalla/midgard/logging.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
 
 namespace bfs = boost::filesystem;
 namespace vb = valhalla::baldr;
 
+namespace {
+
+// size of the blocks that buffered data is collected in. each block becomes
+// one entry in the iovec array passed to writev.
+constexpr size_t kBlockSize = 64 * 1024;
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// how a file was carried over from a previous release.
+enum class carried { kLinked, kCloned, kCopied, kConverted };
+
+// copies the contents of in to out, in the kernel when possible.
+void copy_contents(int in, int out, const std::string &name) {
+  auto fail = [&]() {
+    std::string error(strerror(errno));
+    throw std::runtime_error("Failed to copy " + name + " because: " + error);
+  };
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+  while (true) {
+    ssize_t n = copy_file_range(in, nullptr, out, nullptr, 1 << 30, 0);
+    if (n == 0) {
+      return;
+    }
+    if (n < 0) {
+      // not supported here, so fall back to reading and writing if nothing
+      // has been copied yet.
+      if ((errno == ENOSYS || errno == EXDEV || errno == EINVAL) &&
+          lseek(out, 0, SEEK_CUR) == 0) {
+        break;
+      }
+      fail();
+    }
+  }
+#endif
+  char buf[kBlockSize];
+  ssize_t n;
+  while ((n = read(in, buf, sizeof(buf))) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fail();
+    }
+    for (ssize_t done = 0; done < n; ) {
+      ssize_t w = write(out, buf + done, n - done);
+      if (w < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        fail();
+      }
+      done += w;
+    }
+  }
+}
+
+// makes dst a copy of src, sharing its blocks if the filesystem can.
+carried clone_file(const std::string &src, const std::string &dst) {
+  int in = open(src.c_str(), O_RDONLY);
+  if (in < 0) {
+    std::string error(strerror(errno));
+    throw std::runtime_error("Failed to open " + src + " because: " + error);
+  }
+  struct stat st;
+  fstat(in, &st);
+  int out = open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 0777);
+  if (out < 0) {
+    std::string error(strerror(errno));
+    close(in);
+    throw std::runtime_error("Failed to create " + dst + " because: " + error);
+  }
+
+  carried how = carried::kCopied;
+  try {
+#ifdef FICLONE
+    if (ioctl(out, FICLONE, in) == 0) {
+      how = carried::kCloned;
+    } else
+#endif
+    copy_contents(in, out, src);
+  } catch (...) {
+    close(in);
+    close(out);
+    throw;
+  }
+
+  close(in);
+  if (close(out) < 0) {
+    std::string error(strerror(errno));
+    throw std::runtime_error("Failed to close " + dst + " because: " + error);
+  }
+  return how;
+}
+
+// makes dst a copy of src, compressed with codec instead of however src is.
+void convert_file(const std::string &src, const std::string &dst,
+                  osmlr::util::compression codec) {
+  std::ifstream in(src, std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  if (!in.eof() && !in) {
+    throw std::runtime_error("Failed to read " + src);
+  }
+  std::string plain;
+  if (osmlr::util::decompress(data.data(), data.size(), plain)) {
+    data.swap(plain);
+  }
+  iovec iov;
+  iov.iov_base = &data[0];
+  iov.iov_len = data.size();
+  std::string converted;
+  osmlr::util::compress(codec, &iov, 1, converted);
+
+  std::ofstream out(dst, std::ios::binary | std::ios::trunc);
+  out.write(converted.data(), converted.size());
+  if (!out) {
+    throw std::runtime_error("Failed to write " + dst);
+  }
+}
+
+// links, clones or copies the files with the extension under src into dst.
+void carry_over_dir(const bfs::path &src, const bfs::path &dst,
+                    const std::string &extension, osmlr::util::compression codec,
+                    std::vector<std::string> &files, size_t counts[4]) {
+  bfs::create_directories(dst);
+  for (bfs::directory_iterator itr(src), end; itr != end; ++itr) {
+    const bfs::path &path = itr->path();
+    const bfs::path plain = osmlr::util::uncompressed_name(path.filename().string());
+    if (bfs::is_directory(path)) {
+      carry_over_dir(path, dst / path.filename(), extension, codec, files, counts);
+
+    } else if (bfs::is_regular_file(path) && plain.extension() == extension) {
+      const bfs::path target = dst / (plain.string() + osmlr::util::compression_suffix(codec));
+      carried how = carried::kLinked;
+      if (osmlr::util::compression_of(path.string()) != codec) {
+        convert_file(path.string(), target.string(), codec);
+        how = carried::kConverted;
+      } else if (link(path.c_str(), target.c_str()) != 0) {
+        // e.g: a different filesystem or too many links already
+        how = clone_file(path.string(), target.string());
+      }
+      counts[int(how)]++;
+      files.emplace_back(target.string());
+    }
+  }
+}
+
+} // anonymous namespace
+
 namespace osmlr {
 namespace util {
 
-tile_writer::tile_writer(std::string base_dir, std::string suffix, size_t max_fds)
+tile_writer::tile_writer(std::string base_dir, std::string suffix, size_t max_fds,
+                         size_t max_buffer, compression codec)
+  : tile_writer(base_dir, suffix, max_fds,
+                max_buffer > 0 ? std::make_shared<buffer_budget>(max_buffer) : nullptr,
+                codec) {
+}
+
+tile_writer::tile_writer(std::string base_dir, std::string suffix, size_t max_fds,
+                         std::shared_ptr<buffer_budget> budget, compression codec)
   : m_base_dir(base_dir)
   , m_suffix(suffix)
   , m_max_fds(max_fds)
-  , m_max_lru(0) {
+  , m_codec(codec)
+  , m_archive(tile_archive::is_archive(base_dir))
+  , m_archive_fd(-1)
+  , m_stats{0, 0, 0, 0, 0}
+  , m_budget(budget)
+  , m_buffered(0) {
+  const bfs::path dir = m_archive ? bfs::path(base_dir).parent_path() : bfs::path(base_dir);
+  if (!dir.empty()) {
+    bfs::create_directories(dir);
+  }
+}
+
+tile_writer::~tile_writer() {
+  // buffered data would be lost otherwise, but it's too late to report any
+  // error other than through the log.
+  try {
+    close_all();
+  } catch (const std::exception &e) {
+    LOG_ERROR("Failed to flush tiles under " + m_base_dir + " because: " + e.what());
+  }
+  // whatever couldn't be written no longer counts against a shared budget
+  if (m_budget) {
+    m_budget->release(m_buffered);
+  }
+}
+
+void tile_writer::purge(const std::string &base_dir) {
+  if (tile_archive::is_archive(base_dir)) {
+    if (bfs::exists(base_dir)) {
+      LOG_WARN("Existing " + base_dir + " will be purged of data.");
+      bfs::remove(base_dir);
+    }
+    const bfs::path dir = bfs::path(base_dir).parent_path();
+    if (!dir.empty()) {
+      bfs::create_directories(dir);
+    }
+    return;
+  }
   if (bfs::exists(base_dir) && !bfs::is_empty(base_dir)) {
     LOG_WARN("Non-empty " + base_dir + " will be purged of data.");
     bfs::remove_all(base_dir);
@@ -23,52 +234,387 @@ tile_writer::tile_writer(std::string base_dir, std::string suffix, size_t max_fd
   bfs::create_directories(base_dir);
 }
 
+size_t tile_writer::raise_fd_limit(size_t num_fds) {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) < 0) {
+    std::string error(strerror(errno));
+    throw std::runtime_error("Failed to get the open file limit because: " + error);
+  }
+
+  if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < num_fds) {
+    rlim_t wanted = num_fds;
+    if (limit.rlim_max != RLIM_INFINITY && limit.rlim_max < wanted) {
+      wanted = limit.rlim_max;
+    }
+    limit.rlim_cur = wanted;
+    if (setrlimit(RLIMIT_NOFILE, &limit) < 0) {
+      std::string error(strerror(errno));
+      LOG_WARN("Failed to raise the open file limit because: " + error);
+      getrlimit(RLIMIT_NOFILE, &limit);
+    }
+  }
+
+  if (limit.rlim_cur == RLIM_INFINITY) {
+    return std::numeric_limits<size_t>::max();
+  }
+  return limit.rlim_cur;
+}
+
+std::vector<std::string> tile_writer::carry_over(const std::string &src_dir,
+                                                const std::string &dst_dir,
+                                                const std::string &extension,
+                                                compression codec) {
+  if (tile_archive::is_archive(src_dir) || tile_archive::is_archive(dst_dir)) {
+    std::vector<std::string> names;
+    const auto tiles = scan_tiles(src_dir, extension);
+    for (const auto &t : tiles) {
+      names.push_back(t.path);
+    }
+
+    // an archive can be taken as a whole if it's compressed the right way
+    if (tile_archive::is_archive(src_dir) && tile_archive::is_archive(dst_dir) &&
+        bfs::is_regular_file(src_dir) && tile_archive::open(src_dir)->only(codec)) {
+      const carried how = clone_file(src_dir, dst_dir);
+      LOG_INFO("Carried over " + std::to_string(names.size()) + " " + extension +
+               " tiles by " + (how == carried::kCloned ? "cloning " : "copying ") + src_dir);
+      return names;
+    }
+
+    tile_writer writer(dst_dir, extension.substr(extension.find_first_not_of('.')), 1, 0, codec);
+    for (const auto &t : tiles) {
+      writer.write_to(t.tile_id, tile_archive::read_tile(t.path));
+    }
+    writer.close_all();
+    LOG_INFO("Carried over " + std::to_string(names.size()) + " " + extension +
+             " tiles from " + src_dir + " by copying them into " + dst_dir);
+    return names;
+  }
+
+  std::vector<std::string> files;
+  size_t counts[4] = {0, 0, 0, 0};
+  carry_over_dir(src_dir, dst_dir, extension, codec, files, counts);
+  LOG_INFO("Carried over " + std::to_string(files.size()) + " " + extension +
+           " files from " + src_dir + ": " +
+           std::to_string(counts[int(carried::kLinked)]) + " linked, " +
+           std::to_string(counts[int(carried::kCloned)]) + " cloned, " +
+           std::to_string(counts[int(carried::kCopied)]) + " copied, " +
+           std::to_string(counts[int(carried::kConverted)]) + " converted");
+  return files;
+}
+
+void tile_writer::unshare(const std::string &file_name) {
+  struct stat st;
+  if (stat(file_name.c_str(), &st) != 0 || st.st_nlink <= 1) {
+    return;
+  }
+
+  // copy to the side, then replace the link with the copy in one step.
+  const std::string tmp_name = file_name + ".unshare";
+  clone_file(file_name, tmp_name);
+  if (rename(tmp_name.c_str(), file_name.c_str()) != 0) {
+    std::string error(strerror(errno));
+    unlink(tmp_name.c_str());
+    throw std::runtime_error("Failed to replace " + file_name + " because: " + error);
+  }
+}
+
 void tile_writer::write_to(vb::GraphId tile_id, const std::string &data) {
-  const std::string tile_name = get_name_for_tile(tile_id);
-  const int fd = get_fd_for(tile_id);
+  if (!m_budget) {
+    iovec iov;
+    iov.iov_base = const_cast<char *>(data.data());
+    iov.iov_len = data.size();
+    write_fully(tile_id, &iov, 1);
+    return;
+  }
+
+  // append to the last block, or start a new one if that would overflow it.
+  auto &buffer = m_buffers[tile_id];
+  if (buffer.blocks.empty() ||
+      buffer.blocks.back().size() + data.size() > kBlockSize) {
+    buffer.blocks.emplace_back();
+  }
+  buffer.blocks.back().append(data);
+  buffer.size += data.size();
+  m_buffered += data.size();
 
-  assert(data.size() < std::numeric_limits<ssize_t>::max());
-  ssize_t bytes_left = data.size();
-  const char *ptr = data.data();
+  if (m_budget->add(data.size())) {
+    spill();
+  }
+}
+
+void tile_writer::write_fully(vb::GraphId tile_id, iovec *iov, size_t iovcnt) {
+  trace::span span("write", tile_id, "io");
+  // everything written at once becomes one compressed member or frame
+  std::string compressed;
+  iovec frame;
+  if (m_codec != compression::kNone) {
+    trace::span compress_span("compress", tile_id, "io");
+    compress(m_codec, iov, iovcnt, compressed);
+    frame.iov_base = &compressed[0];
+    frame.iov_len = compressed.size();
+    iov = &frame;
+    iovcnt = 1;
+  }
+
+  // or one record in the archive
+  if (m_archive) {
+    tile_archive::append(archive_fd(), tile_archive::kData, m_codec, tile_id, iov, iovcnt);
+    m_stats.writes += 1;
+    for (size_t i = 0; i < iovcnt; ++i) {
+      m_stats.bytes_written += iov[i].iov_len;
+    }
+    return;
+  }
+
+  // the file is made even if there's nothing to put in it, but writev may
+  // make no progress on empty entries so they're dropped.
+  const int fd = get_fd_for(tile_id);
+  size_t kept = 0;
+  for (size_t i = 0; i < iovcnt; ++i) {
+    if (iov[i].iov_len > 0) {
+      iov[kept++] = iov[i];
+    }
+  }
+  iovcnt = kept;
 
-  while (bytes_left > 0) {
-    ssize_t n = write(fd, ptr, bytes_left);
+  while (iovcnt > 0) {
+    const int count = int(std::min(iovcnt, size_t(IOV_MAX)));
+    ssize_t n = writev(fd, iov, count);
 
     if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
       std::string error(strerror(errno));
-      throw std::runtime_error("Failed to write " + tile_name + " because: " + error);
+      throw std::runtime_error("Failed to write " + get_name_for_tile(tile_id) +
+                               " because: " + error);
 
     } else if (n == 0) {
-      LOG_WARN("Making no progress writing " + tile_name);
+      throw std::runtime_error("Failed to write " + get_name_for_tile(tile_id) +
+                               " because: no progress was made");
 
     } else {
-      bytes_left -= n;
-      ptr += n;
+      m_stats.writes += 1;
+      m_stats.bytes_written += n;
+
+      // skip over everything which was written, which might end part way
+      // through an entry.
+      size_t written = n;
+      while (iovcnt > 0 && written >= iov->iov_len) {
+        written -= iov->iov_len;
+        ++iov;
+        --iovcnt;
+      }
+      if (written > 0) {
+        iov->iov_base = static_cast<char *>(iov->iov_base) + written;
+        iov->iov_len -= written;
+      }
     }
   }
 }
 
+void tile_writer::flush(vb::GraphId tile_id) {
+  auto itr = m_buffers.find(tile_id);
+  if (itr == m_buffers.end()) {
+    return;
+  }
+
+  auto &blocks = itr->second.blocks;
+  std::vector<iovec> iov(blocks.size());
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    iov[i].iov_base = &blocks[i][0];
+    iov[i].iov_len = blocks[i].size();
+  }
+  write_fully(tile_id, iov.data(), iov.size());
+
+  m_buffered -= itr->second.size;
+  m_budget->release(itr->second.size);
+  m_buffers.erase(itr);
+}
+
+void tile_writer::spill() {
+  // write out the largest buffers first, as they give the most memory back
+  // for each file opened. go down to half the budget so that the next few
+  // writes don't immediately trigger another spill, or as far as this
+  // writer can if others hold most of it.
+  std::vector<std::pair<size_t, vb::GraphId> > sizes;
+  sizes.reserve(m_buffers.size());
+  for (const auto &entry : m_buffers) {
+    sizes.emplace_back(entry.second.size, entry.first);
+  }
+  std::sort(sizes.begin(), sizes.end(),
+            [](const std::pair<size_t, vb::GraphId> &a,
+               const std::pair<size_t, vb::GraphId> &b) {
+              return a.first > b.first;
+            });
+
+  for (const auto &entry : sizes) {
+    if (m_budget->used() <= m_budget->limit() / 2) {
+      break;
+    }
+    flush(entry.second);
+  }
+}
+
+void tile_writer::write_tile(vb::GraphId tile_id, const std::string &name) {
+  std::string archive;
+  if (m_archive || tile_archive::archive_of(name, archive) || compression_of(name) != m_codec) {
+    write_to(tile_id, tile_archive::read_tile(name));
+    return;
+  }
+
+  const std::string target = get_name_for_tile(tile_id);
+  bfs::create_directories(bfs::path(target).parent_path());
+  if (link(name.c_str(), target.c_str()) != 0) {
+    // e.g: a different filesystem or too many links already
+    clone_file(name, target);
+  }
+}
+
+void tile_writer::remove(vb::GraphId tile_id) {
+  auto itr = m_buffers.find(tile_id);
+  if (itr != m_buffers.end()) {
+    m_buffered -= itr->second.size;
+    m_budget->release(itr->second.size);
+    m_buffers.erase(itr);
+  }
+
+  if (m_archive) {
+    tile_archive::append(archive_fd(), tile_archive::kRemove, m_codec, tile_id, nullptr, 0);
+    return;
+  }
+
+  auto fd_itr = m_fds.find(tile_id);
+  if (fd_itr != m_fds.end()) {
+    const int fd = fd_itr->second.fd;
+    m_lru.erase(fd_itr->second.lru);
+    m_fds.erase(fd_itr);
+    close_fd(fd);
+  }
+  bfs::remove(get_name_for_tile(tile_id));
+}
+
 void tile_writer::close_all() {
-  while (m_fds.size() > 0) {
-    evict_last_fd();
+  while (!m_buffers.empty()) {
+    flush(m_buffers.begin()->first);
+  }
+  if (m_archive_fd >= 0) {
+    const int fd = m_archive_fd;
+    m_archive_fd = -1;
+    close_fd(fd);
+  }
+  while (!m_fds.empty()) {
+    auto itr = m_fds.begin();
+    const int fd = itr->second.fd;
+    m_lru.erase(itr->second.lru);
+    m_fds.erase(itr);
+    close_fd(fd);
+  }
+}
+
+void tile_writer::write_index(const std::string &base_dir) {
+  if (!tile_archive::is_archive(base_dir) || !bfs::exists(base_dir)) {
+    return;
+  }
+  const int fd = open(base_dir.c_str(), O_RDWR | O_APPEND);
+  if (fd < 0) {
+    std::string error(strerror(errno));
+    throw std::runtime_error("Failed to open " + base_dir + " because: " + error);
+  }
+  try {
+    tile_archive::append_index(fd);
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+  if (close(fd) != 0) {
+    std::string error(strerror(errno));
+    throw std::runtime_error("Failed to close " + base_dir + " because: " + error);
+  }
+}
+
+off_t tile_writer::flushed_size(vb::GraphId tile_id) {
+  if (m_archive) {
+    throw std::runtime_error("Can't checkpoint tiles in the archive " + m_base_dir);
+  }
+  flush(tile_id);
+  struct stat st;
+  const std::string tile_name = get_name_for_tile(tile_id);
+  if (stat(tile_name.c_str(), &st) != 0) {
+    if (errno == ENOENT) {
+      return 0;
+    }
+    std::string error(strerror(errno));
+    throw std::runtime_error("Failed to stat " + tile_name + " because: " + error);
+  }
+  return st.st_size;
+}
+
+void tile_writer::restore(uint8_t level,
+                          const std::unordered_map<vb::GraphId, off_t> &sizes) {
+  if (m_archive) {
+    throw std::runtime_error("Can't resume tiles in the archive " + m_base_dir);
+  }
+  const std::string extension = m_suffix[0] == '.' ? m_suffix : "." + m_suffix;
+  size_t found = 0;
+  for (const auto &file : scan_tiles(m_base_dir, extension)) {
+    if (file.tile_id.level() != level) {
+      continue;
+    }
+    auto itr = sizes.find(file.tile_id);
+    if (itr == sizes.end() || itr->second == 0 || file.path != get_name_for_tile(file.tile_id)) {
+      // started after the checkpoint, or compressed some other way
+      bfs::remove(file.path);
+      continue;
+    }
+    if (file.size < itr->second) {
+      throw std::runtime_error(file.path + " is shorter than at the checkpoint");
+    }
+    if (file.size > itr->second && truncate(file.path.c_str(), itr->second) != 0) {
+      std::string error(strerror(errno));
+      throw std::runtime_error("Failed to truncate " + file.path + " because: " + error);
+    }
+    found += 1;
+  }
+
+  size_t expected = 0;
+  for (const auto &entry : sizes) {
+    expected += entry.second > 0 ? 1 : 0;
+  }
+  if (found != expected) {
+    throw std::runtime_error("Some of the tiles checkpointed under " + m_base_dir + " are missing");
   }
 }
 
 std::string tile_writer::get_name_for_tile(vb::GraphId tile_id) {
   auto suffix = vb::GraphTile::FileSuffix(tile_id);
   auto path = bfs::path(m_base_dir) / suffix;
-  return path.replace_extension(m_suffix).string();
+  return path.replace_extension(m_suffix).string() + compression_suffix(m_codec);
+}
+
+int tile_writer::archive_fd() {
+  if (m_archive_fd < 0) {
+    // a cloned archive is never shared, but one carried over by other means
+    // might be.
+    unshare(m_base_dir);
+    m_archive_fd = open(m_base_dir.c_str(), O_RDWR | O_APPEND | O_CREAT,
+                        S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+    if (m_archive_fd < 0) {
+      std::string error(strerror(errno));
+      throw std::runtime_error("Failed to open " + m_base_dir + " because: " + error);
+    }
+    m_stats.opens += 1;
+  }
+  return m_archive_fd;
 }
 
 int tile_writer::get_fd_for(vb::GraphId tile_id) {
   auto itr = m_fds.find(tile_id);
   if (itr != m_fds.end()) {
-    // update the LRU counter for this entry to make it the most recently used
-    // item (unless it already is).
-    if (itr->second.lru != m_max_lru) {
-      m_max_lru += 1;
-      itr->second.lru = m_max_lru;
-    }
+    // move this entry to the front of the list to make it the most recently
+    // used item.
+    m_lru.splice(m_lru.begin(), m_lru, itr->second.lru);
+    m_stats.hits += 1;
     return itr->second.fd;
 
   } else {
@@ -77,6 +623,7 @@ int tile_writer::get_fd_for(vb::GraphId tile_id) {
 }
 
 int tile_writer::make_fd_for(vb::GraphId tile_id) {
+  trace::span span("open", tile_id, "io");
   while (m_fds.size() >= m_max_fds) {
     evict_last_fd();
   }
@@ -85,6 +632,15 @@ int tile_writer::make_fd_for(vb::GraphId tile_id) {
   // first, assume that the file exists and try to open it.
   int fd = open(tile_name.c_str(), O_WRONLY | O_APPEND);
 
+  // a file carried over from a previous release may still be linked to it,
+  // in which case it needs a copy of its own before being appended to.
+  struct stat st;
+  if (fd >= 0 && fstat(fd, &st) == 0 && st.st_nlink > 1) {
+    close(fd);
+    unshare(tile_name);
+    fd = open(tile_name.c_str(), O_WRONLY | O_APPEND);
+  }
+
   // if it doesn't exist, then try to create it
   if (fd < 0 && errno == ENOENT) {
     bfs::path p(tile_name);
@@ -98,34 +654,31 @@ int tile_writer::make_fd_for(vb::GraphId tile_id) {
     throw std::runtime_error("Failed to open " + tile_name + " because: " + error);
   }
 
-  m_fds.emplace(tile_id, lru_fd{fd, 0});
+  m_lru.push_front(tile_id);
+  m_fds.emplace(tile_id, lru_fd{fd, m_lru.begin()});
+  m_stats.opens += 1;
   return fd;
 }
 
 void tile_writer::evict_last_fd() {
-  const auto end = m_fds.end();
-  auto min_itr = end;
-  for (auto itr = m_fds.begin(); itr != end; ++itr) {
-    if (min_itr == end || itr->second.lru < min_itr->second.lru) {
-      min_itr = itr;
-    }
+  if (m_lru.empty()) {
+    return;
   }
-  if (min_itr != end) {
-    int fd = min_itr->second.fd;
-    size_t lru = min_itr->second.lru;
 
-    int status = close(fd);
-    if (status < 0) {
-      std::string error(strerror(errno));
-      throw std::runtime_error("Failed to close fd " + std::to_string(fd) + " because: " + error);
-    }
-    m_fds.erase(min_itr);
+  // the least recently used tile is at the back of the list.
+  auto itr = m_fds.find(m_lru.back());
+  assert(itr != m_fds.end());
+  close_fd(itr->second.fd);
+  m_fds.erase(itr);
+  m_lru.pop_back();
+  m_stats.evictions += 1;
+}
 
-    // subtract the minimum amount from each record to keep them from growing
-    // without bound.
-    for (auto &entry : m_fds) {
-      entry.second.lru -= lru;
-    }
+void tile_writer::close_fd(int fd) {
+  int status = close(fd);
+  if (status < 0) {
+    std::string error(strerror(errno));
+    throw std::runtime_error("Failed to close fd " + std::to_string(fd) + " because: " + error);
   }
 }
 
@@ -0,0 +1,174 @@
+#include "osmlr/util/trace.hpp"
+#include "osmlr/util/json_writer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace vb = valhalla::baldr;
+
+namespace osmlr {
+namespace util {
+
+constexpr size_t trace::kDefaultEventsPerThread;
+constexpr uint64_t trace::kNoTile;
+std::atomic<bool> trace::s_enabled(false);
+
+namespace {
+
+struct event {
+  const char *name, *category;
+  uint64_t tile, start, duration;
+};
+
+// the events of one thread, or of a succession of threads if each one
+// exits before the next starts.
+struct buffer {
+  uint32_t tid;
+  std::string name;
+  std::vector<event> events;
+  // events ever recorded. once this passes the size of the buffer, the
+  // oldest events are overwritten.
+  uint64_t recorded;
+};
+
+struct recorder {
+  std::mutex lock;
+  std::chrono::steady_clock::time_point epoch;
+  size_t events_per_thread;
+  std::vector<std::unique_ptr<buffer> > buffers;
+  // buffers of threads which have exited, to be given to new threads.
+  std::vector<buffer *> free_buffers;
+};
+
+// never destroyed, so that threads exiting during static destruction can
+// still give back their buffers.
+recorder &get_recorder() {
+  static recorder *r = new recorder;
+  return *r;
+}
+
+// a thread's buffer, handed back when the thread exits.
+struct lease {
+  buffer *held = nullptr;
+  ~lease() {
+    if (held != nullptr) {
+      auto &r = get_recorder();
+      std::lock_guard<std::mutex> guard(r.lock);
+      r.free_buffers.push_back(held);
+    }
+  }
+};
+thread_local lease t_lease;
+
+buffer &local_buffer() {
+  if (t_lease.held == nullptr) {
+    auto &r = get_recorder();
+    std::lock_guard<std::mutex> guard(r.lock);
+    if (!r.free_buffers.empty()) {
+      t_lease.held = r.free_buffers.back();
+      r.free_buffers.pop_back();
+    } else {
+      std::unique_ptr<buffer> b(new buffer);
+      b->tid = uint32_t(r.buffers.size() + 1);
+      b->name = "thread " + std::to_string(b->tid);
+      b->events.resize(r.events_per_thread);
+      b->recorded = 0;
+      r.buffers.push_back(std::move(b));
+      t_lease.held = r.buffers.back().get();
+    }
+  }
+  return *t_lease.held;
+}
+
+// microseconds, which is what the trace format wants.
+void write_time(json_writer &out, uint64_t nanoseconds) {
+  out.coordinate(nanoseconds / 1000.0);
+}
+
+} // anonymous namespace
+
+void trace::start(size_t events_per_thread) {
+  auto &r = get_recorder();
+  {
+    std::lock_guard<std::mutex> guard(r.lock);
+    r.epoch = std::chrono::steady_clock::now();
+    r.events_per_thread = std::max(events_per_thread, size_t(1));
+  }
+  s_enabled.store(true);
+}
+
+void trace::name_thread(const std::string &name) {
+  if (enabled()) {
+    local_buffer().name = name;
+  }
+}
+
+uint64_t trace::now() {
+  return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - get_recorder().epoch).count());
+}
+
+void trace::record(const char *name, const char *category, uint64_t tile,
+                   uint64_t start) {
+  auto &b = local_buffer();
+  b.events[b.recorded % b.events.size()] = event{name, category, tile, start, now() - start};
+  b.recorded += 1;
+}
+
+void trace::write_json(const std::string &file_name) {
+  std::ofstream file(file_name, std::ios::out | std::ios::trunc | std::ios::binary);
+  auto &r = get_recorder();
+  std::lock_guard<std::mutex> guard(r.lock);
+
+  json_writer out(3);
+  out.raw("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  bool first = true;
+  uint64_t dropped = 0;
+  for (const auto &b : r.buffers) {
+    if (!first) out.raw(',');
+    first = false;
+    out.raw("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":").number(b->tid)
+       .raw(",\"args\":{\"name\":").quoted(b->name).raw("}}");
+
+    // oldest first, from where the ring buffer wrapped to if it did
+    const uint64_t size = b->events.size();
+    const uint64_t begin = b->recorded > size ? b->recorded - size : 0;
+    dropped += begin;
+    for (uint64_t i = begin; i < b->recorded; ++i) {
+      const auto &e = b->events[i % size];
+      out.raw(",{\"name\":").quoted(e.name)
+         .raw(",\"cat\":").quoted(e.category)
+         .raw(",\"ph\":\"X\",\"pid\":1,\"tid\":").number(b->tid)
+         .raw(",\"ts\":");
+      write_time(out, e.start);
+      out.raw(",\"dur\":");
+      write_time(out, e.duration);
+      if (e.tile != kNoTile) {
+        const vb::GraphId tile(e.tile);
+        out.raw(",\"args\":{\"tile\":\"").number(tile.level()).raw('/')
+           .number(tile.tileid()).raw("\"}");
+      }
+      out.raw('}');
+
+      // don't hold the whole trace in memory
+      if (out.size() > (1 << 20)) {
+        file.write(out.str().data(), out.size());
+        out.clear();
+      }
+    }
+  }
+  out.raw("],\"otherData\":{\"dropped_events\":\"").number(dropped).raw("\"}}\n");
+  file.write(out.str().data(), out.size());
+  file.close();
+  if (!file) {
+    throw std::runtime_error("Unable to write trace to " + file_name);
+  }
+}
+
+} // namespace util
+} // namespace osmlr
@@ -0,0 +1,147 @@
+#include "test.hpp"
+#include "osmlr/util/feature_collection.hpp"
+
+#include <string>
+
+using namespace osmlr::util;
+
+namespace {
+
+const std::string kFeatureA =
+  "{\"type\":\"Feature\",\"geometry\":{\"type\":\"LineString\",\"coordinates\":[[0,0],[1,1]]},"
+  "\"properties\":{\"osmlr_id\":12345,\"name\":\"a\"}}";
+const std::string kFeatureB =
+  "{\"type\":\"Feature\",\"geometry\":{\"type\":\"LineString\",\"coordinates\":[[1,1],[2,2]]},"
+  "\"properties\":{\"osmlr_id\":\"67890\"}}";
+
+std::string collection(const std::string &features) {
+  return "{\"type\":\"FeatureCollection\",\"features\":[" + features + "]}";
+}
+
+void test_scan() {
+  const std::string json = collection(kFeatureA + "," + kFeatureB);
+  collection_layout layout;
+  test::assert_bool(scan_collection(json, layout), "Collection should scan");
+  test::assert_bool(layout.features.size() == 2, "Should find both features");
+  test::assert_bool(json.substr(layout.features[0].begin,
+                                layout.features[0].end - layout.features[0].begin) == kFeatureA,
+                    "First feature's range is wrong");
+  test::assert_bool(json.substr(layout.features[1].begin,
+                                layout.features[1].end - layout.features[1].begin) == kFeatureB,
+                    "Second feature's range is wrong");
+  test::assert_bool(json[layout.features_begin - 1] == '[' && json[layout.features_end] == ']',
+                    "Features array bounds are wrong");
+}
+
+void test_quoted_id() {
+  collection_layout layout;
+  test::assert_bool(scan_collection(collection(kFeatureA + "," + kFeatureB), layout),
+                    "Collection should scan");
+  test::assert_bool(layout.features[0].osmlr_id == 12345, "Unquoted osmlr_id is wrong");
+  test::assert_bool(layout.features[1].osmlr_id == 67890, "Quoted osmlr_id is wrong");
+}
+
+void test_strings() {
+  // brackets, braces and escaped quotes in strings mustn't change the nesting
+  const std::string feature =
+    "{\"type\":\"Feature\",\"properties\":{\"name\":\"a \\\"]}\\\" b ]} [{\","
+    "\"osmlr_id\":7,\"note\":\"\\\\\"}}";
+  const std::string json = collection(feature + "," + kFeatureA);
+  collection_layout layout;
+  test::assert_bool(scan_collection(json, layout), "Collection should scan");
+  test::assert_bool(layout.features.size() == 2, "Should find both features");
+  test::assert_bool(json.substr(layout.features[0].begin,
+                                layout.features[0].end - layout.features[0].begin) == feature,
+                    "Feature with brackets in strings has the wrong range");
+  test::assert_bool(layout.features[0].osmlr_id == 7 && layout.features[1].osmlr_id == 12345,
+                    "osmlr_ids are wrong");
+}
+
+void test_nested_id() {
+  // only the osmlr_id in a feature's properties counts
+  const std::string feature =
+    "{\"type\":\"Feature\",\"osmlr_id\":1,\"properties\":{\"other\":{\"osmlr_id\":2},\"osmlr_id\":3}}";
+  collection_layout layout;
+  test::assert_bool(scan_collection(collection(feature), layout), "Collection should scan");
+  test::assert_bool(layout.features.size() == 1 && layout.features[0].osmlr_id == 3,
+                    "Should use the osmlr_id of the properties");
+}
+
+void test_empty() {
+  const std::string json = collection("");
+  collection_layout layout;
+  test::assert_bool(scan_collection(json, layout), "Empty collection should scan");
+  test::assert_bool(layout.features.empty(), "Empty collection has no features");
+  test::assert_bool(layout.features_begin == layout.features_end,
+                    "Empty features array should be empty");
+}
+
+void test_missing_id() {
+  const std::string feature = "{\"type\":\"Feature\",\"properties\":{\"name\":\"osmlr_id\"}}";
+  collection_layout layout;
+  test::assert_bool(!scan_collection(collection(kFeatureA + "," + feature), layout),
+                    "Feature without an osmlr_id should fail the scan");
+  test::assert_bool(!scan_collection(collection("{\"type\":\"Feature\",\"properties\":{\"osmlr_id\":\"\"}}"), layout),
+                    "Feature with an empty osmlr_id should fail the scan");
+}
+
+void test_malformed() {
+  collection_layout layout;
+  test::assert_bool(!scan_collection("{\"type\":\"FeatureCollection\"}", layout),
+                    "Collection without features should fail the scan");
+  test::assert_bool(!scan_collection(collection(kFeatureA).substr(1), layout),
+                    "Unbalanced collection should fail the scan");
+  test::assert_bool(!scan_collection("{\"features\":[" + kFeatureA, layout),
+                    "Truncated collection should fail the scan");
+  test::assert_bool(!scan_collection("{\"features\":[{\"properties\":{\"name\":\"a]}", layout),
+                    "Unterminated string should fail the scan");
+}
+
+void test_end() {
+  size_t cut = 0;
+  bool empty = false;
+  const std::string json = collection(kFeatureA);
+  test::assert_bool(find_collection_end(json, cut, empty), "Should find the end");
+  test::assert_bool(cut == json.size() - 2 && !empty, "End of collection is wrong");
+
+  const std::string spaced = "{\"features\":[" + kFeatureA + "\n]\n}\n \t\n";
+  test::assert_bool(find_collection_end(spaced, cut, empty), "Should find the end past whitespace");
+  test::assert_bool(spaced[cut] == ']' && cut == spaced.find("\n]") + 1 && !empty,
+                    "End of collection with whitespace is wrong");
+
+  const std::string empties[] = {collection(""), "{\"features\":[ \n ] }\n"};
+  for (const auto &e : empties) {
+    test::assert_bool(find_collection_end(e, cut, empty), "Should find the end of an empty collection");
+    test::assert_bool(e[cut] == ']' && empty, "Empty collection should be empty");
+  }
+}
+
+void test_no_end() {
+  size_t cut = 0;
+  bool empty = false;
+  test::assert_bool(!find_collection_end("", cut, empty), "Empty file has no end");
+  test::assert_bool(!find_collection_end("  \n", cut, empty), "Whitespace has no end");
+  test::assert_bool(!find_collection_end("]}", cut, empty), "Nothing before the end");
+  test::assert_bool(!find_collection_end(collection(kFeatureA) + ",", cut, empty),
+                    "Trailing garbage has no end");
+  test::assert_bool(!find_collection_end("{\"features\":[" + kFeatureA, cut, empty),
+                    "Truncated collection has no end");
+}
+
+}
+
+int main() {
+  test::suite suite("feature_collection");
+
+  suite.test(TEST_CASE(test_scan));
+  suite.test(TEST_CASE(test_quoted_id));
+  suite.test(TEST_CASE(test_strings));
+  suite.test(TEST_CASE(test_nested_id));
+  suite.test(TEST_CASE(test_empty));
+  suite.test(TEST_CASE(test_missing_id));
+  suite.test(TEST_CASE(test_malformed));
+  suite.test(TEST_CASE(test_end));
+  suite.test(TEST_CASE(test_no_end));
+
+  return suite.tear_down();
+}
@@ -0,0 +1,128 @@
+#include "test.hpp"
+#include "osmlr/util/segment_index.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace vb = valhalla::baldr;
+using osmlr::util::segment_index;
+
+namespace {
+
+// a repeatable sequence of numbers, so that failures can be reproduced.
+struct lcg {
+  uint64_t state;
+  uint32_t next(uint32_t range) {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    return uint32_t(state >> 33) % range;
+  }
+};
+
+// small boxes clustered in a few degrees, so that queries find some of them.
+std::vector<segment_index::item> make_items(size_t count, lcg &random) {
+  std::vector<segment_index::item> items;
+  for (size_t i = 0; i < count; ++i) {
+    const int32_t lng = 1000000000 + int32_t(random.next(30000000));
+    const int32_t lat = 500000000 + int32_t(random.next(30000000));
+    const segment_index::box b{lng, lat, lng + int32_t(random.next(500000)),
+                               lat + int32_t(random.next(500000))};
+    items.push_back(segment_index::item{b, vb::GraphId(756425, 2, i)});
+  }
+  return items;
+}
+
+std::vector<uint64_t> sorted(const std::vector<vb::GraphId> &ids) {
+  std::vector<uint64_t> values;
+  for (const auto &id : ids) {
+    values.push_back(id.value);
+  }
+  std::sort(values.begin(), values.end());
+  return values;
+}
+
+// every item whose box intersects the query, as the index should find them.
+std::vector<uint64_t> brute_force(const std::vector<segment_index::item> &items,
+                                  double min_lng, double min_lat, double max_lng, double max_lat) {
+  const segment_index::box q{int32_t(std::floor(min_lng * 1.0e7)), int32_t(std::floor(min_lat * 1.0e7)),
+                             int32_t(std::ceil(max_lng * 1.0e7)), int32_t(std::ceil(max_lat * 1.0e7))};
+  std::vector<vb::GraphId> ids;
+  for (const auto &i : items) {
+    if (q.intersects(i.bbox)) {
+      ids.push_back(i.id);
+    }
+  }
+  return sorted(ids);
+}
+
+void check_queries(size_t count) {
+  lcg random{count};
+  auto items = make_items(count, random);
+  const auto original = items;
+  test::scratch_dir dir;
+  segment_index::write(dir / "segments.idx", items);
+  segment_index index(dir / "segments.idx");
+  test::assert_bool(index.size() == count, "Index of " + std::to_string(count) +
+                    " items has the wrong size");
+
+  // everything, nothing, and boxes of all sizes around the items
+  test::assert_bool(sorted(index.query(-180, -90, 180, 90)) ==
+                    brute_force(original, -180, -90, 180, 90),
+                    "Index of " + std::to_string(count) + " items should find all of them");
+  test::assert_bool(index.query(-10, -10, -5, -5).empty(),
+                    "Index of " + std::to_string(count) + " items found items far from them all");
+  for (size_t q = 0; q < 200; ++q) {
+    const double min_lng = 99.9 + random.next(3200000) * 1.0e-6;
+    const double min_lat = 49.9 + random.next(3200000) * 1.0e-6;
+    const double max_lng = min_lng + random.next(q % 2 ? 100000 : 2000000) * 1.0e-6;
+    const double max_lat = min_lat + random.next(q % 2 ? 100000 : 2000000) * 1.0e-6;
+    test::assert_bool(sorted(index.query(min_lng, min_lat, max_lng, max_lat)) ==
+                      brute_force(original, min_lng, min_lat, max_lng, max_lat),
+                      "Index of " + std::to_string(count) + " items disagrees with a brute force search");
+  }
+
+  // a box which just touches an item finds it
+  if (count > 0) {
+    const auto &b = original.front().bbox;
+    const auto found = sorted(index.query(b.max_lng * 1.0e-7, b.max_lat * 1.0e-7,
+                                          b.max_lng * 1.0e-7 + 0.1, b.max_lat * 1.0e-7 + 0.1));
+    test::assert_bool(std::find(found.begin(), found.end(), original.front().id.value) != found.end(),
+                      "Index of " + std::to_string(count) + " items should find a touching item");
+  }
+}
+
+void test_empty() {
+  check_queries(0);
+}
+
+void test_one() {
+  check_queries(1);
+}
+
+void test_one_node() {
+  check_queries(segment_index::kNodeSize);
+}
+
+void test_two_levels() {
+  check_queries(segment_index::kNodeSize + 1);
+}
+
+void test_many_levels() {
+  check_queries(segment_index::kNodeSize * segment_index::kNodeSize * 3 + 5);
+}
+
+}
+
+int main() {
+  test::suite suite("segment_index");
+
+  suite.test(TEST_CASE(test_empty));
+  suite.test(TEST_CASE(test_one));
+  suite.test(TEST_CASE(test_one_node));
+  suite.test(TEST_CASE(test_two_levels));
+  suite.test(TEST_CASE(test_many_levels));
+
+  return suite.tear_down();
+}
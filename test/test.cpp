@@ -1,9 +1,12 @@
-#include "test.h"
+#include "test.hpp"
 #include "config.h"
 
+#include <boost/filesystem.hpp>
 #include <cstdlib>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
 
 using namespace std;
 
@@ -31,6 +34,26 @@ void suite::test(const string& test_name, test_function function) {
   }
 }
 
+scratch_dir::scratch_dir()
+  : path((boost::filesystem::temp_directory_path() /
+          boost::filesystem::unique_path("osmlr-test-%%%%-%%%%")).string()) {
+  boost::filesystem::create_directories(path);
+}
+
+scratch_dir::~scratch_dir() {
+  boost::system::error_code ec;
+  boost::filesystem::remove_all(path, ec);
+}
+
+string scratch_dir::operator/(const string& name) const {
+  return (boost::filesystem::path(path) / name).string();
+}
+
+string contents(const string& file_name) {
+  ifstream in(file_name, ios::binary);
+  return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
 int suite::tear_down() {
   cout << "=== Failed " << failed << " tests ===" << endl;
   if(failed > 0)
@@ -26,6 +26,19 @@ struct suite {
   size_t failed;
 };
 
+//a fresh empty directory for a test to write to, removed when done with
+struct scratch_dir {
+ public:
+  scratch_dir();
+  ~scratch_dir();
+  //the path of a file within the directory
+  std::string operator/(const std::string& name) const;
+  const std::string path;
+};
+
+//the whole contents of a file, empty if it can't be read
+std::string contents(const std::string& file_name);
+
 template <typename value_t>
 void assert_bool(value_t value, const std::string& message) {
   if (!value) {
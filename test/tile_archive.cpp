@@ -0,0 +1,222 @@
+#include "test.hpp"
+#include "osmlr/util/tile_archive.hpp"
+#include "osmlr/util/tile_writer.hpp"
+
+#include <boost/filesystem.hpp>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace bfs = boost::filesystem;
+namespace vb = valhalla::baldr;
+using namespace osmlr::util;
+
+namespace {
+
+// an archive open for appending records to.
+struct archive_file {
+  explicit archive_file(const std::string &file_name)
+    : fd(open(file_name.c_str(), O_RDWR | O_APPEND | O_CREAT, S_IWUSR | S_IRUSR)) {
+    if (fd < 0) {
+      throw std::runtime_error("Failed to open " + file_name);
+    }
+  }
+  ~archive_file() {
+    close(fd);
+  }
+  void append(tile_archive::record_type type, compression codec, vb::GraphId tile_id,
+              const std::string &data = "") {
+    iovec iov{const_cast<char *>(data.data()), data.size()};
+    tile_archive::append(fd, type, codec, tile_id, &iov, data.empty() ? 0 : 1);
+  }
+  const int fd;
+};
+
+// the number of index records in the archive, walking it by hand.
+size_t count_indexes(const std::string &file_name) {
+  const std::string data = test::contents(file_name);
+  size_t count = 0, pos = 0;
+  while (data.size() - pos >= sizeof(tile_archive::record_header)) {
+    tile_archive::record_header header;
+    memcpy(&header, data.data() + pos, sizeof(header));
+    count += (header.type == tile_archive::kIndex) ? 1 : 0;
+    pos += sizeof(header) + header.length;
+  }
+  return count;
+}
+
+bool ends_with_footer(const std::string &file_name) {
+  const std::string data = test::contents(file_name);
+  return data.size() >= sizeof(tile_archive::footer) &&
+    data.compare(data.size() - sizeof(tile_archive::kMagic), sizeof(tile_archive::kMagic),
+                 tile_archive::kMagic, sizeof(tile_archive::kMagic)) == 0;
+}
+
+// overwrites the type of the first record in the archive.
+void set_first_type(const std::string &file_name, uint32_t type) {
+  std::fstream out(file_name, std::ios::binary | std::ios::in | std::ios::out);
+  out.write(reinterpret_cast<const char *>(&type), sizeof(type));
+  test::assert_bool(out.good(), "Failed to change the first record of " + file_name);
+}
+
+std::string gzip(const std::string &data) {
+  iovec iov{const_cast<char *>(data.data()), data.size()};
+  std::string out;
+  compress(compression::kGzip, &iov, 1, out);
+  return out;
+}
+
+const vb::GraphId kTile(756425, 2, 0), kOther(756426, 2, 0), kRemoved(1000, 1, 0);
+
+// appends the same records to the archive: data in pieces for one tile,
+// another tile, and a tile which is removed after being written.
+void fill(const std::string &file_name) {
+  archive_file archive(file_name);
+  archive.append(tile_archive::kData, compression::kNone, kTile, "abc");
+  archive.append(tile_archive::kData, compression::kNone, kRemoved, "gone");
+  archive.append(tile_archive::kData, compression::kNone, kOther, "xyz");
+  archive.append(tile_archive::kData, compression::kNone, kTile, "def");
+  archive.append(tile_archive::kRemove, compression::kNone, kRemoved);
+  archive.append(tile_archive::kData, compression::kNone, kTile, "gh");
+}
+
+void check(const tile_archive &archive) {
+  test::assert_bool(archive.read(kTile) == "abcdefgh", "Appended data should be read in order");
+  test::assert_bool(archive.size_of(kTile) == 8, "Tile has the wrong size");
+  test::assert_bool(archive.read(kOther) == "xyz", "Other tile has the wrong data");
+  test::assert_bool(archive.read(kRemoved).empty() && archive.size_of(kRemoved) == 0,
+                    "Removed tile should have no data");
+  const auto tiles = archive.tiles();
+  test::assert_bool(tiles.size() == 2 && tiles[0] == kTile && tiles[1] == kOther,
+                    "Archive has the wrong tiles");
+  test::assert_bool(archive.only(compression::kNone), "Archive should be uncompressed");
+}
+
+void test_walk() {
+  test::scratch_dir dir;
+  const std::string file_name = dir / "walk.pack";
+  fill(file_name);
+  test::assert_bool(!ends_with_footer(file_name), "Archive shouldn't have an index yet");
+  check(tile_archive(file_name));
+}
+
+void test_index() {
+  test::scratch_dir dir;
+  const std::string file_name = dir / "index.pack";
+  fill(file_name);
+  {
+    archive_file archive(file_name);
+    tile_archive::append_index(archive.fd);
+  }
+  test::assert_bool(ends_with_footer(file_name), "Archive should end with its index");
+  check(tile_archive(file_name));
+
+  // the index is read instead of the records, so a record the walk would
+  // stop at doesn't matter.
+  set_first_type(file_name, 99);
+  check(tile_archive(file_name));
+  set_first_type(file_name, tile_archive::kData);
+
+  // appending more drops the index until another is written
+  {
+    archive_file archive(file_name);
+    archive.append(tile_archive::kRemove, compression::kNone, kOther);
+  }
+  test::assert_bool(!ends_with_footer(file_name), "Appending should leave no index at the end");
+  {
+    tile_archive archive(file_name);
+    test::assert_bool(archive.read(kOther).empty() && archive.read(kTile) == "abcdefgh",
+                      "Records after an index should be walked");
+  }
+  {
+    archive_file archive(file_name);
+    tile_archive::append_index(archive.fd);
+    tile_archive::append_index(archive.fd);
+  }
+  test::assert_bool(count_indexes(file_name) == 2, "An indexed archive shouldn't be indexed again");
+  tile_archive archive(file_name);
+  test::assert_bool(archive.tiles().size() == 1 && archive.read(kTile) == "abcdefgh",
+                    "Second index has the wrong tiles");
+}
+
+void test_truncated() {
+  // a writer may have stopped part way through a record
+  test::scratch_dir dir;
+  const std::string file_name = dir / "truncated.pack";
+  fill(file_name);
+  {
+    archive_file archive(file_name);
+    archive.append(tile_archive::kData, compression::kNone, kOther, "more");
+  }
+  bfs::resize_file(file_name, bfs::file_size(file_name) - 2);
+  check(tile_archive(file_name));
+}
+
+void test_read_tile() {
+  // each append is a gzip member of its own, and the tile is all of them
+  test::scratch_dir dir;
+  const std::string file_name = dir / "gzip.pack";
+  {
+    archive_file archive(file_name);
+    archive.append(tile_archive::kData, compression::kGzip, kTile, gzip("abc"));
+    archive.append(tile_archive::kData, compression::kGzip, kOther, gzip("xyz"));
+    archive.append(tile_archive::kData, compression::kGzip, kTile, gzip("def"));
+    tile_archive::append_index(archive.fd);
+  }
+  const auto archive = tile_archive::open(file_name);
+  test::assert_bool(archive->only(compression::kGzip), "Archive should only be gzipped");
+  test::assert_bool(archive->read(kTile) == gzip("abc") + gzip("def"),
+                    "Tile should be read as it was written");
+
+  const std::string name = archive->name_of(kTile, ".osmlr.gz");
+  std::string in;
+  test::assert_bool(tile_archive::archive_of(name, in) && in == file_name,
+                    "Tile name should be within the archive");
+  test::assert_bool(tile_archive::read_tile(name) == "abcdef",
+                    "Every gzip member of the tile should be decompressed");
+  test::assert_bool(tile_archive::read_tile(archive->name_of(kOther, ".osmlr.gz")) == "xyz",
+                    "Other tile should be decompressed");
+}
+
+void test_writers() {
+  // several writers append to one archive, which is indexed once they're done
+  test::scratch_dir dir;
+  const std::string file_name = dir / "writers.pack";
+  tile_writer::purge(file_name);
+  {
+    tile_writer first(file_name, "osmlr", 1, 0, compression::kGzip);
+    tile_writer second(file_name, "osmlr", 1, 1 << 20, compression::kGzip);
+    first.write_to(kTile, "abc");
+    second.write_to(kOther, "xyz");
+    first.write_to(kTile, "def");
+    first.close_all();
+    second.close_all();
+  }
+  test::assert_bool(count_indexes(file_name) == 0, "Closing a writer shouldn't index the archive");
+  tile_writer::write_index(file_name);
+  tile_writer::write_index(file_name);
+  test::assert_bool(count_indexes(file_name) == 1 && ends_with_footer(file_name),
+                    "Archive should be indexed once");
+
+  const auto archive = tile_archive::open(file_name);
+  test::assert_bool(tile_archive::read_tile(archive->name_of(kTile, ".osmlr.gz")) == "abcdef",
+                    "First writer's tile has the wrong data");
+  test::assert_bool(tile_archive::read_tile(archive->name_of(kOther, ".osmlr.gz")) == "xyz",
+                    "Second writer's tile has the wrong data");
+}
+
+}
+
+int main() {
+  test::suite suite("tile_archive");
+
+  suite.test(TEST_CASE(test_walk));
+  suite.test(TEST_CASE(test_index));
+  suite.test(TEST_CASE(test_truncated));
+  suite.test(TEST_CASE(test_read_tile));
+  suite.test(TEST_CASE(test_writers));
+
+  return suite.tear_down();
+}
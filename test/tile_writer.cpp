@@ -0,0 +1,107 @@
+#include "test.hpp"
+#include "osmlr/util/tile_writer.hpp"
+
+#include <boost/filesystem.hpp>
+#include <string>
+
+namespace bfs = boost::filesystem;
+namespace vb = valhalla::baldr;
+using namespace osmlr::util;
+
+namespace {
+
+const vb::GraphId kTile(756425, 2, 0);
+
+void test_empty_write() {
+  test::scratch_dir dir;
+  tile_writer writer(dir / "tiles", "osmlr", 4);
+  writer.write_to(kTile, "");
+  writer.close_all();
+  const std::string name = writer.get_name_for_tile(kTile);
+  test::assert_bool(bfs::exists(name), "Empty write should still make the tile");
+  test::assert_bool(bfs::file_size(name) == 0, "Empty write should leave the tile empty");
+}
+
+void test_empty_buffered_write() {
+  test::scratch_dir dir;
+  tile_writer writer(dir / "tiles", "osmlr", 4, 1 << 20);
+  writer.write_to(kTile, "");
+  writer.write_to(kTile, "");
+  writer.close_all();
+  const std::string name = writer.get_name_for_tile(kTile);
+  test::assert_bool(bfs::exists(name), "Empty buffered write should still make the tile");
+  test::assert_bool(bfs::file_size(name) == 0, "Empty buffered write should leave the tile empty");
+}
+
+void test_empty_write_tile() {
+  // converting an empty compressed tile writes nothing to the new one
+  test::scratch_dir dir;
+  tile_writer compressed(dir / "src", "osmlr", 4, 0, compression::kGzip);
+  compressed.write_to(kTile, "");
+  compressed.close_all();
+
+  tile_writer writer(dir / "dst", "osmlr", 4);
+  writer.write_tile(kTile, compressed.get_name_for_tile(kTile));
+  writer.close_all();
+  test::assert_bool(test::contents(writer.get_name_for_tile(kTile)).empty(),
+                    "Converted empty tile should be empty");
+}
+
+void test_write() {
+  test::scratch_dir dir;
+  const vb::GraphId other(756426, 2, 0);
+  tile_writer unbuffered(dir / "a", "osmlr", 1);
+  tile_writer buffered(dir / "b", "osmlr", 1, 4);
+  for (auto *writer : {&unbuffered, &buffered}) {
+    writer->write_to(kTile, "abc");
+    writer->write_to(other, "");
+    writer->write_to(kTile, "");
+    writer->write_to(other, "xyz");
+    writer->write_to(kTile, "defgh");
+    writer->close_all();
+    test::assert_bool(test::contents(writer->get_name_for_tile(kTile)) == "abcdefgh",
+                      "Tile has the wrong contents");
+    test::assert_bool(test::contents(writer->get_name_for_tile(other)) == "xyz",
+                      "Other tile has the wrong contents");
+  }
+}
+
+void test_shared_budget() {
+  // writers sharing a budget keep what they buffer between them within it
+  test::scratch_dir dir;
+  auto budget = std::make_shared<buffer_budget>(64);
+  const vb::GraphId other(756426, 2, 0);
+  std::string expected;
+  {
+    tile_writer first(dir / "a", "osmlr", 1, budget);
+    tile_writer second(dir / "b", "osmlr", 1, budget);
+    for (int i = 0; i < 100; ++i) {
+      const std::string data = std::to_string(i) + ",";
+      first.write_to(i % 2 ? kTile : other, data);
+      second.write_to(kTile, data);
+      expected += data;
+      test::assert_bool(budget->used() <= budget->limit(),
+                        "Writers should stay within their shared budget");
+    }
+    test::assert_bool(budget->used() > 0, "Writers should buffer within their budget");
+    first.close_all();
+    test::assert_bool(budget->used() > 0, "Second writer should still be buffering");
+  }
+  test::assert_bool(budget->used() == 0, "Closed writers should give back their budget");
+  test::assert_bool(test::contents(tile_writer(dir / "b", "osmlr", 1).get_name_for_tile(kTile)) == expected,
+                    "Writer sharing a budget has the wrong contents");
+}
+
+}
+
+int main() {
+  test::suite suite("tile_writer");
+
+  suite.test(TEST_CASE(test_empty_write));
+  suite.test(TEST_CASE(test_empty_buffered_write));
+  suite.test(TEST_CASE(test_empty_write_tile));
+  suite.test(TEST_CASE(test_write));
+  suite.test(TEST_CASE(test_shared_budget));
+
+  return suite.tear_down();
+}